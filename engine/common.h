@@ -484,6 +484,17 @@ int		IsColorEscape(std::u32string_view str);
 void	ReadColorEscape(char const* str, col3_t out);
 std::u32string_view ReadColorEscape(std::u32string_view str, col3_t out);
 
+// Run of text between color escapes, the escape that precedes it (if any) sets its color
+struct ColorEscapeSpan {
+	size_t	begin = 0;
+	size_t	end = 0;
+	bool	hasColor = false;
+	col3_t	color = {};
+};
+
+// Split a string into spans of text, excluding the escapes, in a single pass
+void	TokenizeColorEscapes(std::u32string_view str, std::vector<ColorEscapeSpan>& spans);
+
 char*	_AllocString(const char* str, const char* file, int line);
 #define AllocString(s) _AllocString(s, __FILE__, __LINE__)
 char*	_AllocStringLen(size_t len, const char* file, int line);
@@ -525,3 +536,4 @@ char* NarrowUTF8String(const wchar_t* str);
 #include "common/keylist.h"
 #include "common/streams.h"
 #include "common/console.h"
+#include "common/zones.h"
@@ -247,6 +247,23 @@ int IsColorEscape(std::u32string_view str)
 	return 0;
 }
 
+// Value of a hex digit that has already been validated, '0'-'9' map through the low nibble and
+// both letter cases have bit 6 set which adds the 9 needed to reach 10-15
+template <class CharT>
+static inline int HexDigitValue(CharT ch)
+{
+	return (int)((ch & 0xF) + 9 * ((ch >> 6) & 1));
+}
+
+template <class CharT>
+static inline void ReadHexColor(const CharT* digits, col3_t out)
+{
+	for (int c = 0; c < 3; c++) {
+		int val = (HexDigitValue(digits[c * 2]) << 4) | HexDigitValue(digits[c * 2 + 1]);
+		out[c] = val / 255.0f;
+	}
+}
+
 void ReadColorEscape(const char* str, col3_t out)
 {
 	int len = IsColorEscape(str);
@@ -255,14 +272,8 @@ void ReadColorEscape(const char* str, col3_t out)
 		VectorCopy(colorEscape[str[1] - '0'], out);
 		break;
 	case 8:
-	{
-		int xr, xg, xb;
-		sscanf(str + 2, "%2x%2x%2x", &xr, &xg, &xb);
-		out[0] = xr / 255.0f;
-		out[1] = xg / 255.0f;
-		out[2] = xb / 255.0f;
-	}
-	break;
+		ReadHexColor(str + 2, out);
+		break;
 	}
 }
 
@@ -274,22 +285,41 @@ std::u32string_view ReadColorEscape(std::u32string_view str, col3_t out)
 		VectorCopy(colorEscape[str[1] - U'0'], out);
 		break;
 	case 8:
-		{
-			int xr, xg, xb;
-			char buf[7]{};
-			for (size_t i = 0; i < 6; ++i) {
-				buf[i] = (char)str[i + 2];
-			}
-			sscanf(buf, "%2x%2x%2x", &xr, &xg, &xb);
-			out[0] = xr / 255.0f;
-			out[1] = xg / 255.0f;
-			out[2] = xb / 255.0f;
-		}
+		ReadHexColor(str.data() + 2, out);
 		break;
 	}
 	return str.substr(len);
 }
 
+void TokenizeColorEscapes(std::u32string_view str, std::vector<ColorEscapeSpan>& spans)
+{
+	spans.clear();
+	ColorEscapeSpan span{};
+	size_t idx = 0;
+	while (idx < str.size()) {
+		// Skip ahead to the next escape candidate
+		size_t caret = str.find(U'^', idx);
+		if (caret == std::u32string_view::npos) {
+			break;
+		}
+		int escLen = IsColorEscape(str.substr(caret));
+		if (!escLen) {
+			idx = caret + 1;
+			continue;
+		}
+
+		// Close the text before the escape and start a new span with its color
+		span.end = caret;
+		spans.push_back(span);
+		span.begin = caret + escLen;
+		span.hasColor = true;
+		ReadColorEscape(str.substr(caret), span.color);
+		idx = span.begin;
+	}
+	span.end = str.size();
+	spans.push_back(span);
+}
+
 // ================
 // String Functions
 // ================
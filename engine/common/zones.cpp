@@ -0,0 +1,172 @@
+// SimpleGraphic Engine
+// (c) David Gowor, 2014
+//
+// Module: Zones
+//
+
+#include "common.h"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+// =======
+// Classes
+// =======
+
+// Ring of the most recent zones of one thread; kept after the thread exits so its zones can still be collected, until a new thread reuses it
+struct zoneBuffer_s {
+	static constexpr size_t RING_SIZE = 1 << 16;
+
+	std::mutex mutex;				// Only contended while collecting
+	std::vector<zoneEvent_s> ring;
+	size_t	head = 0;				// Total zones written
+	unsigned int id = 0;
+	std::string name;
+};
+
+struct zoneThread_s {
+	static constexpr int MAX_DEPTH = 64;
+
+	~zoneThread_s();
+
+	std::shared_ptr<zoneBuffer_s> buffer;	// Allocated on the thread's first recorded zone
+	std::string name;
+	int		depth = 0;
+	const char* names[MAX_DEPTH] = { };
+	int64_t	starts[MAX_DEPTH] = { };
+};
+
+std::atomic<bool> zone_enabled = false;
+
+static std::mutex zone_registryMutex;
+static std::vector<std::shared_ptr<zoneBuffer_s>> zone_buffers;		// Guarded by zone_registryMutex
+static std::vector<zoneBuffer_s*> zone_freeBuffers;					// Buffers of exited threads, guarded by zone_registryMutex
+static thread_local zoneThread_s zone_thread;
+
+zoneThread_s::~zoneThread_s()
+{
+	if (buffer) {
+		std::lock_guard lock(zone_registryMutex);
+		zone_freeBuffers.push_back(buffer.get());
+	}
+}
+
+// =========
+// Functions
+// =========
+
+void Zone_Enable(bool enable)
+{
+	zone_enabled = enable;
+}
+
+bool Zone_IsEnabled()
+{
+	return zone_enabled;
+}
+
+int64_t Zone_Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static zoneBuffer_s* Zone_ThreadBuffer()
+{
+	if ( !zone_thread.buffer ) {
+		std::shared_ptr<zoneBuffer_s> buffer;
+		{
+			std::lock_guard lock(zone_registryMutex);
+			if ( !zone_freeBuffers.empty() ) {
+				buffer = zone_buffers[zone_freeBuffers.back()->id];
+				zone_freeBuffers.pop_back();
+			}
+			else {
+				buffer = std::make_shared<zoneBuffer_s>();
+				buffer->id = (unsigned int)zone_buffers.size();
+				zone_buffers.push_back(buffer);
+			}
+		}
+		std::lock_guard lock(buffer->mutex);
+		if (buffer->ring.empty()) {
+			buffer->ring.resize(zoneBuffer_s::RING_SIZE);
+		}
+		buffer->head = 0;
+		buffer->name = zone_thread.name;
+		zone_thread.buffer = std::move(buffer);
+	}
+	return zone_thread.buffer.get();
+}
+
+void Zone_Begin(const char* name)
+{
+	zoneThread_s& t = zone_thread;
+	if (t.depth < zoneThread_s::MAX_DEPTH) {
+		t.names[t.depth] = name;
+		t.starts[t.depth] = Zone_Now();
+	}
+	t.depth++;
+}
+
+void Zone_End()
+{
+	zoneThread_s& t = zone_thread;
+	if (t.depth == 0) {
+		return;
+	}
+	t.depth--;
+	if (t.depth >= zoneThread_s::MAX_DEPTH) {
+		return;
+	}
+	zoneEvent_s ev;
+	ev.name = t.names[t.depth];
+	ev.startNsec = t.starts[t.depth];
+	ev.endNsec = Zone_Now();
+	ev.depth = t.depth;
+	zoneBuffer_s* buffer = Zone_ThreadBuffer();
+	ev.thread = buffer->id;
+	std::lock_guard lock(buffer->mutex);
+	buffer->ring[buffer->head++ % zoneBuffer_s::RING_SIZE] = ev;
+}
+
+void Zone_SetThreadName(const char* name)
+{
+	zone_thread.name = name;
+	if (zoneBuffer_s* buffer = zone_thread.buffer.get()) {
+		std::lock_guard lock(buffer->mutex);
+		buffer->name = name;
+	}
+}
+
+std::string Zone_GetThreadName(unsigned int thread)
+{
+	std::shared_ptr<zoneBuffer_s> buffer;
+	{
+		std::lock_guard lock(zone_registryMutex);
+		if (thread >= zone_buffers.size()) {
+			return { };
+		}
+		buffer = zone_buffers[thread];
+	}
+	std::lock_guard lock(buffer->mutex);
+	return buffer->name.empty() ? "Thread " + std::to_string(thread) : buffer->name;
+}
+
+void Zone_Collect(std::vector<zoneEvent_s>& out, int64_t sinceNsec)
+{
+	std::vector<std::shared_ptr<zoneBuffer_s>> buffers;
+	{
+		std::lock_guard lock(zone_registryMutex);
+		buffers = zone_buffers;
+	}
+	for (auto& buffer : buffers) {
+		std::lock_guard lock(buffer->mutex);
+		size_t first = buffer->head > zoneBuffer_s::RING_SIZE ? buffer->head - zoneBuffer_s::RING_SIZE : 0;
+		for (size_t i = first; i < buffer->head; i++) {
+			const zoneEvent_s& ev = buffer->ring[i % zoneBuffer_s::RING_SIZE];
+			if (ev.endNsec >= sinceNsec) {
+				out.push_back(ev);
+			}
+		}
+	}
+}
@@ -0,0 +1,66 @@
+// SimpleGraphic Engine
+// (c) David Gowor, 2014
+//
+// Zones Header
+//
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// =======
+// Classes
+// =======
+
+// One finished zone, as recorded by the thread that ran it
+struct zoneEvent_s {
+	const char* name = nullptr;		// Must be a static string
+	int64_t	startNsec = 0;			// Zone_Now() clock
+	int64_t	endNsec = 0;
+	unsigned int thread = 0;		// Ring slot of the recording thread; reused once that thread exits
+	int		depth = 0;				// Nesting level on its thread
+};
+
+// =========
+// Functions
+// =========
+
+extern std::atomic<bool> zone_enabled;
+
+void	Zone_Enable(bool enable);
+bool	Zone_IsEnabled();
+int64_t	Zone_Now();
+void	Zone_Begin(const char* name);
+void	Zone_End();
+void	Zone_SetThreadName(const char* name);
+std::string Zone_GetThreadName(unsigned int thread);
+// Copies the zones still held in the per-thread rings that ended at or after sinceNsec
+void	Zone_Collect(std::vector<zoneEvent_s>& out, int64_t sinceNsec);
+
+// Times the enclosing scope while zones are enabled, otherwise costs a single relaxed load
+class zoneScope_c {
+public:
+	zoneScope_c(const char* name)
+	{
+		if (zone_enabled.load(std::memory_order_relaxed)) {
+			active = true;
+			Zone_Begin(name);
+		}
+	}
+	~zoneScope_c()
+	{
+		if (active) {
+			Zone_End();
+		}
+	}
+	zoneScope_c(const zoneScope_c&) = delete;
+	zoneScope_c& operator=(const zoneScope_c&) = delete;
+
+private:
+	bool	active = false;
+};
+
+#define ZONE_CONCAT_(a, b) a##b
+#define ZONE_CONCAT(a, b) ZONE_CONCAT_(a, b)
+#define ZONE(name) zoneScope_c ZONE_CONCAT(zoneScope_, __LINE__)(name)
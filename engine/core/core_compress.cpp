@@ -1,5 +1,9 @@
 #include "core_compress.h"
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 std::optional<std::vector<char>> CompressZstandard(gsl::span<const std::byte> src, std::optional<int> level)
 {
 	if (!level)
@@ -12,31 +16,159 @@ std::optional<std::vector<char>> CompressZstandard(gsl::span<const std::byte> sr
 	return dst;
 }
 
+std::optional<std::vector<char>> CompressZstandard(ZSTD_CCtx* cctx, gsl::span<const std::byte> src)
+{
+	std::vector<char> dst(ZSTD_compressBound(src.size()));
+	size_t rc = ZSTD_compress2(cctx, dst.data(), dst.size(), src.data(), src.size());
+	if (ZSTD_isError(rc))
+		return {};
+	dst.resize(rc);
+	return dst;
+}
+
 std::optional<std::vector<char>> DecompressZstandard(gsl::span<const std::byte> src)
 {
-	const size_t buffOutSize = ZSTD_DStreamOutSize();
-	std::vector<char> buffOut(buffOutSize);
+	std::shared_ptr<ZSTD_DCtx> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+	if (!dctx)
+		return {};
+	return DecompressZstandard(dctx.get(), src);
+}
+
+std::optional<std::vector<char>> DecompressZstandard(ZSTD_DCtx* dctx, gsl::span<const std::byte> src)
+{
+	ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
 
 	std::vector<char> dst;
-	dst.reserve(1 << 20);
+	// Frames written in one shot record their size, which lets the output be sized exactly up front
+	const unsigned long long contentSize = ZSTD_getFrameContentSize(src.data(), src.size());
+	if (contentSize != ZSTD_CONTENTSIZE_ERROR && contentSize != ZSTD_CONTENTSIZE_UNKNOWN && contentSize < (1ull << 31)) {
+		dst.resize((size_t)contentSize);
+		size_t rc = ZSTD_decompressDCtx(dctx, dst.data(), dst.size(), src.data(), src.size());
+		if (!ZSTD_isError(rc) && rc == dst.size() && ZSTD_findFrameCompressedSize(src.data(), src.size()) == src.size()) {
+			return dst;
+		}
+		ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+		dst.clear();
+	}
 
-	std::shared_ptr<ZSTD_DCtx> dctx(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+	dst.resize(std::max<size_t>(ZSTD_DStreamOutSize(), src.size() * 4));
+	size_t dstLen = 0;
 	ZSTD_inBuffer input = { src.data(), src.size(), 0 };
-	while (input.pos < input.size) {
-		ZSTD_outBuffer output = { buffOut.data(), buffOut.size(), 0 };
-		const size_t rc = ZSTD_decompressStream(dctx.get(), &output, &input);
+	size_t rc = 0;
+	while (true) {
+		if (dstLen == dst.size()) {
+			dst.resize(dst.size() * 2);
+		}
+		ZSTD_outBuffer output = { dst.data() + dstLen, dst.size() - dstLen, 0 };
+		rc = ZSTD_decompressStream(dctx, &output, &input);
 		if (ZSTD_isError(rc)) {
 			return {};
 		}
-		auto oldSize = dst.size();
-		auto newSize = oldSize + output.pos;
-		if (newSize > dst.capacity()) {
-			dst.reserve((size_t)(newSize * 1.5));
+		dstLen += output.pos;
+		// Stop once all input is consumed and the decoder has nothing more buffered for us
+		if (input.pos == input.size && output.pos < output.size) {
+			break;
 		}
-		dst.resize(newSize);
-		memcpy(dst.data() + oldSize, output.dst, output.pos);
+	}
+	// Anything but 0 means the last frame wasn't complete, so the input was truncated
+	if (rc != 0) {
+		return {};
 	}
 
+	dst.resize(dstLen);
 	dst.shrink_to_fit();
 	return dst;
 }
+
+std::optional<std::vector<char>> CompressDeflateParallel(gsl::span<const std::byte> src, int level, size_t threadCount)
+{
+	// Each block is deflated as a raw stream primed with the 32 KiB window preceding it, so the match
+	// distance is unaffected by the split. All but the last block end on a sync flush, which byte-aligns
+	// the output without marking the final block, letting the pieces be concatenated into one stream.
+	constexpr size_t blockSize = 128 << 10;
+	constexpr size_t windowSize = 32 << 10;
+	const size_t blockCount = std::max<size_t>(1, (src.size() + blockSize - 1) / blockSize);
+
+	struct Block {
+		std::vector<char> out;
+		uLong adler = 0;
+		size_t len = 0;
+		bool ok = false;
+	};
+	std::vector<Block> blocks(blockCount);
+
+	auto compressBlock = [&](size_t index) {
+		Block& block = blocks[index];
+		const size_t begin = index * blockSize;
+		block.len = std::min(blockSize, src.size() - begin);
+		const Bytef* in = (const Bytef*)src.data() + begin;
+		block.adler = adler32(adler32(0, nullptr, 0), in, (uInt)block.len);
+
+		z_stream z{};
+		if (deflateInit2(&z, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return;
+		if (index > 0) {
+			const size_t dictLen = std::min(windowSize, begin);
+			deflateSetDictionary(&z, in - dictLen, (uInt)dictLen);
+		}
+		const bool last = index == blockCount - 1;
+		// Leave room for the sync flush marker on top of the usual bound
+		block.out.resize(deflateBound(&z, (uLong)block.len) + 16);
+		z.next_in = (Bytef*)in;
+		z.avail_in = (uInt)block.len;
+		z.next_out = (Bytef*)block.out.data();
+		z.avail_out = (uInt)block.out.size();
+		int err = deflate(&z, last ? Z_FINISH : Z_SYNC_FLUSH);
+		deflateEnd(&z);
+		if (last ? err != Z_STREAM_END : err != Z_OK || z.avail_in != 0 || z.avail_out == 0)
+			return;
+		block.out.resize(z.total_out);
+		block.ok = true;
+	};
+
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	threadCount = std::min(threadCount, blockCount);
+	if (threadCount <= 1) {
+		for (size_t i = 0; i < blockCount; ++i)
+			compressBlock(i);
+	}
+	else {
+		std::atomic<size_t> nextBlock = 0;
+		auto worker = [&]() {
+			for (size_t i; (i = nextBlock.fetch_add(1)) < blockCount; )
+				compressBlock(i);
+		};
+		std::vector<std::thread> workers;
+		for (size_t t = 1; t < threadCount; ++t)
+			workers.emplace_back(worker);
+		worker();
+		for (auto& t : workers)
+			t.join();
+	}
+
+	size_t outLen = 2 + 4;
+	for (auto& block : blocks) {
+		if (!block.ok)
+			return {};
+		outLen += block.out.size();
+	}
+	std::vector<char> dst;
+	dst.reserve(outLen);
+
+	// zlib header for a 32 KiB window, with the level hint and check bits
+	const int levelFlag = level == Z_DEFAULT_COMPRESSION || level == 6 ? 2 : level < 2 ? 0 : level < 6 ? 1 : 3;
+	unsigned header = (0x78 << 8) | (levelFlag << 6);
+	header += 31 - header % 31;
+	dst.push_back((char)(header >> 8));
+	dst.push_back((char)(header & 0xFF));
+
+	uLong adler = adler32(0, nullptr, 0);
+	for (auto& block : blocks) {
+		dst.insert(dst.end(), block.out.begin(), block.out.end());
+		adler = adler32_combine(adler, block.adler, (z_off_t)block.len);
+	}
+	for (int shift = 24; shift >= 0; shift -= 8)
+		dst.push_back((char)((adler >> shift) & 0xFF));
+	return dst;
+}
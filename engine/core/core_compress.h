@@ -5,8 +5,18 @@
 #include <vector>
 
 #include <gsl/span>
+#include <zlib.h>
 #include <zstd.h>
 
 std::optional<std::vector<char>> CompressZstandard(gsl::span<const std::byte> src, std::optional<int> level = {});
 
 std::optional<std::vector<char>> DecompressZstandard(gsl::span<const std::byte> src);
+
+// Variants that reuse a caller-owned context, including any parameters or dictionary referenced on it
+std::optional<std::vector<char>> CompressZstandard(ZSTD_CCtx* cctx, gsl::span<const std::byte> src);
+
+std::optional<std::vector<char>> DecompressZstandard(ZSTD_DCtx* dctx, gsl::span<const std::byte> src);
+
+// Produces a zlib stream by deflating fixed-size blocks on several threads and stitching them together,
+// decodable by any standard inflater. A thread count of zero uses all hardware threads.
+std::optional<std::vector<char>> CompressDeflateParallel(gsl::span<const std::byte> src, int level = Z_BEST_COMPRESSION, size_t threadCount = 0);
@@ -73,8 +73,13 @@ void core_main_c::Init(int argc, char** argv)
 
 void core_main_c::Frame()
 {
+	ZONE("Core Frame");
+
 	// Execute commands
-	sys->con->ExecCommands();
+	{
+		ZONE("Exec commands");
+		sys->con->ExecCommands();
+	}
 
 	// Run UI
 	ui->Frame();
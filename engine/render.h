@@ -4,6 +4,7 @@
 // Render Global Header
 //
 
+#include <functional>
 #include <glm/vec2.hpp>
 
 // =======
@@ -51,6 +52,15 @@ enum r_blendMode_e {
 	RB_ADDITIVE
 };
 
+// Packed image batch layouts
+enum r_imageBatch_e {
+	IB_RECT,	// left, top, width, height, tcLeft, tcTop, tcRight, tcBottom
+	IB_QUAD,	// x1, y1, x2, y2, x3, y3, x4, y4, s1, t1, s2, t2, s3, t3, s4, t4
+};
+
+// Most images accepted by one image batch
+enum { IB_MAX_COUNT = 1 << 20 };
+
 // Shader handle
 class r_shaderHnd_c {
 	friend class r_renderer_c;
@@ -68,6 +78,7 @@ private:
 // ==========
 
 class image_c;
+class r_displayList_c;
 
 // Renderer: r_main.cpp
 class r_IRenderer {
@@ -83,6 +94,8 @@ public:
 	
 	virtual r_shaderHnd_c* RegisterShader(std::string_view name, int flags) = 0;
 	virtual r_shaderHnd_c* RegisterShaderFromImage(std::unique_ptr<image_c> img, int flags) = 0;
+	virtual r_shaderHnd_c* RegisterShaderFromImageAsync(std::function<std::unique_ptr<image_c>()> producer, int width, int height, int flags) = 0;
+	virtual void	QueueImageJob(std::function<void()> job, int pri = 0) = 0;
 	virtual void	GetShaderImageSize(r_shaderHnd_c* hnd, int &width, int &height) = 0;
 	virtual void	SetShaderLoadingPriority(r_shaderHnd_c* hnd, int pri) = 0;
 	virtual void	PurgeShaders() = 0;
@@ -99,11 +112,21 @@ public:
 	virtual void	GetDrawColor(col4_t color) = 0;
 	virtual void	DrawImage(r_shaderHnd_c* hnd, glm::vec2 pos, glm::vec2 extent, glm::vec2 uv1 = { 0, 0 }, glm::vec2 uv2 = { 1, 1 }, int stackLayer = 0, std::optional<int> maskLayer = {}) = 0;
 	virtual void	DrawImageQuad(r_shaderHnd_c* hnd, glm::vec2 p0, glm::vec2 p1, glm::vec2 p2, glm::vec2 p3, glm::vec2 uv0 = { 0, 0 }, glm::vec2 uv1 = { 1, 0 }, glm::vec2 uv2 = { 1, 1 }, glm::vec2 uv3 = { 0, 1 }, int stackLayer = 0, std::optional<int> maskLayer = {}) = 0;
+	virtual void	DrawImageBatch(r_shaderHnd_c* hnd, int layout, const float* data, size_t count, float posScale = 1.0f, int stackLayer = 0, std::optional<int> maskLayer = {}) = 0;
 	virtual void	DrawString(float x, float y, int align, int height, const col4_t col, int font, const char* str) = 0;
 	virtual void	DrawStringFormat(float x, float y, int align, int height, const col4_t col, int font, const char* fmt, ...) = 0;
 	virtual int		DrawStringWidth(int height, int font, const char* str) = 0;
 	virtual int		DrawStringCursorIndex(int height, int font, const char* str, int curX, int curY) = 0;
 
+	virtual r_displayList_c* NewDisplayList() = 0;
+	virtual void	FreeDisplayList(r_displayList_c* list) = 0;
+	virtual void	BeginDisplayList(r_displayList_c* list) = 0;
+	virtual void	EndDisplayList() = 0;
+	virtual r_displayList_c* RecordingDisplayList() = 0;
+	virtual void	ClearDisplayList(r_displayList_c* list) = 0;
+	virtual bool	IsDisplayListEmpty(r_displayList_c* list) = 0;
+	virtual void	DrawDisplayList(r_displayList_c* list, glm::vec2 offset = { 0, 0 }, float scale = 1.0f) = 0;
+
 	virtual int		VirtualScreenWidth() = 0;
 	virtual int		VirtualScreenHeight() = 0;
 	virtual float	VirtualScreenScaleFactor() = 0;
@@ -113,4 +136,7 @@ public:
 	virtual int		VirtualUnmap(int mappedValue) = 0;
 	
 	virtual void	ToggleDebugImGui() = 0;
+	// Adds a window to the debug hub; draw is called between ImGui::Begin() and ImGui::End() while it is open
+	virtual void	AddDebugPanel(std::string_view name, std::function<void()> draw) = 0;
+	virtual void	RemoveDebugPanel(std::string_view name) = 0;
 };
@@ -10,7 +10,9 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 // =======
 // Classes
@@ -25,6 +27,8 @@ struct f_glyph_s {
 	int		width = 0;
 	int		spLeft = 0;
 	int		spRight = 0;
+	int		x = 0;
+	int		y = 0;
 };
 
 // Font height info
@@ -34,6 +38,7 @@ struct f_fontHeight_s {
 	int		numGlyph;
 	f_glyph_s glyphs[128];
 	f_glyph_s defGlyph{0.0f, 0.0f, 0.0f, 0.0f, 0, 0, 0};
+	bool	atlasReady = false;
 
 	f_glyph_s const& Glyph(char ch) const {
 		if ((unsigned char)ch >= numGlyph) {
@@ -41,8 +46,30 @@ struct f_fontHeight_s {
 		}
 		return glyphs[(unsigned char)ch];
 	}
+
+	void PrepareAtlas() {
+		if (atlasReady) {
+			return;
+		}
+
+		// The atlas is loaded in the background, wait for it and resolve the glyph texture coordinates
+		tex->CompleteLoad();
+		float texWidth = (float)(std::max)((dword)tex->fileWidth, 1u);
+		float texHeight = (float)(std::max)((dword)tex->fileHeight, 1u);
+		for (int i = 0; i < numGlyph; i++) {
+			f_glyph_s* glyph = &glyphs[i];
+			glyph->tcLeft = glyph->x / texWidth;
+			glyph->tcRight = (glyph->x + glyph->width) / texWidth;
+			glyph->tcTop = glyph->y / texHeight;
+			glyph->tcBottom = (glyph->y + height) / texHeight;
+		}
+		atlasReady = true;
+	}
 };
 
+// Atlases are needed as soon as the first frame draws text, so they jump ahead of other queued textures
+static int const f_atlasLoadPri = (std::numeric_limits<int>::max)();
+
 // ===========
 // Font Loader
 // ===========
@@ -75,7 +102,8 @@ r_font_c::r_font_c(r_renderer_c* renderer, const char* fontName)
 			fh = new f_fontHeight_s;
 			fontHeights[numFontHeight++] = fh;
 			std::string tgaName = fmt::format("{}.{}.tga", fileNameBase, h);
-			fh->tex = new r_tex_c(renderer->texMan, tgaName.c_str(), TF_NOMIPMAP);
+			fh->tex = new r_tex_c(renderer->texMan, tgaName.c_str(), TF_NOMIPMAP | TF_ASYNC);
+			fh->tex->loadPri = f_atlasLoadPri;
 			fh->height = h;
 			if (h > maxHeight) {
 				maxHeight = h;
@@ -85,11 +113,10 @@ r_font_c::r_font_c(r_renderer_c* renderer, const char* fontName)
 		else if (fh && sscanf(sub.c_str(), "GLYPH %u %u %u %d %d;", &x, &y, &w, &sl, &sr) == 5) {
 			// Add glyph
 			if (fh->numGlyph >= 128) continue;
+			// Texture coordinates are resolved once the atlas has loaded, only the metrics are needed up front
 			f_glyph_s* glyph = &fh->glyphs[fh->numGlyph++];
-			glyph->tcLeft = (float)x / fh->tex->fileWidth;
-			glyph->tcRight = (float)(x + w) / fh->tex->fileWidth;
-			glyph->tcTop = (float)y / fh->tex->fileHeight;
-			glyph->tcBottom = (float)(y + fh->height) / fh->tex->fileHeight;
+			glyph->x = x;
+			glyph->y = y;
 			glyph->width = w;
 			glyph->spLeft = sl;
 			glyph->spRight = sr;
@@ -124,6 +151,17 @@ r_font_c::~r_font_c()
 	delete fontHeightMap;
 }
 
+int r_font_c::PendingAtlasCount()
+{
+	int count = 0;
+	for (int i = 0; i < numFontHeight; i++) {
+		if (fontHeights[i]->tex->status != r_tex_c::DONE) {
+			count++;
+		}
+	}
+	return count;
+}
+
 // =============
 // Font Renderer
 // =============
@@ -140,7 +178,7 @@ std::u32string BuildTofuString(char32_t cp) {
 
 int const tofuSizeReduction = 3;
 
-int r_font_c::StringWidthInternal(f_fontHeight_s* fh, std::u32string_view str, int height, float scale)
+int r_font_c::StringWidthInternal(f_fontHeight_s* fh, std::u32string_view str, std::vector<ColorEscapeSpan> const& spans, int height, float scale)
 {
 	int heightIdx = (int)(std::find(fontHeights, fontHeights + numFontHeight, fh) - fontHeights);
 	auto tofuFont = FindSmallerFontHeight(height, heightIdx, tofuSizeReduction);
@@ -151,31 +189,26 @@ int r_font_c::StringWidthInternal(f_fontHeight_s* fh, std::u32string_view str, i
 	};
 
 	float width = 0.0f;
-	for (size_t idx = 0; idx < str.size();) {
-		auto ch = str[idx];
-		int escLen = IsColorEscape(str.substr(idx));
-		if (escLen) {
-			idx += escLen;
-		}
-		else if (ch >= (unsigned)fh->numGlyph) {
-			auto tofu = BuildTofuString(ch);
-			for (auto cp : tofu) {
-				width += measureCodepoint(tofuFont.fh, cp);
+	for (auto& span : spans) {
+		for (size_t idx = span.begin; idx < span.end; ++idx) {
+			auto ch = str[idx];
+			if (ch >= (unsigned)fh->numGlyph) {
+				auto tofu = BuildTofuString(ch);
+				for (auto cp : tofu) {
+					width += measureCodepoint(tofuFont.fh, cp);
+					width = std::ceil(width);
+				}
+			}
+			else if (ch == U'\t') {
+				auto& glyph = fh->Glyph(' ');
+				int spWidth = glyph.width + glyph.spLeft + glyph.spRight;
+				width += spWidth * 4 * scale;
+				width = std::ceil(width);
+			}
+			else {
+				width += measureCodepoint(fh, ch) * scale;
 				width = std::ceil(width);
 			}
-			++idx;
-		}
-		else if (ch == U'\t') {
-			auto& glyph = fh->Glyph(' ');
-			int spWidth = glyph.width + glyph.spLeft + glyph.spRight;
-			width += spWidth * 4 * scale;
-			width = std::ceil(width);
-			++idx;
-		}
-		else {
-			width += measureCodepoint(fh, ch) * scale;
-			width = std::ceil(width);
-			++idx;
 		}
 	}
 	return static_cast<int>(width);
@@ -191,7 +224,8 @@ int r_font_c::StringWidth(int height, std::u32string_view str)
 		auto lineEnd = std::find(I, str.end(), U'\n');
 		if (I != lineEnd) {
 			std::u32string_view line(&*I, std::distance(I, lineEnd));
-			int lw = StringWidthInternal(fh, line, height, scale);
+			TokenizeColorEscapes(line, spanBuf);
+			int lw = StringWidthInternal(fh, line, spanBuf, height, scale);
 			max = (std::max)(max, lw);
 		}
 		if (lineEnd == str.end()) {
@@ -202,7 +236,7 @@ int r_font_c::StringWidth(int height, std::u32string_view str)
 	return max;
 }
 
-size_t r_font_c::StringCursorInternal(f_fontHeight_s* fh, std::u32string_view str, int height, float scale, int curX)
+void r_font_c::BuildCursorLine(f_fontHeight_s* fh, std::u32string_view str, int height, float scale, CursorLine& line)
 {
 	int heightIdx = (int)(std::find(fontHeights, fontHeights + numFontHeight, fh) - fontHeights);
 	auto tofuFont = FindSmallerFontHeight(height, heightIdx, tofuSizeReduction);
@@ -212,77 +246,103 @@ size_t r_font_c::StringCursorInternal(f_fontHeight_s* fh, std::u32string_view st
 		return glyph.width + glyph.spLeft + glyph.spRight;
 	};
 
+	TokenizeColorEscapes(str, spanBuf);
+	line.advances.clear();
+	line.indices.clear();
+
+	// Record the right edge of every character, a cursor at or left of it lands on that character
 	float x = 0.0f;
-	auto I = str.begin();
-	auto lineEnd = std::find(I, str.end(), U'\n');
-	while (I != lineEnd) {
-		auto tail = str.substr(std::distance(str.begin(), I));
-		int escLen = IsColorEscape(tail);
-		if (escLen) {
-			I += escLen;
-		}
-		else if (*I >= (unsigned)fh->numGlyph) {
-			auto tofu = BuildTofuString(*I);
-			for (auto cp : tofu) {
-				x += measureCodepoint(tofuFont.fh, cp);
-				x = std::ceil(x);
-				if (curX <= x) {
-					return std::distance(str.begin(), I);
+	for (auto& span : spanBuf) {
+		for (size_t idx = span.begin; idx < span.end; ++idx) {
+			auto ch = str[idx];
+			if (ch >= (unsigned)fh->numGlyph) {
+				auto tofu = BuildTofuString(ch);
+				for (auto cp : tofu) {
+					x += measureCodepoint(tofuFont.fh, cp);
+					x = std::ceil(x);
 				}
 			}
-			++I;
-		}
-		else if (*I == U'\t') {
-			auto& glyph = fh->Glyph(' ');
-			float fullWidth = (glyph.width + glyph.spLeft + glyph.spRight) * 4.0f * scale;
-			float halfWidth = std::ceil(fullWidth / 2.0f);
-			x += halfWidth;
-			x = std::ceil(x);
-			if (curX <= x) {
-				break;
-			}
-			x += fullWidth - halfWidth;
-			x = std::ceil(x);
-			if (curX <= x) {
-				break;
+			else if (ch == U'\t') {
+				auto& glyph = fh->Glyph(' ');
+				float fullWidth = (glyph.width + glyph.spLeft + glyph.spRight) * 4.0f * scale;
+				float halfWidth = std::ceil(fullWidth / 2.0f);
+				x += halfWidth;
+				x = std::ceil(x);
+				x += fullWidth - halfWidth;
+				x = std::ceil(x);
 			}
-			++I;
-		}
-		else {
-			x += measureCodepoint(fh, *I) * scale;
-			x = std::ceil(x);
-			if (curX <= x) {
-				break;
+			else {
+				x += measureCodepoint(fh, ch) * scale;
+				x = std::ceil(x);
 			}
-			++I;
+			// Keep the edges sorted for the binary search even if a glyph has a negative advance
+			line.advances.push_back(line.advances.empty() ? x : (std::max)(x, line.advances.back()));
+			line.indices.push_back((uint32_t)idx);
 		}
 	}
-	return std::distance(str.begin(), I);
 }
 
-int	r_font_c::StringCursorIndex(int height, std::u32string_view str, int curX, int curY)
+r_font_c::CursorTable& r_font_c::FindCursorTable(int height, std::u32string_view str)
 {
+	for (auto& table : cursorTables) {
+		if (table.height == height && table.text == str) {
+			return table;
+		}
+	}
+
+	// Build a new table in place of the oldest one
+	auto& table = cursorTables[cursorTableNext];
+	cursorTableNext = (cursorTableNext + 1) % cursorTableCount;
+	table.height = height;
+	table.text = str;
+	table.numLines = 0;
+	table.trailingNewline = false;
+
 	auto mainFont = FindFontHeight(height);
 	f_fontHeight_s* fh = mainFont.fh;
-	int lastIndex = 0;
-	int lineY = height;
 	float scale = (float)height / fh->height;
-
-	auto I = str.begin();
-	while (I != str.end()) {
-		auto lineEnd = std::find(I, str.end(), U'\n');
-		auto line = str.substr(std::distance(str.begin(), I), std::distance(I, lineEnd));
-		lastIndex = (int)(StringCursorInternal(fh, line, height, scale, curX));
-		if (curY <= lineY) {
-			break;
+	for (size_t begin = 0; begin < str.size();) {
+		size_t lineEnd = (std::min)(str.find(U'\n', begin), str.size());
+		if (table.numLines == table.lines.size()) {
+			table.lines.emplace_back();
 		}
-		if (lineEnd == str.end()) {
+		auto& line = table.lines[table.numLines++];
+		line.begin = begin;
+		line.length = lineEnd - begin;
+		BuildCursorLine(fh, str.substr(begin, line.length), height, scale, line);
+		if (lineEnd == str.size()) {
 			break;
 		}
-		I = lineEnd + 1;
-		lineY += height;
+		table.trailingNewline = lineEnd + 1 == str.size();
+		begin = lineEnd + 1;
+	}
+	return table;
+}
+
+int	r_font_c::StringCursorIndex(int height, std::u32string_view str, int curX, int curY)
+{
+	if (str.empty()) {
+		return 0;
+	}
+	auto& table = FindCursorTable(height, str);
+
+	// Line n covers cursor heights up to (n + 1) * height, anything above the first line hits it
+	size_t lineIdx = curY <= height ? 0 : (size_t)((curY - 1) / height);
+	bool pastEnd = lineIdx >= table.numLines;
+	if (pastEnd) {
+		lineIdx = table.numLines - 1;
+	}
+	auto& line = table.lines[lineIdx];
+	size_t index = line.begin + line.length;
+	auto hit = std::lower_bound(line.advances.begin(), line.advances.end(), (float)curX);
+	if (hit != line.advances.end()) {
+		index = line.begin + line.indices[std::distance(line.advances.begin(), hit)];
 	}
-	return (int)std::distance(str.begin(), I) + lastIndex;
+	if (pastEnd && table.trailingNewline) {
+		// The cursor is on the empty line after the final newline
+		return (int)(str.size() + index - line.begin);
+	}
+	return (int)index;
 }
 
 r_font_c::EmbeddedFontSpec r_font_c::FindSmallerFontHeight(int height, int heightIdx, int sizeReduction) {
@@ -320,19 +380,20 @@ r_font_c::FontHeightEntry r_font_c::FindFontHeight(int height) {
 
 void r_font_c::DrawTextLine(scp_t pos, int align, int height, col4_t col, std::u32string_view str)
 {
+	TokenizeColorEscapes(str, spanBuf);
+
+	// Lines recorded into a display list may be replayed elsewhere, so they are never culled
+	bool const cull = !renderer->captureList;
+
 	// Check if the line is visible
-	if (pos[Y] >= renderer->sys->video->vid.size[1] || pos[Y] <= -height) {
+	if (cull && (pos[Y] >= renderer->sys->video->vid.size[1] || pos[Y] <= -height)) {
 		// Just process the colour codes
-		while (!str.empty()) {
-			// Check for escape character
-			int escLen = IsColorEscape(str);
-			if (escLen) {
-				str = ReadColorEscape(str, col);
+		for (auto& span : spanBuf) {
+			if (span.hasColor) {
+				VectorCopy(span.color, col);
 				col[3] = 1.0f;
 				renderer->curLayer->Color(col);
-				continue;
 			}
-			str = str.substr(1);
 		}
 		return;
 	}
@@ -342,13 +403,14 @@ void r_font_c::DrawTextLine(scp_t pos, int align, int height, col4_t col, std::u
 	f_fontHeight_s* fh = mainFont.fh;
 	float scale = (float)height / fh->height;
 	auto tofuFont = FindSmallerFontHeight(height, mainFont.heightIdx, tofuSizeReduction);
+	fh->PrepareAtlas();
 
 	// Calculate the string position
 	float x = pos[X];
 	float y = std::floor(pos[Y]);
 	if (align != F_LEFT) {
 		// Calculate the real width of the string
-		float width = StringWidthInternal(fh, str, height, scale);
+		float width = StringWidthInternal(fh, str, spanBuf, height, scale);
 		switch (align) {
 		case F_CENTRE:
 			x = floor((renderer->VirtualScreenWidth() - width) / 2.0f + pos[X]);
@@ -370,7 +432,7 @@ void r_font_c::DrawTextLine(scp_t pos, int align, int height, col4_t col, std::u
 
 	r_tex_c* curTex{};
 
-	auto drawCodepoint = [this, &curTex, &x, y](f_fontHeight_s* fh, int height, float scale, int yShift, char32_t cp) {
+	auto drawCodepoint = [this, &curTex, &x, y, cull](f_fontHeight_s* fh, int height, float scale, int yShift, char32_t cp) {
 		float cpY = y + yShift;
 		if (curTex != fh->tex) {
 			curTex = fh->tex;
@@ -380,7 +442,7 @@ void r_font_c::DrawTextLine(scp_t pos, int align, int height, col4_t col, std::u
 		x += glyph.spLeft * scale;
 		if (glyph.width) {
 			float w = glyph.width * scale;
-			if (x + w >= 0 && x < renderer->VirtualScreenWidth()) {
+			if (!cull || (x + w >= 0 && x < renderer->VirtualScreenWidth())) {
 				renderer->curLayer->Quad(
 					glyph.tcLeft, glyph.tcTop, x, cpY,
 					glyph.tcRight, glyph.tcTop, x + w, cpY,
@@ -395,39 +457,36 @@ void r_font_c::DrawTextLine(scp_t pos, int align, int height, col4_t col, std::u
 	};
 
 	// Render the string
-	for (auto tail = str; !tail.empty();) {
-		// Draw unprintable characters as tofu placeholders
-		auto ch = tail[0];
-		if (ch >= (unsigned)fh->numGlyph) {
-			auto tofu = BuildTofuString(ch);
-			for (auto ch : tofu) {
-				drawCodepoint(tofuFont.fh, tofuFont.fh->height, 1.0f, tofuFont.yPad, ch);
-			}
-			tail = tail.substr(1);
-			continue;
-		}
-
-		// Check for escape character
-		int escLen = IsColorEscape(tail);
-		if (escLen) {
-			tail = ReadColorEscape(tail, col);
+	for (auto& span : spanBuf) {
+		if (span.hasColor) {
+			VectorCopy(span.color, col);
 			col[3] = 1.0f;
 			renderer->curLayer->Color(col);
-			continue;
 		}
 
-		// Handle tabs
-		if (ch == U'\t') {
-			auto& glyph = fh->Glyph(' ');
-			int spWidth = glyph.width + glyph.spLeft + glyph.spRight;
-			x+= (spWidth << 2) * scale;
-			tail = tail.substr(1);
-			continue;
-		}
+		for (size_t idx = span.begin; idx < span.end; ++idx) {
+			// Draw unprintable characters as tofu placeholders
+			auto ch = str[idx];
+			if (ch >= (unsigned)fh->numGlyph) {
+				auto tofu = BuildTofuString(ch);
+				tofuFont.fh->PrepareAtlas();
+				for (auto ch : tofu) {
+					drawCodepoint(tofuFont.fh, tofuFont.fh->height, 1.0f, tofuFont.yPad, ch);
+				}
+				continue;
+			}
 
-		// Draw glyph
-		drawCodepoint(fh, height, scale, 0, ch);
-		tail = tail.substr(1);
+			// Handle tabs
+			if (ch == U'\t') {
+				auto& glyph = fh->Glyph(' ');
+				int spWidth = glyph.width + glyph.spLeft + glyph.spRight;
+				x+= (spWidth << 2) * scale;
+				continue;
+			}
+
+			// Draw glyph
+			drawCodepoint(fh, height, scale, 0, ch);
+		}
 	}
 }
 
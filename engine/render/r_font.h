@@ -8,7 +8,9 @@
 // Classes
 // =======
 
+#include <string>
 #include <string_view>
+#include <vector>
 
 // Font
 class r_font_c {
@@ -21,10 +23,26 @@ public:
 	void	Draw(scp_t pos, int align, int height, col4_t col, std::u32string_view str);
 	void	FDraw(scp_t pos, int align, int height, col4_t col, const char* fmt, ...);
 	void	VDraw(scp_t pos, int align, int height, col4_t col, const char* fmt, va_list va);
+	int		PendingAtlasCount();
 
 private:
-	int		StringWidthInternal(struct f_fontHeight_s* fh, std::u32string_view str, int height, float scale);
-	size_t	StringCursorInternal(struct f_fontHeight_s* fh, std::u32string_view str, int height, float scale, int curX);
+	int		StringWidthInternal(struct f_fontHeight_s* fh, std::u32string_view str, std::vector<ColorEscapeSpan> const& spans, int height, float scale);
+	// Cumulative advances of a line, for answering cursor queries by binary search
+	struct CursorLine {
+		size_t	begin = 0;
+		size_t	length = 0;
+		std::vector<float> advances;	// Right edge of each character, escapes excluded
+		std::vector<uint32_t> indices;	// Offset of each character within the line
+	};
+	struct CursorTable {
+		std::u32string text;
+		int		height = -1;
+		size_t	numLines = 0;
+		bool	trailingNewline = false;
+		std::vector<CursorLine> lines;
+	};
+	void	BuildCursorLine(struct f_fontHeight_s* fh, std::u32string_view str, int height, float scale, CursorLine& line);
+	CursorTable& FindCursorTable(int height, std::u32string_view str);
 	void	DrawTextLine(scp_t pos, int align, int height, col4_t col, std::u32string_view str);
 
 	struct EmbeddedFontSpec {
@@ -44,4 +62,10 @@ private:
 	struct f_fontHeight_s *fontHeights[32] = {};
 	int		maxHeight = 0;
 	int*	fontHeightMap = nullptr;
+
+	std::vector<ColorEscapeSpan> spanBuf;	// Reused color escape spans for the line being processed
+
+	static const int cursorTableCount = 4;
+	CursorTable cursorTables[cursorTableCount];	// Recently hit-tested strings
+	int		cursorTableNext = 0;
 };
@@ -52,6 +52,7 @@ public:
 
 	r_shader_c(r_renderer_c* renderer, std::string_view shname, int flags);
 	r_shader_c(r_renderer_c* renderer, std::string_view shname, int flags, std::unique_ptr<image_c> img);
+	r_shader_c(r_renderer_c* renderer, std::string_view shname, int flags, std::function<std::unique_ptr<image_c>()> producer, int width, int height);
 	~r_shader_c();
 };
 
@@ -76,6 +77,15 @@ r_shader_c::r_shader_c(r_renderer_c* renderer, std::string_view shname, int flag
 	tex = new r_tex_c(renderer->texMan, std::move(img), flags);
 }
 
+r_shader_c::r_shader_c(r_renderer_c* renderer, std::string_view shname, int flags, std::function<std::unique_ptr<image_c>()> producer, int width, int height)
+	: renderer(renderer)
+{
+	name = shname;
+	nameHash = StringHash(name.c_str(), 0xFFFF);
+	refCount = 0;
+	tex = new r_tex_c(renderer->texMan, std::move(producer), width, height, flags);
+}
+
 r_shader_c::~r_shader_c()
 {
 	delete tex;
@@ -166,10 +176,10 @@ struct r_layerCmdQuad_s {
 	} quad;
 };
 
-r_layer_c::r_layer_c(r_renderer_c* renderer, int layer, int subLayer)
-	: renderer(renderer), layer(layer), subLayer(subLayer)
+r_layer_c::r_layer_c(r_renderer_c* renderer, int layer, int subLayer, bool retained)
+	: renderer(renderer), layer(layer), subLayer(subLayer), retained(retained)
 {
-	cmdStorage.resize(1ull << 23);
+	cmdStorage.resize(retained ? 1ull << 16 : 1ull << 23);
 	cmdCursor = 0;
 	numCmd = 0;
 }
@@ -215,15 +225,31 @@ bool r_layer_c::GetNextCommand(r_layer_c::CmdHandle& handle)
 	return true;
 }
 
-r_layerCmd_s* r_layer_c::NewCommand(size_t size)
+std::byte* r_layer_c::Reserve(size_t size)
 {
+	// Compared against the space left, so a huge size can't wrap around
+	size_t const limit = retained ? R_MAXRETAINEDBYTES : cmdStorage.size();
+	if (size >= limit - cmdCursor) {
+		return nullptr;
+	}
 	size_t const cmdEnd = cmdCursor + size;
 	if (cmdEnd >= cmdStorage.size()) {
-		return nullptr;
+		cmdStorage.resize((std::min)((std::max)(cmdStorage.size() * 2, cmdEnd + 1), limit));
 	}
-	auto *ret = (r_layerCmd_s*)(cmdStorage.data() + cmdCursor);
+	auto *ret = cmdStorage.data() + cmdCursor;
 	cmdCursor = cmdEnd;
-	++numCmd;
+	return ret;
+}
+
+r_layerCmd_s* r_layer_c::NewCommand(size_t size, size_t count)
+{
+	if (count > SIZE_MAX / size) {
+		return nullptr;
+	}
+	auto* ret = (r_layerCmd_s*)Reserve(size * count);
+	if (ret) {
+		numCmd += count;
+	}
 	return ret;
 }
 
@@ -275,6 +301,106 @@ void r_layer_c::Quad(float s0, float t0, float x0, float y0, float s1, float t1,
 	}
 }
 
+void r_layer_c::QuadBatch(int layout, const float* data, size_t count, float posScale, int stackLayer, int maskLayer)
+{
+	// Reserve storage for the whole batch at once and fill the commands in place
+	size_t const cmdSize = CommandSize(r_layerCmd_s::QUAD);
+	auto* cmdBase = (std::byte*)NewCommand(cmdSize, count);
+	if (!cmdBase) {
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		auto* cmd = (r_layerCmdQuad_s*)(cmdBase + i * cmdSize);
+		cmd->cmd = r_layerCmd_s::QUAD;
+		auto& q = cmd->quad;
+		if (layout == IB_RECT) {
+			const float* r = data + i * 8;
+			float x0 = r[0] * posScale, y0 = r[1] * posScale;
+			float x1 = x0 + r[2] * posScale, y1 = y0 + r[3] * posScale;
+			q.x[0] = x0; q.x[1] = x1; q.x[2] = x1; q.x[3] = x0;
+			q.y[0] = y0; q.y[1] = y0; q.y[2] = y1; q.y[3] = y1;
+			q.s[0] = r[4]; q.s[1] = r[6]; q.s[2] = r[6]; q.s[3] = r[4];
+			q.t[0] = r[5]; q.t[1] = r[5]; q.t[2] = r[7]; q.t[3] = r[7];
+		}
+		else {
+			const float* r = data + i * 16;
+			for (int v = 0; v < 4; v++) {
+				q.x[v] = r[v * 2] * posScale;
+				q.y[v] = r[v * 2 + 1] * posScale;
+				q.s[v] = r[8 + v * 2];
+				q.t[v] = r[8 + v * 2 + 1];
+			}
+		}
+		q.stackLayer = stackLayer;
+		q.maskLayer = maskLayer;
+	}
+}
+
+void r_layer_c::Append(r_layer_c& src, glm::vec2 offset, float scale)
+{
+	if (offset == glm::vec2{ 0, 0 } && scale == 1.0f) {
+		// Untransformed, so the commands can be copied as one block
+		if (auto* dst = Reserve(src.cmdCursor)) {
+			memcpy(dst, src.cmdStorage.data(), src.cmdCursor);
+			numCmd += src.numCmd;
+		}
+		return;
+	}
+
+	// Quads recorded before any viewport change are relative to the viewport at replay time and are moved by the offset,
+	// after a recorded viewport change they are relative to that viewport which takes the offset instead
+	glm::vec2 quadOffset = offset;
+	for (auto handle = src.GetFirstCommand(); handle.cmd; src.GetNextCommand(handle)) {
+		size_t const size = CommandSize(handle.cmd->cmd);
+		auto* cmd = NewCommand(size);
+		if (!cmd) {
+			return;
+		}
+		memcpy(cmd, handle.cmd, size);
+		switch (cmd->cmd) {
+		case r_layerCmd_s::VIEWPORT:
+		{
+			auto& vp = ((r_layerCmdViewport_s*)cmd)->viewport;
+			vp.x = (int)std::lround(vp.x * scale + offset.x);
+			vp.y = (int)std::lround(vp.y * scale + offset.y);
+			vp.width = (int)std::lround(vp.width * scale);
+			vp.height = (int)std::lround(vp.height * scale);
+			quadOffset = { 0, 0 };
+			break;
+		}
+		case r_layerCmd_s::QUAD:
+		{
+			auto& q = ((r_layerCmdQuad_s*)cmd)->quad;
+			for (int v = 0; v < 4; v++) {
+				q.x[v] = q.x[v] * scale + quadOffset.x;
+				q.y[v] = q.y[v] * scale + quadOffset.y;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+// ===================
+// Display List Class
+// ===================
+
+r_displayList_c::r_displayList_c(r_renderer_c* renderer)
+	: cmds(renderer, 0, 0, true)
+{
+}
+
+void r_displayList_c::Clear()
+{
+	cmds.Discard();
+	hasViewport = false;
+	hasBlendMode = false;
+	shaders.clear();
+	shaderRefs.clear();
+}
+
 // =================
 // Geometric queries
 // =================
@@ -1086,6 +1212,7 @@ void r_renderer_c::Init(r_featureFlag_e features)
 	ImGui_ImplGlfw_InitForOpenGL((GLFWwindow*)sys->video->GetWindowHandle(), true);
 	ImGui_ImplOpenGL3_Init("#version 100");
 
+	fontLoadTimer.Start();
 	fonts[F_FIXED] = new r_font_c(this, "Bitstream Vera Sans Mono");
 	fonts[F_VAR] = new r_font_c(this, "Liberation Sans");
 	fonts[F_VAR_BOLD] = new r_font_c(this, "Liberation Sans Bold");
@@ -1093,6 +1220,8 @@ void r_renderer_c::Init(r_featureFlag_e features)
 	fonts[F_FONTIN_SC_ITALIC] = new r_font_c(this, "Fontin SmallCaps Italic");
 	fonts[F_FONTIN] = new r_font_c(this, "Fontin");
 	fonts[F_FONTIN_ITALIC] = new r_font_c(this, "Fontin Italic");
+	fontsPending = true;
+	sys->con->Printf("Font metrics loaded in %d msec, atlases loading in background.\n", fontLoadTimer.Get());
 
 	sys->con->Printf("Renderer initialised in %d msec.\n", timer.Get());
 }
@@ -1150,6 +1279,16 @@ void r_renderer_c::Shutdown()
 void r_renderer_c::PumpShaders()
 {
 	texMan->ProcessPendingTextureUploads();
+	if (fontsPending) {
+		int pending = 0;
+		for (int f = 0; f < F_NUMFONTS; f++) {
+			pending += fonts[f]->PendingAtlasCount();
+		}
+		if (pending == 0) {
+			fontsPending = false;
+			sys->con->Printf("Font atlases loaded in %d msec.\n", fontLoadTimer.Get());
+		}
+	}
 	for (size_t idx = 0; idx < numShader; ++idx)
 		if (auto* sh = shaderList[idx])
 			if (auto tex = sh->tex; tex && tex->status != r_tex_c::DONE) {
@@ -1263,8 +1402,16 @@ static std::string BinaryUnitPrefix(uint64_t quantity) {
 
 void r_renderer_c::EndFrame()
 {
+	ZONE("Renderer EndFrame");
+
+	// Recording can't span frames
+	EndDisplayList();
+
 	inhibitElision = false;
-	PumpShaders();
+	{
+		ZONE("Pump shaders");
+		PumpShaders();
+	}
 
 	std::chrono::time_point endFrameTic = std::chrono::steady_clock::now();
 	frameStats.AppendDuration(&FrameStats::midFrameStepDurations, endFrameTic - beginFrameToc);
@@ -1273,6 +1420,7 @@ void r_renderer_c::EndFrame()
 	static bool showMetrics = false;
 	static bool showHash = false;
 	static bool showTiming = false;
+	static bool showZones = false;
 	if (debugImGui) {
 		if (ImGui::Begin("Debug Hub", &debugImGui)) {
 			if (ImGui::Button("ImGui Demo")) {
@@ -1284,6 +1432,14 @@ void r_renderer_c::EndFrame()
 			if (ImGui::Button("Layers")) {
 				debugLayers = true;
 			}
+			if (ImGui::Button("Zones")) {
+				showZones = true;
+			}
+			for (auto& [name, panel] : debugPanels) {
+				if (ImGui::Button(name.c_str())) {
+					panel.open = true;
+				}
+			}
 		}
 		ImGui::End();
 	}
@@ -1389,6 +1545,7 @@ void r_renderer_c::EndFrame()
 	std::future<std::optional<std::vector<uint8_t>>> elidedFrameHashFut;
 	if (elideFrames) {
 		elidedFrameHashFut = std::async([&]() -> std::optional<std::vector<uint8_t>> {
+			ZONE("Frame hash");
 			std::vector<uint8_t> commandDigest;
 
 			for (auto lIdx = 0; lIdx < numLayer; ++lIdx) {
@@ -1413,6 +1570,7 @@ void r_renderer_c::EndFrame()
 	bool decideDraw = false;
 	bool elideDraw = false;
 	{
+		ZONE("Render layers");
 		glBindFramebuffer(GL_FRAMEBUFFER, GetDrawRenderTarget().framebuffer);
 		glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 		int l{};
@@ -1467,6 +1625,7 @@ void r_renderer_c::EndFrame()
 	delete[] layerSort;
 
 	{
+		ZONE("Present blit");
 		auto& rtt = GetPresentRenderTarget();
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -1528,11 +1687,74 @@ void r_renderer_c::EndFrame()
 		ImGui::End();
 	}
 
-	ImGui::Render();
-	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+	if (showZones) {
+		if (ImGui::Begin("Zones", &showZones)) {
+			bool enabled = Zone_IsEnabled();
+			if (ImGui::Checkbox("Record zones", &enabled)) {
+				Zone_Enable(enabled);
+			}
+
+			// Totals per thread and zone over the last second
+			struct ZoneStats {
+				int		count = 0;
+				int64_t	totalNsec = 0;
+				int64_t	maxNsec = 0;
+			};
+			std::vector<zoneEvent_s> events;
+			Zone_Collect(events, Zone_Now() - 1'000'000'000);
+			std::map<std::pair<unsigned int, std::string>, ZoneStats> zoneStats;
+			for (auto& ev : events) {
+				auto& stats = zoneStats[{ ev.thread, ev.name }];
+				stats.count++;
+				stats.totalNsec += ev.endNsec - ev.startNsec;
+				stats.maxNsec = std::max(stats.maxNsec, ev.endNsec - ev.startNsec);
+			}
+			if (ImGui::BeginTable("Zone stats", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+				ImGui::TableSetupColumn("Thread");
+				ImGui::TableSetupColumn("Zone");
+				ImGui::TableSetupColumn("Count/s");
+				ImGui::TableSetupColumn("Total ms/s");
+				ImGui::TableSetupColumn("Max ms");
+				ImGui::TableHeadersRow();
+				for (auto& [key, stats] : zoneStats) {
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn();
+					ImGui::Text("%s", Zone_GetThreadName(key.first).c_str());
+					ImGui::TableNextColumn();
+					ImGui::Text("%s", key.second.c_str());
+					ImGui::TableNextColumn();
+					ImGui::Text("%d", stats.count);
+					ImGui::TableNextColumn();
+					ImGui::Text("%.2f", stats.totalNsec / 1e6);
+					ImGui::TableNextColumn();
+					ImGui::Text("%.2f", stats.maxNsec / 1e6);
+				}
+				ImGui::EndTable();
+			}
+		}
+		ImGui::End();
+	}
+
+	for (auto& [name, panel] : debugPanels) {
+		if (panel.open) {
+			if (ImGui::Begin(name.c_str(), &panel.open)) {
+				panel.draw();
+			}
+			ImGui::End();
+		}
+	}
+
+	{
+		ZONE("ImGui render");
+		ImGui::Render();
+		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+	}
 
 	// Swap output buffers
-	openGL->Swap();
+	{
+		ZONE("Swap");
+		openGL->Swap();
+	}
 
 	// Take screenshot
 	switch (takeScreenshot) {
@@ -1613,7 +1835,7 @@ r_shaderHnd_c* r_renderer_c::RegisterShader(std::string_view shname, int flags)
 	return new r_shaderHnd_c(shaderList[newId]);
 }
 
-r_shaderHnd_c* r_renderer_c::RegisterShaderFromImage(std::unique_ptr<image_c> img, int flags)
+int r_renderer_c::NewDataShaderSlot()
 {
 	int newId = -1;
 	for (int s = 0; s < numShader; s++) {
@@ -1625,21 +1847,48 @@ r_shaderHnd_c* r_renderer_c::RegisterShaderFromImage(std::unique_ptr<image_c> im
 	if (newId == -1) {
 		if (numShader == R_MAXSHADERS) {
 			sys->con->Warning("shader limit reached");
-			return NULL;
+			return -1;
 		}
 		newId = numShader++;
 	}
+	return newId;
+}
+
+r_shaderHnd_c* r_renderer_c::RegisterShaderFromImage(std::unique_ptr<image_c> img, int flags)
+{
+	int newId = NewDataShaderSlot();
+	if (newId == -1) {
+		return NULL;
+	}
 	char shname[32];
 	sprintf(shname, "data:%d", newId);
 	shaderList[newId] = new r_shader_c(this, shname, flags, std::move(img));
 	return new r_shaderHnd_c(shaderList[newId]);
 }
 
+r_shaderHnd_c* r_renderer_c::RegisterShaderFromImageAsync(std::function<std::unique_ptr<image_c>()> producer, int width, int height, int flags)
+{
+	int newId = NewDataShaderSlot();
+	if (newId == -1) {
+		return NULL;
+	}
+	char shname[32];
+	sprintf(shname, "data:%d", newId);
+	shaderList[newId] = new r_shader_c(this, shname, flags, std::move(producer), width, height);
+	return new r_shaderHnd_c(shaderList[newId]);
+}
+
+void r_renderer_c::QueueImageJob(std::function<void()> job, int pri)
+{
+	texMan->AsyncJob(std::move(job), pri);
+}
+
 void r_renderer_c::GetShaderImageSize(r_shaderHnd_c* hnd, int& width, int& height)
 {
 	if (hnd)
 	{
-		while (hnd->sh->tex->status < r_tex_c::SIZE_KNOWN) {
+		// Textures built from a producer know their size up front
+		while (hnd->sh->tex->status < r_tex_c::SIZE_KNOWN && hnd->sh->tex->fileWidth == 0) {
 			Sleep(1);
 		}
 		width = hnd->sh->tex->fileWidth;
@@ -1720,12 +1969,18 @@ void r_renderer_c::SetViewport(int x, int y, int width, int height)
 	curViewport.width = width;
 	curViewport.height = height;
 	curLayer->SetViewport(&curViewport);
+	if (captureList) {
+		captureList->hasViewport = true;
+	}
 }
 
 void r_renderer_c::SetBlendMode(int mode)
 {
 	curBlendMode = mode;
 	curLayer->SetBlendMode(mode);
+	if (captureList) {
+		captureList->hasBlendMode = true;
+	}
 }
 
 void r_renderer_c::DrawColor(const col4_t col)
@@ -1774,6 +2029,7 @@ void r_renderer_c::DrawImage(r_shaderHnd_c* hnd, glm::vec2 pos, glm::vec2 extent
 void r_renderer_c::DrawImageQuad(r_shaderHnd_c* hnd, glm::vec2 p0, glm::vec2 p1, glm::vec2 p2, glm::vec2 p3, glm::vec2 uv0, glm::vec2 uv1, glm::vec2 uv2, glm::vec2 uv3, int stackLayer, std::optional<int> maskLayer)
 {
 	if (hnd) {
+		RetainCapturedShader(hnd->sh);
 		curLayer->Bind(hnd->sh->tex);
 		stackLayer = clamp(stackLayer, 0, (int)hnd->sh->tex->stackLayers - 1);
 	}
@@ -1790,6 +2046,21 @@ void r_renderer_c::DrawImageQuad(r_shaderHnd_c* hnd, glm::vec2 p0, glm::vec2 p1,
 		stackLayer, maskLayer.value_or(-1));
 }
 
+void r_renderer_c::DrawImageBatch(r_shaderHnd_c* hnd, int layout, const float* data, size_t count, float posScale, int stackLayer, std::optional<int> maskLayer)
+{
+	if (hnd) {
+		RetainCapturedShader(hnd->sh);
+		curLayer->Bind(hnd->sh->tex);
+		stackLayer = clamp(stackLayer, 0, (int)hnd->sh->tex->stackLayers - 1);
+	}
+	else {
+		curLayer->Bind(whiteImage->sh->tex);
+		stackLayer = 0;
+	}
+	curLayer->Color(drawColor);
+	curLayer->QuadBatch(layout, data, count, posScale, stackLayer, maskLayer.value_or(-1));
+}
+
 void r_renderer_c::DrawString(float x, float y, int align, int height, const col4_t col, int font, const char* str)
 {
 	auto idxStr = IndexUTF8ToUTF32(str);
@@ -1848,7 +2119,12 @@ int r_renderer_c::DrawStringCursorIndex(int height, int font, const char* str, i
 		return 0;
 	}
 	std::string_view narrowView(str);
-	auto idxStr = IndexUTF8ToUTF32(narrowView);
+	if (narrowView != cursorText) {
+		// Hit-testing tends to repeat on the same text as the mouse moves
+		cursorText = narrowView;
+		cursorIdxStr = IndexUTF8ToUTF32(narrowView);
+	}
+	auto& idxStr = cursorIdxStr;
 	if (font < 0 || font >= F_NUMFONTS) {
 		font = F_FIXED;
 	}
@@ -1859,6 +2135,94 @@ int r_renderer_c::DrawStringCursorIndex(int height, int font, const char* str, i
 	return (int)narrowView.size();
 }
 
+// =============
+// Display Lists
+// =============
+
+r_displayList_c* r_renderer_c::NewDisplayList()
+{
+	return new r_displayList_c(this);
+}
+
+void r_renderer_c::FreeDisplayList(r_displayList_c* list)
+{
+	if (list == captureList) {
+		EndDisplayList();
+	}
+	delete list;
+}
+
+void r_renderer_c::BeginDisplayList(r_displayList_c* list)
+{
+	EndDisplayList();
+	list->Clear();
+
+	// Redirect drawing into the display list until recording ends
+	captureList = list;
+	captureLayer = curLayer;
+	captureViewport = curViewport;
+	captureBlendMode = curBlendMode;
+	curLayer = &list->cmds;
+}
+
+void r_renderer_c::EndDisplayList()
+{
+	if (!captureList) {
+		return;
+	}
+	curLayer = captureLayer;
+	curViewport = captureViewport;
+	curBlendMode = captureBlendMode;
+	captureList = nullptr;
+	captureLayer = nullptr;
+}
+
+r_displayList_c* r_renderer_c::RecordingDisplayList()
+{
+	return captureList;
+}
+
+void r_renderer_c::ClearDisplayList(r_displayList_c* list)
+{
+	list->Clear();
+}
+
+bool r_renderer_c::IsDisplayListEmpty(r_displayList_c* list)
+{
+	return list->cmds.numCmd == 0;
+}
+
+void r_renderer_c::DrawDisplayList(r_displayList_c* list, glm::vec2 offset, float scale)
+{
+	if (list == captureList) {
+		return;
+	}
+	curLayer->Append(list->cmds, offset, scale);
+	if (captureList) {
+		// Replaying into another display list, which now depends on the same textures
+		for (auto sh : list->shaders) {
+			RetainCapturedShader(sh);
+		}
+		captureList->hasViewport |= list->hasViewport;
+		captureList->hasBlendMode |= list->hasBlendMode;
+	}
+
+	// Restore the state the recorded commands may have changed
+	if (list->hasViewport) {
+		curLayer->SetViewport(&curViewport);
+	}
+	if (list->hasBlendMode) {
+		curLayer->SetBlendMode(curBlendMode);
+	}
+}
+
+void r_renderer_c::RetainCapturedShader(r_shader_c* sh)
+{
+	if (captureList && captureList->shaders.insert(sh).second) {
+		captureList->shaderRefs.emplace_back(new r_shaderHnd_c(sh));
+	}
+}
+
 // ==============
 // Virtual screen
 // ==============
@@ -1913,6 +2277,19 @@ void r_renderer_c::ToggleDebugImGui() {
 	debugImGui = !debugImGui;
 }
 
+void r_renderer_c::AddDebugPanel(std::string_view name, std::function<void()> draw)
+{
+	debugPanels[std::string(name)] = { std::move(draw), false };
+}
+
+void r_renderer_c::RemoveDebugPanel(std::string_view name)
+{
+	auto it = debugPanels.find(name);
+	if (it != debugPanels.end()) {
+		debugPanels.erase(it);
+	}
+}
+
 // ===========
 // Screenshots
 // ===========
@@ -9,11 +9,16 @@
 // =============
 
 #define R_MAXSHADERS 65536
+#define R_MAXRETAINEDBYTES (256 << 20)	// Display list storage limit, keeps command offsets well within 32 bits
 
 #include <array>
 #include <chrono>
 #include <deque>
 #include <imgui.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_set>
 #include <vector>
 
 // =======
@@ -38,7 +43,7 @@ public:
 	int		layer;
 	int		subLayer;
 
-	r_layer_c(r_renderer_c* renderer, int i_layer, int i_subLayer);
+	r_layer_c(r_renderer_c* renderer, int i_layer, int i_subLayer, bool i_retained = false);
 	~r_layer_c();
 
 	void	SetViewport(r_viewport_s* viewport);
@@ -46,6 +51,8 @@ public:
 	void	Bind(r_tex_c* tex);
 	void	Color(col4_t col);
 	void	Quad(float s0, float t0, float x0, float y0, float s1, float t1, float x1, float y1, float s2, float t2, float x2, float y2, float s3, float t3, float x3, float y3, int stackLayer = 0, int maskLayer = -1);
+	void	QuadBatch(int layout, const float* data, size_t count, float posScale, int stackLayer = 0, int maskLayer = -1);
+	void	Append(r_layer_c& src, glm::vec2 offset, float scale);
 	void	Render();
 	void    Discard();
 
@@ -59,8 +66,24 @@ public:
 
 private:
 	r_renderer_c* renderer;
+	bool	retained = false;	// Storage starts small and grows, for display lists
 
-	struct r_layerCmd_s* NewCommand(size_t size);
+	std::byte* Reserve(size_t size);
+	struct r_layerCmd_s* NewCommand(size_t size, size_t count = 1);
+};
+
+// Display list
+class r_displayList_c {
+public:
+	r_displayList_c(r_renderer_c* renderer);
+
+	void	Clear();
+
+	r_layer_c cmds;			// Recorded commands
+	bool	hasViewport = false;	// Recorded commands change the viewport?
+	bool	hasBlendMode = false;	// Recorded commands change the blend mode?
+	std::unordered_set<class r_shader_c*> shaders;
+	std::vector<std::unique_ptr<r_shaderHnd_c>> shaderRefs;	// Keeps recorded textures alive
 };
 
 // Renderer Main Class
@@ -75,6 +98,8 @@ public:
 	
 	r_shaderHnd_c* RegisterShader(std::string_view shname, int flags);
 	r_shaderHnd_c* RegisterShaderFromImage(std::unique_ptr<image_c> img, int flags);
+	r_shaderHnd_c* RegisterShaderFromImageAsync(std::function<std::unique_ptr<image_c>()> producer, int width, int height, int flags);
+	void	QueueImageJob(std::function<void()> job, int pri = 0);
 	void	GetShaderImageSize(r_shaderHnd_c* hnd, int &width, int &height);
 	void	SetShaderLoadingPriority(r_shaderHnd_c* hnd, int pri);
 	void	PumpShaders();
@@ -92,11 +117,21 @@ public:
 	void	GetDrawColor(col4_t color);
 	void	DrawImage(r_shaderHnd_c* hnd, glm::vec2 pos, glm::vec2 extent, glm::vec2 uv1 = { 0, 0 }, glm::vec2 uv2 = { 1, 1 }, int stackLayer = 0, std::optional<int> maskLayer = {});
 	void	DrawImageQuad(r_shaderHnd_c* hnd, glm::vec2 p0, glm::vec2 p1, glm::vec2 p2, glm::vec2 p3, glm::vec2 uv0 = { 0, 0 }, glm::vec2 uv1 = { 1, 0 }, glm::vec2 uv2 = { 1, 1 }, glm::vec2 uv3 = { 0, 1 }, int stackLayer = 0, std::optional<int> maskLayer = {});
+	void	DrawImageBatch(r_shaderHnd_c* hnd, int layout, const float* data, size_t count, float posScale = 1.0f, int stackLayer = 0, std::optional<int> maskLayer = {});
 	void	DrawString(float x, float y, int align, int height, const col4_t col, int font, const char* str);
 	void	DrawStringFormat(float x, float y, int align, int height, const col4_t col, int font, const char* fmt, ...);
 	int		DrawStringWidth(int height, int font, const char* str);
 	int		DrawStringCursorIndex(int height, int font, const char* str, int curX, int curY);
 
+	r_displayList_c* NewDisplayList();
+	void	FreeDisplayList(r_displayList_c* list);
+	void	BeginDisplayList(r_displayList_c* list);
+	void	EndDisplayList();
+	r_displayList_c* RecordingDisplayList();
+	void	ClearDisplayList(r_displayList_c* list);
+	bool	IsDisplayListEmpty(r_displayList_c* list);
+	void	DrawDisplayList(r_displayList_c* list, glm::vec2 offset = { 0, 0 }, float scale = 1.0f);
+
 	int		VirtualScreenWidth();
 	int		VirtualScreenHeight();
 	float	VirtualScreenScaleFactor();
@@ -106,6 +141,8 @@ public:
 	int		VirtualUnmap(int mappedValue);
 
 	void	ToggleDebugImGui();
+	void	AddDebugPanel(std::string_view name, std::function<void()> draw);
+	void	RemoveDebugPanel(std::string_view name);
 
 	// Encapsulated
 	r_renderer_c(sys_IMain* sysHnd);
@@ -144,6 +181,10 @@ public:
 	ImGuiContext* imguiCtx = nullptr;
 
 	r_font_c* fonts[F_NUMFONTS] = {}; // Font objects
+	timer_c	fontLoadTimer;		// Time since font loading began
+	bool	fontsPending = false;	// Font atlases still loading?
+	std::string	cursorText;			// Text of the last cursor index query
+	IndexedUTF32String cursorIdxStr;	// Decoded text of the last cursor index query
 
 	col4_t	drawColor = {};		// Current draw color
 
@@ -160,6 +201,13 @@ public:
 	r_layer_c** layerList = nullptr;
 	r_layer_c* curLayer = nullptr;
 
+	r_displayList_c* captureList = nullptr;	// Display list being recorded
+	r_layer_c* captureLayer = nullptr;		// Layer to return to when recording ends
+	r_viewport_s captureViewport = {};		// Viewport to return to when recording ends
+	int		captureBlendMode = 0;			// Blend mode to return to when recording ends
+	void	RetainCapturedShader(class r_shader_c* sh);
+	int		NewDataShaderSlot();
+
 	int		layerCmdBinCount = 0;
 	int		layerCmdBinSize = 0;
 	struct r_layerCmd_s** layerCmdBin = nullptr;
@@ -209,6 +257,12 @@ public:
 	bool	debugImGui = false;
 	bool	debugLayers = false;
 
+	struct DebugPanel {
+		std::function<void()> draw;
+		bool	open = false;
+	};
+	std::map<std::string, DebugPanel, std::less<>> debugPanels;
+
 	int		takeScreenshot = 0;
 	void	DoScreenshot(image_c* i, int type, const char* ext);
 
@@ -51,6 +51,7 @@ public:
 	// Interface
 	int		GetAsyncCount() override;
 	void	ProcessPendingTextureUploads() override;
+	void	AsyncJob(std::function<void()> job, int pri) override;
 
 	// Encapsulated
 	t_manager_c(r_renderer_c* renderer);
@@ -73,6 +74,11 @@ private:
 
 	std::vector<std::thread> workers;
 	std::vector<r_tex_c *> textureQueue;
+	struct job_s {
+		std::function<void()> func;
+		int		pri;
+	};
+	std::vector<job_s> jobQueue;
 	std::mutex mutex;
 
 	std::vector<r_tex_c *> uploadQueue;
@@ -133,7 +139,7 @@ t_manager_c::~t_manager_c()
 int t_manager_c::GetAsyncCount()
 {
 	std::lock_guard<std::mutex> lock ( mutex );
-	return (int)textureQueue.size();
+	return (int)(textureQueue.size() + jobQueue.size());
 }
 
 void t_manager_c::ProcessPendingTextureUploads()
@@ -145,6 +151,18 @@ void t_manager_c::ProcessPendingTextureUploads()
 	uploadQueue.clear();
 }
 
+void t_manager_c::AsyncJob(std::function<void()> job, int pri)
+{
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		if ( runnersRunning > 0 ) {
+			jobQueue.push_back({ std::move(job), pri });
+			return;
+		}
+	}
+	job();
+}
+
 bool t_manager_c::AsyncAdd(r_tex_c* tex)
 {
 	std::lock_guard<std::mutex> lock( mutex );
@@ -183,8 +201,10 @@ bool t_manager_c::AsyncRemove(r_tex_c* tex)
 
 void t_manager_c::EnqueueTextureUpload(r_tex_c* tex)
 {
+	// Publish the status under the lock so RemovePendingTextureUpload() never sees PENDING_UPLOAD before the entry is queued
 	std::scoped_lock lk(uploadMutex);
 	uploadQueue.push_back(tex);
+	tex->status = r_tex_c::PENDING_UPLOAD;
 }
 
 void t_manager_c::RemovePendingTextureUpload(r_tex_c* tex)
@@ -196,9 +216,11 @@ void t_manager_c::RemovePendingTextureUpload(r_tex_c* tex)
 
 void t_manager_c::ThreadProc()
 {
+	Zone_SetThreadName("Texture loader");
 	++runnersRunning;
 	while (doRun) {
 		r_tex_c *doTex = nullptr;
+		std::function<void()> doJob;
 		{
 			std::lock_guard<std::mutex> lock( mutex );
 
@@ -213,14 +235,28 @@ void t_manager_c::ThreadProc()
 				}
 			}
 
-			if (doTexItr != textureQueue.end()) {
+			// Jobs compete on the same priority scale, winning ties so that textures waiting on them can follow
+			auto doJobItr = jobQueue.end();
+			for (auto curJobItr = jobQueue.begin(); curJobItr != jobQueue.end(); ++curJobItr) {
+				if (doJobItr == jobQueue.end() || curJobItr->pri > doJobItr->pri) {
+					doJobItr = curJobItr;
+				}
+			}
+
+			if (doJobItr != jobQueue.end() && (doTexItr == textureQueue.end() || doJobItr->pri >= maxPri)) {
+				doJob = std::move(doJobItr->func);
+				jobQueue.erase(doJobItr);
+			}
+			else if (doTexItr != textureQueue.end()) {
 				doTex = *doTexItr;
 				textureQueue.erase(doTexItr);
 				doTex->status = r_tex_c::PROCESSING;
 			}
 		}
 	
-		if (doTex != nullptr) {
+		if (doJob) {
+			doJob();
+		} else if (doTex != nullptr) {
 			// Load this texture
 			doTex->LoadFile();
 			doTex = nullptr;
@@ -311,10 +347,24 @@ r_tex_c::r_tex_c(r_ITexManager* manager, std::unique_ptr<image_c> img, int flags
 	Init(manager, {}, flags);
 
 	// Direct upload
-	img = BuildMipSet(std::move(img));
+	this->img = BuildMipSet(std::move(img));
 	PerformUpload(this);
 }
 
+r_tex_c::r_tex_c(r_ITexManager* manager, std::function<std::unique_ptr<image_c>()> i_producer, int width, int height, int flags)
+{
+	Init(manager, {}, flags | TF_ASYNC);
+	producer = std::move(i_producer);
+	fileHeight = height;
+	fileWidth = width;
+
+	StartLoad();
+	if (status == INIT) {
+		// Load it now
+		LoadFile();
+	}
+}
+
 r_tex_c::~r_tex_c()
 {
 	if (status >= IN_QUEUE && status < DONE) {
@@ -383,8 +433,24 @@ void r_tex_c::ForceLoad()
 	}
 }
 
+void r_tex_c::CompleteLoad()
+{
+	// Block until the texture is usable, finishing any asynchronous load on the calling thread
+	if (status >= IN_QUEUE && status < DONE) {
+		manager->AsyncRemove(this);
+	}
+	if (status == INIT) {
+		flags &= ~TF_ASYNC;
+		LoadFile();
+	}
+	else if (status == PENDING_UPLOAD) {
+		PerformUpload(this);
+	}
+}
+
 std::unique_ptr<image_c> r_tex_c::BuildMipSet(std::unique_ptr<image_c> img)
 {
+	ZONE("Texture mip build");
 	const auto format = img->tex.format();
 
 	const bool blockCompressed = is_compressed(format);
@@ -569,32 +635,50 @@ void r_tex_c::LoadFile()
 		return;
 	}
 
-	// Try to load image file using appropriate loader
-	auto path = std::filesystem::u8path(fileName);
-	img = std::unique_ptr<image_c>(image_c::LoaderForFile(renderer->sys->con, path));
+	if (producer) {
+		// Build the image on this thread, the producer only runs once
+		std::function<std::unique_ptr<image_c>()> produce;
+		produce.swap(producer);
+		img = produce();
+		error = !img;
+		if (img) {
+			status = SIZE_KNOWN;
+		}
+	}
+	else {
+		// Try to load image file using appropriate loader
+		auto path = std::filesystem::u8path(fileName);
+		img = std::unique_ptr<image_c>(image_c::LoaderForFile(renderer->sys->con, path));
+		if (img) {
+			// Height goes first as size queries key off a non-zero width
+			auto sizeCallback = [this](int width, int height) {
+				this->fileHeight = height;
+				this->fileWidth = width;
+				this->status = SIZE_KNOWN;
+			};
+			ZONE("Texture decode");
+			error = img->Load(path, sizeCallback);
+		}
+	}
 	if (img) {
-		auto sizeCallback = [this](int width, int height) {
-			this->fileWidth = width;
-			this->fileHeight = height;
-			this->status = SIZE_KNOWN;
-		};
-		error = img->Load(path, sizeCallback);
 		if ( !error ) {
 			const bool useTextureFormatFallback = !renderer->texBC7;
 			if (useTextureFormatFallback) {
-				if (img->tex.format() == gli::FORMAT_RGBA_BP_UNORM_BLOCK16)
+				if (img->tex.format() == gli::FORMAT_RGBA_BP_UNORM_BLOCK16) {
+					ZONE("Texture transcode");
 					img->tex = TranscodeTexture(img->tex, gli::FORMAT_RGBA8_UNORM_PACK8, true);
+				}
 			}
 			stackLayers = img->tex.layers();
 			const bool is_async = !!(flags & TF_ASYNC);
 			img = BuildMipSet(std::move(img));
 
-			status = PENDING_UPLOAD;
 			if (is_async) {
 				// Post a main thread task to create and fill GPU textures.
 				manager->EnqueueTextureUpload(this);
 			}
 			else {
+				status = PENDING_UPLOAD;
 				PerformUpload(this);
 			}
 			return;
@@ -603,12 +687,22 @@ void r_tex_c::LoadFile()
 
 	auto raw = std::make_unique<image_c>();
 	raw->CopyRaw(IMGTYPE_GRAY, 8, 8, t_defaultTexture);
+	if (flags & TF_ASYNC) {
+		// Off the main thread, so the default image is uploaded like a successful load
+		img = std::move(raw);
+		manager->EnqueueTextureUpload(this);
+		return;
+	}
 	Upload(*raw, TF_NOMIPMAP);
 	status = DONE;
 }
 
 void r_tex_c::PerformUpload(r_tex_c* tex)
 {
+	ZONE("Texture upload");
+	if (tex->status == DONE || !tex->img) {
+		return;
+	}
 	tex->Upload(*tex->img, tex->flags);
 	tex->img = {};
 	tex->status = DONE;
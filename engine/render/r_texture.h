@@ -9,6 +9,7 @@
 // =======
 
 #include <atomic>
+#include <functional>
 #include <memory>
 #include <string>
 
@@ -36,11 +37,13 @@ public:
 	std::atomic<dword> fileWidth;
 	std::atomic<dword> fileHeight;
 	std::unique_ptr<image_c> img;
+	std::function<std::unique_ptr<image_c>()> producer;	// Builds the image instead of reading fileName
 	GLenum target{};
 	size_t stackLayers = 1;
 
 	r_tex_c(class r_ITexManager* manager, std::string_view fileName, int flags);
 	r_tex_c(class r_ITexManager* manager, std::unique_ptr<image_c> img, int flags);
+	r_tex_c(class r_ITexManager* manager, std::function<std::unique_ptr<image_c>()> producer, int width, int height, int flags);
 	~r_tex_c();
 
 	void	Bind();
@@ -50,6 +53,7 @@ public:
 	void	StartLoad();
 	void	AbortLoad();
 	void	ForceLoad();
+	void	CompleteLoad();
 	void	LoadFile();
 
 	static void PerformUpload(r_tex_c*);
@@ -74,4 +78,5 @@ public:
 
 	virtual int		GetAsyncCount() = 0;
 	virtual void	ProcessPendingTextureUploads() = 0;
+	virtual void	AsyncJob(std::function<void()> job, int pri) = 0;
 };
@@ -667,15 +667,20 @@ bool sys_main_c::Run(int argc, char** argv)
 #endif
 
 		// Initialise engine
+		Zone_SetThreadName("Main");
 		core->Init(argc, argv);
 
 		// Run frame loop
 		while (exitFlag == false) {
-			if (minimized) {
-				glfwWaitEventsTimeout(0.1);
-			}
-			else {
-				glfwPollEvents();
+			ZONE("Run");
+			{
+				ZONE("Poll events");
+				if (minimized) {
+					glfwWaitEventsTimeout(0.1);
+				}
+				else {
+					glfwPollEvents();
+				}
 			}
 			auto wnd = (GLFWwindow*)video->GetWindowHandle();
 			if (glfwWindowShouldClose(wnd)) {
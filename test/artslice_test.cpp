@@ -0,0 +1,252 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// Art Slicing Test
+//
+
+// Compares ArtSliceRectangle and ArtSliceArcBand against golden per-pixel slicers, and against the
+// row scanning arc band slicer they replaced, then times the old and new slicers.
+// Run with "bench" to only time them.
+
+#include "ui_artslice.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+// =========
+// Reference
+// =========
+
+// Guard bytes after each destination buffer catch writes past its end
+static const int GUARD_SIZE = 64;
+static const uint8_t GUARD_BYTE = 0xCD;
+
+struct testImage_s {
+	int		width = 0;
+	int		height = 0;
+	int		comp = 0;
+	std::vector<uint8_t> data;
+};
+
+static testImage_s RandomImage(std::mt19937& rng, int width, int height, int comp)
+{
+	testImage_s img;
+	img.width = width;
+	img.height = height;
+	img.comp = comp;
+	img.data.resize((size_t)width * height * comp);
+	for (auto& b : img.data) {
+		b = (uint8_t)rng();
+	}
+	return img;
+}
+
+static void GoldenRectangle(const testImage_s& src, int x1, int y1, int x2, int y2, uint8_t* dst)
+{
+	const int dstWidth = x2 - x1;
+	for (int y = y1; y < y2; y++) {
+		for (int x = x1; x < x2; x++) {
+			for (int c = 0; c < src.comp; c++) {
+				dst[((y - y1) * dstWidth + (x - x1)) * src.comp + c] = src.data[((size_t)y * src.width + x) * src.comp + c];
+			}
+		}
+	}
+}
+
+// A pixel is in the band if its center lies between the two radii, inclusive, measured in doubled coordinates
+static void GoldenArcBand(const testImage_s& src, int xC, int yC, int rMin, int rMax, uint8_t* dst)
+{
+	const int x1 = xC - rMax;
+	const int y1 = yC - rMax;
+	const int rMinSq = (rMin * 2) * (rMin * 2), rMaxSq = (rMax * 2) * (rMax * 2);
+	for (int y = 0; y < rMax; y++) {
+		for (int x = 0; x < rMax; x++) {
+			const int dx = rMax * 2 - (x * 2 + 1);
+			const int dy = rMax * 2 - (y * 2 + 1);
+			const int rSq = dx * dx + dy * dy;
+			const bool inside = rSq >= rMinSq && rSq <= rMaxSq;
+			for (int c = 0; c < src.comp; c++) {
+				dst[(y * rMax + x) * src.comp + c] = inside ? src.data[((size_t)(y1 + y) * src.width + x1 + x) * src.comp + c] : 0;
+			}
+		}
+	}
+}
+
+// The arc band slicer as it was before the spans were solved directly, scanning each row for both ends
+static void ScanArcBand(const uint8_t* src, int srcWidth, int comp, int xC, int yC, int rMin, int rMax, uint8_t* dst)
+{
+	const int x1 = xC - rMax;
+	const int y1 = yC - rMax;
+	const int dstStride = rMax * comp;
+	const int srcStride = srcWidth * comp;
+	memset(dst, 0x00, rMax * dstStride);
+
+	const int rMinSq = (rMin * 2) * (rMin * 2), rMaxSq = (rMax * 2) * (rMax * 2);
+	const int width = rMax * 2, height = rMax * 2;
+	for (int row = 1; row < height; row += 2) {
+		const int dy = height - row;
+		int colLo = -1;
+		for (int x = 1; x < width; x += 2) {
+			const int dx = width - x;
+			if (dx * dx + dy * dy <= rMaxSq) {
+				colLo = x;
+				break;
+			}
+		}
+		if (colLo == -1)
+			continue;
+		int colHi = width;
+		for (int x = colLo; x < width; x += 2) {
+			const int dx = width - x;
+			if (dx * dx + dy * dy < rMinSq) {
+				colHi = x;
+				break;
+			}
+		}
+		const int xLo = colLo / 2;
+		const int xHi = colHi / 2;
+		if (xLo != xHi) {
+			const int y = row / 2;
+			memcpy(dst + y * dstStride + xLo * comp, src + (y1 + y) * srcStride + (x1 + xLo) * comp, (xHi - xLo) * comp);
+		}
+	}
+}
+
+// =====
+// Tests
+// =====
+
+static int failures = 0;
+
+static bool CheckGuard(const std::vector<uint8_t>& buf, size_t size)
+{
+	for (size_t i = size; i < buf.size(); i++) {
+		if (buf[i] != GUARD_BYTE) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void Fail(const char* what, int a, int b, int c, int comp)
+{
+	if (failures++ < 20) {
+		printf("FAILED: %s (%d, %d, %d) with %d components\n", what, a, b, c, comp);
+	}
+}
+
+static void TestRectangles(std::mt19937& rng)
+{
+	for (int comp : { 1, 3, 4 }) {
+		const testImage_s src = RandomImage(rng, 67, 45, comp);
+		for (int x1 = 0; x1 <= src.width; x1 += 3) {
+			for (int x2 = x1; x2 <= src.width; x2 += 5) {
+				for (int y1 = 0; y1 <= src.height; y1 += 4) {
+					const int y2 = std::min(y1 + (x2 - x1) % 17 + 1, src.height);
+					const size_t size = (size_t)(x2 - x1) * (y2 - y1) * comp;
+					std::vector<uint8_t> got(size + GUARD_SIZE, GUARD_BYTE);
+					std::vector<uint8_t> want(size);
+					ArtSliceRectangle(src.data.data(), src.width, comp, x1, y1, x2, y2, got.data());
+					GoldenRectangle(src, x1, y1, x2, y2, want.data());
+					if (!CheckGuard(got, size)) {
+						Fail("ArtSliceRectangle wrote past the destination", x1, y1, x2, comp);
+					} else if (size && memcmp(got.data(), want.data(), size)) {
+						Fail("ArtSliceRectangle differs from golden", x1, y1, x2, comp);
+					}
+				}
+			}
+		}
+	}
+}
+
+static void TestArcBand(const testImage_s& src, int xC, int yC, int rMin, int rMax)
+{
+	const size_t size = (size_t)rMax * rMax * src.comp;
+	std::vector<uint8_t> got(size + GUARD_SIZE, GUARD_BYTE);
+	std::vector<uint8_t> scan(size);
+	std::vector<uint8_t> want(size);
+	ArtSliceArcBand(src.data.data(), src.width, src.comp, xC, yC, rMin, rMax, got.data());
+	ScanArcBand(src.data.data(), src.width, src.comp, xC, yC, rMin, rMax, scan.data());
+	GoldenArcBand(src, xC, yC, rMin, rMax, want.data());
+	if (!CheckGuard(got, size)) {
+		Fail("ArtSliceArcBand wrote past the destination", xC, rMin, rMax, src.comp);
+	} else if (memcmp(got.data(), want.data(), size)) {
+		Fail("ArtSliceArcBand differs from golden", xC, rMin, rMax, src.comp);
+	} else if (memcmp(got.data(), scan.data(), size)) {
+		Fail("ArtSliceArcBand differs from the row scanning slicer", xC, rMin, rMax, src.comp);
+	}
+}
+
+static void TestArcBands(std::mt19937& rng)
+{
+	// Every radius pair up to 128, then a strided sweep up to 300; the centre is offset so the band isn't at the image origin
+	const int maxRadius = 300;
+	const testImage_s src1 = RandomImage(rng, maxRadius + 9, maxRadius + 7, 1);
+	for (int rMax = 1; rMax <= maxRadius; rMax++) {
+		const int step = rMax <= 128 ? 1 : 7;
+		for (int rMin = 0; rMin <= rMax; rMin += step) {
+			TestArcBand(src1, rMax + 3, rMax + 5, rMin, rMax);
+		}
+		TestArcBand(src1, rMax + 3, rMax + 5, rMax, rMax);
+	}
+	for (int comp : { 3, 4 }) {
+		const testImage_s src = RandomImage(rng, 140, 150, comp);
+		for (int rMax = 1; rMax <= 128; rMax += 3) {
+			for (int rMin = 0; rMin <= rMax; rMin += 5) {
+				TestArcBand(src, rMax + 2, rMax + 1, rMin, rMax);
+			}
+		}
+	}
+}
+
+// =========
+// Benchmark
+// =========
+
+template <typename Func>
+static double TimeMsec(int iterations, Func&& func)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		func();
+	}
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+static void Benchmark(std::mt19937& rng)
+{
+	const testImage_s src = RandomImage(rng, 2048, 2048, 4);
+	std::vector<uint8_t> dst((size_t)1024 * 1024 * 4);
+
+	double rect = TimeMsec(50, [&] { ArtSliceRectangle(src.data.data(), src.width, 4, 512, 512, 1536, 1536, dst.data()); });
+	double rectGolden = TimeMsec(5, [&] { GoldenRectangle(src, 512, 512, 1536, 1536, dst.data()); });
+	printf("rectangle 1024x1024 RGBA: %.3f ms, per-pixel copy %.3f ms\n", rect, rectGolden);
+
+	for (int rMax : { 64, 256, 1024 }) {
+		const int rMin = rMax * 3 / 4;
+		double arc = TimeMsec(50, [&] { ArtSliceArcBand(src.data.data(), src.width, 4, 1536, 1536, rMin, rMax, dst.data()); });
+		double arcScan = TimeMsec(10, [&] { ScanArcBand(src.data.data(), src.width, 4, 1536, 1536, rMin, rMax, dst.data()); });
+		printf("arc band %d to %d RGBA: %.3f ms, row scanning %.3f ms (%.1fx)\n", rMin, rMax, arc, arcScan, arcScan / arc);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::mt19937 rng(1234);
+	const bool benchOnly = argc > 1 && !strcmp(argv[1], "bench");
+	if (!benchOnly) {
+		TestRectangles(rng);
+		TestArcBands(rng);
+		if (failures) {
+			printf("%d failures\n", failures);
+			return 1;
+		}
+		printf("All art slices match\n");
+	}
+	Benchmark(rng);
+	return 0;
+}
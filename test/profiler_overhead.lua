@@ -0,0 +1,79 @@
+-- SimpleGraphic profiler overhead test
+--
+-- Run as the main script of the SimpleGraphic host, or through ctest with SIMPLEGRAPHIC_BUILD_TESTS and SIMPLEGRAPHIC_TEST_HOST set
+-- Times a calculation loop of small table allocations and function calls with SetProfiling() off and on,
+-- alternating between the two so that clock and cache drift hit both alike, and compares the medians.
+-- Prints "profiler_overhead: PASSED" if profiling costs less than 5%, otherwise "profiler_overhead: FAILED".
+
+local ROUNDS = 15
+local ITERATIONS = 20000
+local MAX_OVERHEAD = 0.05
+
+local function mod(stat, base, inc, more)
+	return { stat = stat, value = (base + inc) * (1 + more / 100) }
+end
+
+local function sumMods(list, name)
+	local total = 0
+	for _, m in ipairs(list) do
+		if m.stat == name then
+			total = total + m.value
+		end
+	end
+	return total
+end
+
+local function calc(iter)
+	local names = { "Life", "Mana", "Armour", "Evasion", "Damage", "Speed" }
+	local acc = 0
+	for i = 1, iter do
+		local list = { }
+		for j = 1, 40 do
+			list[j] = mod(names[(i + j) % #names + 1], j, i % 7, (i * j) % 50)
+		end
+		for k = 1, #names do
+			acc = acc + sumMods(list, names[k])
+		end
+		if i % 64 == 0 then
+			acc = acc + #string.format("%s=%.2f", names[i % #names + 1], acc % 1000)
+		end
+	end
+	return acc
+end
+
+local function timeCalc()
+	local start = GetTime()
+	calc(ITERATIONS)
+	return GetTime() - start
+end
+
+local function median(list)
+	table.sort(list)
+	return list[math.floor(#list / 2) + 1]
+end
+
+local main = { }
+
+function main:OnInit()
+	-- Warm up the JIT before timing anything
+	timeCalc()
+	timeCalc()
+
+	local off, on = { }, { }
+	for round = 1, ROUNDS do
+		off[round] = timeCalc()
+		SetProfiling(true)
+		on[round] = timeCalc()
+		SetProfiling(false)
+	end
+
+	local offMsec = math.max(median(off), 1)
+	local onMsec = median(on)
+	local overhead = onMsec / offMsec - 1
+	local result = overhead < MAX_OVERHEAD and "PASSED" or "FAILED"
+	ConPrintf("profiler_overhead: unprofiled %d ms, profiled %d ms, overhead %.1f%%", offMsec, onMsec, overhead * 100)
+	ConPrintf("profiler_overhead: %s", result)
+	Exit(result == "FAILED" and "profiler_overhead: FAILED" or nil)
+end
+
+SetMainObject(main)
@@ -0,0 +1,132 @@
+-- SimpleGraphic sub script call queue stress test
+--
+-- Run as the main script of the SimpleGraphic host, or through ctest with SIMPLEGRAPHIC_BUILD_TESTS and SIMPLEGRAPHIC_TEST_HOST set
+-- Several sub scripts each make thousands of OnSubCall round trips, alternating function calls and sub
+-- calls. Every call carries its sequence number, so calls that arrive out of order, twice or not at all
+-- fail the test, as do function replies that go to the wrong call. A few waves of short sub scripts are
+-- run afterwards, as freeing sub scripts straight after they finish is where teardown races show up.
+-- Prints "subscript_stress: PASSED" with the throughput, or "subscript_stress: FAILED" with the reason.
+
+local SCRIPT_COUNT = 8
+local CALLS_PER_SCRIPT = 5000
+local WAVE_COUNT = 50
+local WAVE_SIZE = 16
+
+local subScript = [[
+local index, count = ...
+for i = 1, count do
+	if i % 2 == 1 then
+		local echoIndex, echoSeq = Echo(index, i)
+		if echoIndex ~= index or echoSeq ~= i then
+			error(string.format("script %d call %d got reply for script %s call %s", index, i, tostring(echoIndex), tostring(echoSeq)))
+		end
+	else
+		Note(index, i)
+	end
+end
+return index, count
+]]
+
+local main = { }
+
+function main:Fail(fmt, ...)
+	local msg = string.format(fmt, ...)
+	ConPrintf("subscript_stress: FAILED: %s", msg)
+	self.done = true
+	Exit("subscript_stress: FAILED: " .. msg)
+end
+
+function main:Launch(index, count)
+	local id = LaunchSubScript(subScript, "Echo", "Note", index, count)
+	if not id then
+		self:Fail("LaunchSubScript() failed for script %d", index)
+		return
+	end
+	self.scripts[id] = index
+	self.expected[index] = count
+	self.lastSeq[index] = 0
+	self.running = self.running + 1
+end
+
+function main:OnInit()
+	self.scripts = { }
+	self.expected = { }
+	self.lastSeq = { }
+	self.running = 0
+	self.calls = 0
+	self.wave = 0
+	self.startTime = GetTime()
+	for index = 1, SCRIPT_COUNT do
+		self:Launch(index, CALLS_PER_SCRIPT)
+	end
+end
+
+function main:OnSubCall(name, index, seq)
+	if self.done then
+		return
+	end
+	local last = self.lastSeq[index]
+	if not last then
+		self:Fail("%s() from unknown script %s", tostring(name), tostring(index))
+		return
+	end
+	if seq ~= last + 1 then
+		self:Fail("script %d: %s() call %s arrived after call %d", index, tostring(name), tostring(seq), last)
+		return
+	end
+	local expectedName = seq % 2 == 1 and "Echo" or "Note"
+	if name ~= expectedName then
+		self:Fail("script %d call %d: expected %s(), got %s()", index, seq, expectedName, tostring(name))
+		return
+	end
+	self.lastSeq[index] = seq
+	self.calls = self.calls + 1
+	if name == "Echo" then
+		return index, seq
+	end
+end
+
+function main:OnSubError(id, errMsg)
+	if not self.done then
+		self:Fail("script %s: %s", tostring(self.scripts[id]), tostring(errMsg))
+	end
+end
+
+function main:OnSubFinished(id, index, count)
+	if self.done then
+		return
+	end
+	local expectedIndex = self.scripts[id]
+	if index ~= expectedIndex or count ~= self.expected[index] then
+		self:Fail("script %s finished with results %s, %s", tostring(expectedIndex), tostring(index), tostring(count))
+		return
+	end
+	if self.lastSeq[index] ~= count then
+		self:Fail("script %d finished after %d of %d calls", index, self.lastSeq[index], count)
+		return
+	end
+	self.scripts[id] = nil
+	self.running = self.running - 1
+end
+
+function main:OnFrame()
+	if self.done or self.running > 0 then
+		return
+	end
+	if self.wave == 0 then
+		local msec = math.max(GetTime() - self.startTime, 1)
+		ConPrintf("subscript_stress: %d round trips from %d sub scripts in %d ms (%.0f calls/s)", self.calls, SCRIPT_COUNT, msec, self.calls * 1000 / msec)
+	end
+	if self.wave < WAVE_COUNT then
+		self.wave = self.wave + 1
+		for i = 1, WAVE_SIZE do
+			self:Launch(SCRIPT_COUNT + (self.wave - 1) * WAVE_SIZE + i, 2)
+		end
+		return
+	end
+	ConPrintf("subscript_stress: PASSED")
+	self.done = true
+	Exit()
+end
+
+SetMainObject(main)
@@ -0,0 +1,362 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// Module: UI Allocation Tracker
+//
+
+#include "ui_local.h"
+
+#include "luajit.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <imgui.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// =======
+// Classes
+// =======
+
+// Bytes allocated between call site samples; each sample is charged with everything allocated since the previous one
+static const int64_t ALLOC_SAMPLE_BYTES = 128 * 1024;
+
+// Live heap history: a point every 100 msec for the last minute
+static const int ALLOC_HISTORY_MSEC = 100;
+static const size_t ALLOC_HISTORY_LENGTH = 600;
+
+// One attached Lua state; apart from liveBytes, only the thread running the state touches it
+struct ui_allocState_s {
+	class ui_allocTracker_c* tracker = nullptr;
+	lua_State* L = nullptr;
+	std::string label;
+	lua_Hook onHookCleared = nullptr;
+	lua_Alloc origAlloc = nullptr;
+	void*	origUd = nullptr;
+	std::atomic<int64_t> liveBytes = 0;		// Written by the state's thread only, read by the panel
+	int64_t	untilSample = ALLOC_SAMPLE_BYTES;
+	int64_t	pendingBytes = 0;
+	int64_t	pendingCount = 0;
+	std::string sampleKey;
+};
+
+struct ui_allocSite_s {
+	std::string key;
+	int64_t	bytes = 0;
+	int64_t	count = 0;
+};
+
+// ==========================
+// ui_IAllocTracker Interface
+// ==========================
+
+class ui_allocTracker_c: public ui_IAllocTracker {
+public:
+	// Interface
+	void	Attach(lua_State* L, const char* label, lua_Hook onHookCleared);
+	void	Detach(lua_State* L);
+	void	SetSampling(bool enable);
+	bool	IsSampling();
+	void	AllocFrame();
+	void	PrintReport();
+	bool	WriteFolded(const std::filesystem::path& fileName);
+
+	// Encapsulated
+	ui_allocTracker_c(ui_main_c* ui);
+	~ui_allocTracker_c();
+
+	ui_main_c* ui = nullptr;
+	std::atomic<bool> sampling = false;
+
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ui_allocState_s>> states;		// Guarded by mutex
+	std::unordered_map<std::string, ui_allocSite_s> sites;		// Guarded by mutex; keyed by folded stack, rooted at the state's label
+
+	// Main thread only
+	std::chrono::steady_clock::time_point historyTime;
+	std::vector<float> mainHistory;		// MiB
+	std::vector<float> subHistory;
+
+	void	Sample(ui_allocState_s* s, lua_State* L);
+	void	SortSites(std::vector<ui_allocSite_s>& out);
+	void	DrawPanel();
+};
+
+ui_IAllocTracker* ui_IAllocTracker::GetHandle(ui_main_c* ui)
+{
+	return new ui_allocTracker_c(ui);
+}
+
+void ui_IAllocTracker::FreeHandle(ui_IAllocTracker* hnd)
+{
+	delete (ui_allocTracker_c*)hnd;
+}
+
+ui_allocTracker_c::ui_allocTracker_c(ui_main_c* ui)
+	: ui(ui)
+{
+	if (ui->renderer) {
+		ui->renderer->AddDebugPanel("Lua Heap", [this] { DrawPanel(); });
+	}
+}
+
+ui_allocTracker_c::~ui_allocTracker_c()
+{
+	if (ui->renderer) {
+		ui->renderer->RemoveDebugPanel("Lua Heap");
+	}
+}
+
+// ==================
+// Allocator and Hook
+// ==================
+
+static void* l_allocTracked(void* ud, void* ptr, size_t osize, size_t nsize);
+
+static void l_allocHook(lua_State* L, lua_Debug* ar)
+{
+	void* ud;
+	if (lua_getallocf(L, &ud) == l_allocTracked) {
+		auto s = (ui_allocState_s*)ud;
+		s->tracker->Sample(s, L);
+		if (s->onHookCleared) {
+			s->onHookCleared(L, ar);
+		}
+	}
+}
+
+// Forwards to the state's own allocator, so LuaJIT's placement requirements for GC memory still hold
+static void* l_allocTracked(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	auto s = (ui_allocState_s*)ud;
+	void* out = s->origAlloc(s->origUd, ptr, osize, nsize);
+	if (nsize && !out) {
+		return out;
+	}
+	// LuaJIT passes the old size of every block, so the live total is exact
+	// Only this thread writes it, so a plain store avoids a locked add on every allocation
+	s->liveBytes.store(s->liveBytes.load(std::memory_order_relaxed) + (int64_t)nsize - (int64_t)osize, std::memory_order_relaxed);
+	if (nsize > osize && s->tracker->sampling.load(std::memory_order_relaxed)) {
+		s->pendingBytes += nsize - osize;
+		s->pendingCount++;
+		s->untilSample -= nsize - osize;
+		if (s->untilSample <= 0 && !lua_gethook(s->L)) {
+			// The stack can't be read safely from inside the allocator, so the next instruction takes the sample
+			// Any other hook takes precedence; the bytes keep adding up until it has gone
+			lua_sethook(s->L, l_allocHook, LUA_MASKCOUNT, 1);
+		}
+	}
+	return out;
+}
+
+void ui_allocTracker_c::Sample(ui_allocState_s* s, lua_State* L)
+{
+	if (lua_gethook(L) == l_allocHook) {
+		lua_sethook(L, NULL, 0, 0);
+	}
+
+	// Taken first, as reading the stack may allocate
+	const int64_t bytes = s->pendingBytes;
+	const int64_t count = s->pendingCount;
+	s->pendingBytes = 0;
+	s->pendingCount = 0;
+	s->untilSample = ALLOC_SAMPLE_BYTES;
+	if ( !sampling ) {
+		return;
+	}
+
+	size_t len;
+	s->sampleKey = s->label;
+	s->sampleKey += ';';
+	const char* stack = luaJIT_profile_dumpstack(L, "pF;", -100, &len);
+	s->sampleKey.append(stack, len);
+	const char* line = luaJIT_profile_dumpstack(L, "pl", 1, &len);
+	s->sampleKey.append(line, len);
+
+	std::lock_guard lock(mutex);
+	auto& site = sites[s->sampleKey];
+	if (site.key.empty()) {
+		site.key = s->sampleKey;
+	}
+	site.bytes += bytes;
+	site.count += count;
+}
+
+// ==============
+// State Tracking
+// ==============
+
+void ui_allocTracker_c::Attach(lua_State* L, const char* label, lua_Hook onHookCleared)
+{
+	auto s = std::make_unique<ui_allocState_s>();
+	s->tracker = this;
+	s->L = L;
+	s->label = label;
+	s->onHookCleared = onHookCleared;
+	s->origAlloc = lua_getallocf(L, &s->origUd);
+	// Blocks from before now get freed through the wrapper too, so it starts from the current total
+	s->liveBytes = (int64_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+	lua_setallocf(L, l_allocTracked, s.get());
+
+	std::lock_guard lock(mutex);
+	states.push_back(std::move(s));
+}
+
+void ui_allocTracker_c::Detach(lua_State* L)
+{
+	std::lock_guard lock(mutex);
+	auto it = std::find_if(states.begin(), states.end(), [L](auto& s) { return s->L == L; });
+	if (it == states.end()) {
+		return;
+	}
+	if (lua_gethook(L) == l_allocHook) {
+		lua_sethook(L, NULL, 0, 0);
+	}
+	lua_setallocf(L, (*it)->origAlloc, (*it)->origUd);
+	states.erase(it);
+}
+
+void ui_allocTracker_c::SetSampling(bool enable)
+{
+	if (enable) {
+		std::lock_guard lock(mutex);
+		sites.clear();
+	}
+	sampling = enable;
+}
+
+bool ui_allocTracker_c::IsSampling()
+{
+	return sampling;
+}
+
+void ui_allocTracker_c::AllocFrame()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now - historyTime < std::chrono::milliseconds(ALLOC_HISTORY_MSEC)) {
+		return;
+	}
+	historyTime = now;
+
+	int64_t mainBytes = 0, subBytes = 0;
+	{
+		std::lock_guard lock(mutex);
+		for (auto& s : states) {
+			(s->L == ui->L ? mainBytes : subBytes) += s->liveBytes.load(std::memory_order_relaxed);
+		}
+	}
+	auto append = [](std::vector<float>& history, int64_t bytes) {
+		if (history.size() >= ALLOC_HISTORY_LENGTH) {
+			history.erase(history.begin());
+		}
+		history.push_back(bytes / (1024.0f * 1024.0f));
+	};
+	append(mainHistory, mainBytes);
+	append(subHistory, subBytes);
+}
+
+// =========
+// Reporting
+// =========
+
+void ui_allocTracker_c::SortSites(std::vector<ui_allocSite_s>& out)
+{
+	{
+		std::lock_guard lock(mutex);
+		out.clear();
+		out.reserve(sites.size());
+		for (auto& [key, site] : sites) {
+			out.push_back(site);
+		}
+	}
+	std::sort(out.begin(), out.end(), [](const ui_allocSite_s& a, const ui_allocSite_s& b) {
+		return a.bytes != b.bytes ? a.bytes > b.bytes : a.key < b.key;
+	});
+}
+
+// Leaf function and current line of a folded stack
+static std::string SiteName(const std::string& key)
+{
+	size_t line = key.rfind(';');
+	size_t func = line == std::string::npos || line == 0 ? std::string::npos : key.rfind(';', line - 1);
+	return func == std::string::npos ? key : key.substr(func + 1);
+}
+
+void ui_allocTracker_c::PrintReport()
+{
+	std::vector<ui_allocSite_s> sorted;
+	SortSites(sorted);
+	if (sorted.empty()) {
+		return;
+	}
+	int64_t totalBytes = 0;
+	for (auto& site : sorted) {
+		totalBytes += site.bytes;
+	}
+	ui->sys->con->Printf("Allocation sites, %.1f MiB sampled:\n", totalBytes / (1024.0 * 1024.0));
+	for (size_t i = 0; i < sorted.size() && i < 20; i++) {
+		ui->sys->con->Printf("%s: %.1f KiB in %lld allocations (%.1f%%)\n", SiteName(sorted[i].key).c_str(), sorted[i].bytes / 1024.0, (long long)sorted[i].count, sorted[i].bytes * 100.0 / totalBytes);
+	}
+}
+
+bool ui_allocTracker_c::WriteFolded(const std::filesystem::path& fileName)
+{
+	std::vector<ui_allocSite_s> sorted;
+	SortSites(sorted);
+	std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+	for (auto& site : sorted) {
+		out << site.key << " " << site.bytes << "\n";
+	}
+	if ( !out ) {
+		ui->sys->con->Warning("couldn't write allocation profile to '%s'", fileName.generic_u8string().c_str());
+		return false;
+	}
+	return true;
+}
+
+void ui_allocTracker_c::DrawPanel()
+{
+	bool enable = sampling;
+	if (ImGui::Checkbox("Sample call sites", &enable)) {
+		SetSampling(enable);
+	}
+
+	if ( !mainHistory.empty() ) {
+		ImGui::Text("Main: %.1f MiB, sub scripts: %.1f MiB", mainHistory.back(), subHistory.back());
+		float scaleMax = 1.0f;
+		for (float mib : mainHistory) {
+			scaleMax = std::max(scaleMax, mib * 1.1f);
+		}
+		for (float mib : subHistory) {
+			scaleMax = std::max(scaleMax, mib * 1.1f);
+		}
+		ImGui::PlotLines("Main", mainHistory.data(), (int)mainHistory.size(), 0, nullptr, 0.0f, scaleMax, ImVec2(0, 80));
+		ImGui::PlotLines("Sub scripts", subHistory.data(), (int)subHistory.size(), 0, nullptr, 0.0f, scaleMax, ImVec2(0, 80));
+	}
+
+	std::vector<ui_allocSite_s> sorted;
+	SortSites(sorted);
+	if ( !sorted.empty() && ImGui::BeginTable("Allocation sites", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit)) {
+		ImGui::TableSetupColumn("State");
+		ImGui::TableSetupColumn("Call site");
+		ImGui::TableSetupColumn("KiB");
+		ImGui::TableSetupColumn("Allocations");
+		ImGui::TableHeadersRow();
+		for (size_t i = 0; i < sorted.size() && i < 30; i++) {
+			auto& site = sorted[i];
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn();
+			ImGui::Text("%s", site.key.substr(0, site.key.find(';')).c_str());
+			ImGui::TableNextColumn();
+			ImGui::Text("%s", SiteName(site.key).c_str());
+			ImGui::TableNextColumn();
+			ImGui::Text("%.1f", site.bytes / 1024.0);
+			ImGui::TableNextColumn();
+			ImGui::Text("%lld", (long long)site.count);
+		}
+		ImGui::EndTable();
+	}
+}
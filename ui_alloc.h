@@ -0,0 +1,30 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// UI Allocation Tracker Header
+//
+
+// ==========
+// Interfaces
+// ==========
+
+// UI Allocation Tracker
+// Counts the heap of each attached Lua state and, while sampling, attributes allocations to the Lua call sites that made them
+class ui_IAllocTracker {
+public:
+	static ui_IAllocTracker* GetHandle(class ui_main_c*);
+	static void FreeHandle(ui_IAllocTracker*);
+
+	// Wraps the state's allocator, which keeps serving every request; label roots the state's call sites, e.g. "Main"
+	// onHookCleared is called after the sampler removes its own count hook, for states that set other hooks asynchronously
+	virtual void	Attach(lua_State* L, const char* label, lua_Hook onHookCleared = nullptr) = 0;
+	// Restores the original allocator; must be called before the state is closed
+	virtual void	Detach(lua_State* L) = 0;
+	virtual void	SetSampling(bool enable) = 0;
+	virtual bool	IsSampling() = 0;
+	// Records the live heap history shown in the debug hub
+	virtual void	AllocFrame() = 0;
+	virtual void	PrintReport() = 0;
+	// Writes the sampled call sites weighted by bytes, in folded stack format
+	virtual bool	WriteFolded(const std::filesystem::path& fileName) = 0;
+};
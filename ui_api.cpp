@@ -6,11 +6,14 @@
 
 #include "ui_local.h"
 
+#include <condition_variable>
 #include <filesystem>
 #include <fstream>
+#include <mutex>
 #include <zlib.h>
 #include <cmath>
 
+#include "core/core_compress.h"
 #include "core/core_tex_manipulation.h"
 
 /* OnFrame()
@@ -28,7 +31,8 @@
 ** SetMainObject(object)
 **
 ** artHandle = NewArtHandle("<filename>")
-** width, height = artHandle:Size()
+** width, height = artHandle:Size()  Waits for the image header if the art is still loading, returns nil once the art has failed to decode
+** isLoading = artHandle:IsLoading()
 **
 ** imgHandle = NewImageHandle()
 ** imgHandle:Load("<fileName>"[, "flag1"[, "flag2"...]])  flag:{"ASYNC"|"CLAMP"|"MIPMAP"}
@@ -40,6 +44,13 @@
 ** imgHandle:SetLoadingPriority(pri)
 ** width, height = imgHandle:ImageSize()
 **
+** dlHandle = NewDisplayList()
+** dlHandle:Begin()  -- draw calls until End are recorded instead of drawn, SetDrawLayer can't be used while recording
+** dlHandle:End()
+** dlHandle:Draw([x, y[, scale]])
+** dlHandle:Clear()
+** isEmpty = dlHandle:IsEmpty()
+**
 ** texHandle = NewTexHandle()
 ** texHandle:Allocate(format, width, height, layerCount, mipCount)
 ** texHandle:Load("<fileName>")
@@ -62,10 +73,13 @@
 ** SetDrawColor(red, green, blue[, alpha]) / SetDrawColor("<escapeStr>")
 ** DrawImage({imgHandle|nil}, left, top, width, height[, tcLeft, tcTop, tcRight, tcBottom][, stackIdx[, maskIdx]])  maskIdx: use a stack layer as multiplicative mask
 ** DrawImageQuad({imgHandle|nil}, x1, y1, x2, y2, x3, y3, x4, y4[, s1, t1, s2, t2, s3, t3, s4, t4][, stackIdx[, maskIdx]])
+** DrawImageBatch({imgHandle|nil}, layout{"RECT"|"QUAD"}, data[, count[, stackIdx[, maskIdx]]])  data: table of numbers or FFI float array (float[n] or float[?], not a pointer), 8 numbers per RECT as DrawImage, 16 per QUAD as DrawImageQuad
 ** DrawString(left, top, align{"LEFT"|"CENTER"|"RIGHT"|"CENTER_X"|"RIGHT_X"}, height, font{"FIXED"|"VAR"|"VAR BOLD"|"FONTIN SC"|"FONTIN SC ITALIC"|"FONTIN"|"FONTIN ITALIC"}, "<text>")
+** DrawStringBatch({ {left, top, align, height, font, "<text>"}, ... })  same fields as DrawString, runs sharing align/font/height resolve them once
 ** width = DrawStringWidth(height, font{"FIXED"|"VAR"|"VAR BOLD"|"FONTIN SC"|"FONTIN SC ITALIC"|"FONTIN"|"FONTIN ITALIC"}, "<text>")
 ** index = DrawStringCursorIndex(height, font{"FIXED"|"VAR"|"VAR BOLD"|"FONTIN SC"|"FONTIN SC ITALIC"|"FONTIN"|"FONTIN ITALIC"}, "<text>", cursorX, cursorY)
 ** str = StripEscapes("<string>")
+** length = StripEscapesLength("<string>")
 ** count = GetAsyncCount()
 **
 ** searchHandle = NewFileSearch("<spec>"[, findDirectories])
@@ -85,15 +99,44 @@
 ** string = Paste()
 ** compressed = Deflate(uncompressed)
 ** uncompressed = Inflate(compressed)
+** compressed = DeflateParallel(uncompressed[, level[, threads]])  Output is Inflate-compatible, threads: 0 for all hardware threads (default)
+** deflateHandle = NewDeflateStream([level[, windowBits]])  level: 0-9 (default 9), windowBits: 9-15 (default 15), negative for raw deflate, +16 for gzip
+** compressed = deflateHandle:Write(data)
+** compressed = deflateHandle:Finish([data])
+** inflateHandle = NewInflateStream([windowBits])  windowBits: 8-15 (default 15), negative for raw deflate, +16 for gzip, +32 to detect zlib or gzip
+** uncompressed, finished, more = inflateHandle:Write(compressed)  Output is limited to 16 MiB per call; while more is true, call Write("") to get the rest
+** compressed = CompressZstd(data[, level])  level: negative for fast modes up to 22 (default 3)
+** data = DecompressZstd(compressed)
+** zstdHandle = NewZstdHandle([level[, dictionary]])
+** compressed = zstdHandle:Compress(data)  Resets any stream in progress
+** data = zstdHandle:Decompress(compressed)
+** compressed = zstdHandle:CompressStream(data[, finish])
+** data, frameEnded = zstdHandle:DecompressStream(compressed)
+** zstdHandle:Reset()
 ** msec = GetTime()
 ** path[, pathACP[, err]] = GetScriptPath()
 ** path[, pathACP[, err]] = GetRuntimePath()
 ** path[, pathACP[, err]] = GetUserPath() -- may return nil if the user path could not be determined
 ** SetWorkDir("<path>")
 ** path = GetWorkDir()
-** ssID = LaunchSubScript("<scriptText>", "<funcList>", "<subList>"[, ...])
-** AbortSubScript(ssID)
+** ssID = LaunchSubScript("<scriptText>", "<funcList>", "<subList>"[, ...])  Arguments, calls and results may be nil, boolean, number, string or table
+** AbortSubScript(ssID)  Returns straight away, no further callbacks are made for the subscript
 ** isRunning = IsSubScriptRunning(ssID)
+** job = LaunchSubScriptJob("<scriptText>", "<funcList>", "<subList>"[, ...])  As LaunchSubScript, but the outcome is kept on the job instead of passed to OnSubFinished/OnSubError
+** state, progress = job:Status()  "RUNNING", "DONE", "FAILED", "CANCELLED" or "TIMEDOUT"; progress is the last value the subscript passed to ReportProgress(value)
+** ... = job:Results()  Return values once DONE, otherwise nil, err
+** job:Cancel([graceMsec])  Returns straight away; IsCancelRequested() becomes true in the subscript, which is interrupted if still running after graceMsec (default 1000)
+** job:SetTimeout(msec)  Interrupts the subscript if still running msec from now
+** job = ParallelMap("<scriptText>", items[, maxWorkers])  scriptText returns function(item, index); items are split into runs over up to maxWorkers (default processor count) subscripts
+**   job:Results() gives the list of return values in item order; if items fail, the error is always from the lowest failing index
+** ok[, err] = PublishSnapshot("<name>", value)  Stores an immutable copy of value for all states, nil removes it
+** view = GetSnapshot("<name>")  Read-only view, tables can be indexed and measured but not modified; also available to subscripts
+** iterator = SnapshotPairs(view)
+** table = SnapshotToTable(view)  Deep copy as a regular table
+** id = ReadFileAsync("<path>", callback[, "NONE"|"DEFLATE"|"ZSTD"])  callback(id, data) or callback(id, nil, err) during the next frame
+** id = WriteFileAsync("<path>", data[, callback[, append]])  callback(id, true) or callback(id, nil, err); writes still pending at exit or restart are finished first
+** cancelled = CancelFileAsync(id)  The callback won't be called if this returns true
+** status = GetFileAsyncStatus(id)  "QUEUED", "RUNNING", "DONE" or nil if cancelled, delivered or unknown
 ** ... = LoadModule("<modName>"[, ...])
 ** err, ... = PLoadModule("<modName>"[, ...])
 ** err, ... = PCall(func[, ...])
@@ -102,7 +145,7 @@
 ** ConExecute("<cmd>")
 ** SpawnProcess("<cmdName>"[, "<args>"])
 ** err = OpenURL("<url>")
-** SetProfiling(isEnabled)
+** SetProfiling(isEnabled[, "<outputBase>"])  Enabling with outputBase also writes <outputBase>.folded (flame graph) and <outputBase>.json (Chrome trace) when profiling stops; outputBase can't be given while already profiling
 ** Restart()
 ** Exit(["<message>"])
 ** SetForeground()
@@ -290,8 +333,83 @@ static int l_SetMainObject(lua_State* L)
 * of each other in a single image file.
 */
 
+/*
+* Art images are decoded on the renderer's texture workers. Size queries only wait for the
+* image header, while anything that needs the pixels waits for the full decode, running it
+* on the calling thread if no worker has picked it up yet.
+*/
+
+struct artImage_s {
+	std::filesystem::path path;
+	IConsole* con = nullptr;
+	std::once_flag decodeOnce;
+	std::atomic<bool> started = false;
+	std::atomic<bool> ready = false;
+	std::atomic<bool> failed = false;
+	std::mutex sizeMutex;
+	std::condition_variable sizeKnown;
+	bool	headerDone = false;		// Guarded by sizeMutex, along with the size
+	int		width = 0;
+	int		height = 0;
+	std::unique_ptr<image_c> img;	// Only valid once ready, null if decoding failed
+
+	void Decode()
+	{
+		started = true;
+		std::unique_ptr<image_c> loaded(image_c::LoaderForFile(con, path));
+		auto sizeCallback = [this](int w, int h) {
+			std::lock_guard lock(sizeMutex);
+			width = w;
+			height = h;
+			headerDone = true;
+			sizeKnown.notify_all();
+		};
+		bool valid = loaded && !loaded->Load(path, sizeCallback);
+		if (valid) {
+			const auto format = loaded->tex.format();
+			const auto comp = component_count(format);
+			valid = !is_compressed(format) && is_unsigned(format) && (comp == 1 || comp == 3 || comp == 4);
+		}
+		if (!valid) {
+			con->Warning("couldn't decode art '%s'", path.generic_u8string().c_str());
+		}
+		{
+			std::lock_guard lock(sizeMutex);
+			if (valid) {
+				img = std::move(loaded);
+				width = img->tex.extent().x;
+				height = img->tex.extent().y;
+			}
+			failed = !valid;
+			headerDone = true;
+		}
+		ready = true;
+		sizeKnown.notify_all();
+	}
+
+	const image_c* Image()
+	{
+		std::call_once(decodeOnce, [this] { Decode(); });
+		return img.get();
+	}
+
+	// Returns false once decoding has failed, the header size may already have been reported by then
+	bool WaitForSize(int& outWidth, int& outHeight)
+	{
+		if (!started) {
+			// Still queued, decoding here beats waiting behind the rest of the queue
+			Image();
+		}
+		std::unique_lock lock(sizeMutex);
+		sizeKnown.wait(lock, [this] { return headerDone; });
+		outWidth = width;
+		outHeight = height;
+		return !failed;
+	}
+};
+
 struct artHandle_s {
-	std::unique_ptr<image_c> img;
+	std::shared_ptr<artImage_s> art;
 };
 
 SG_LUA_CPP_FUN_BEGIN(NewArtHandle)
@@ -304,24 +422,25 @@ SG_LUA_CPP_FUN_BEGIN(NewArtHandle)
 	std::filesystem::path filePath = std::filesystem::u8path(reader.ArgToString(1));
 	if (filePath.is_relative())
 		filePath = ui->scriptWorkDir / filePath;
-	std::unique_ptr<image_c> img(image_c::LoaderForFile(ui->sys->con, filePath));
-	if (!img)
-		return 0;
-
-	if (img->Load(filePath))
-		return 0;
 
-	const auto format = img->tex.format();
-	if (is_compressed(format) || !is_unsigned(format))
+	// Missing files and unknown formats are cheap to detect, so those still fail here
+	std::unique_ptr<image_c> probe(image_c::LoaderForFile(ui->sys->con, filePath));
+	if (!probe)
 		return 0;
 
-	const auto comp = component_count(format);
-	if (comp != 1 && comp != 3 && comp != 4)
+	auto art = std::make_shared<artImage_s>();
+	art->path = filePath;
+	art->con = ui->sys->con;
+	if (ui->renderer) {
+		ui->renderer->QueueImageJob([art] { art->Image(); });
+	}
+	else if (!art->Image()) {
 		return 0;
+	}
 
 	artHandle_s* artHandle = (artHandle_s*)lua_newuserdata(L, sizeof(artHandle_s));
 	new(artHandle) artHandle_s();
-	artHandle->img = std::move(img);
+	artHandle->art = std::move(art);
 	lua_pushvalue(L, lua_upvalueindex(1));
 	lua_setmetatable(L, -2);
 	return 1;
@@ -349,12 +468,23 @@ static int l_artHandleSize(lua_State* L)
 	ui_main_c* ui = GetUIPtr(L);
 	artHandle_s* artHandle = GetArtHandle(L, ui, "Size");
 
-	const auto extent = artHandle->img ? artHandle->img->tex.extent() : gli::texture2d_array::extent_type{0, 0};
-	lua_pushinteger(L, extent.x);
-	lua_pushinteger(L, extent.y);
+	int width, height;
+	if (!artHandle->art->WaitForSize(width, height)) {
+		return 0;
+	}
+	lua_pushinteger(L, width);
+	lua_pushinteger(L, height);
 	return 2;
 }
 
+static int l_artHandleIsLoading(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	artHandle_s* artHandle = GetArtHandle(L, ui, "IsLoading");
+	lua_pushboolean(L, !artHandle->art->ready);
+	return 1;
+}
+
 // =============
 // Image Handles
 // =============
@@ -505,16 +635,22 @@ namespace {
 		}
 		return flags;
 	}
+}
 
-	r_shaderHnd_c* RegisterShaderFromImage(r_IRenderer& renderer, std::unique_ptr<image_c> img, int flags)
-	{
-		return renderer.RegisterShaderFromImage(std::move(img), flags);
-	}
+static std::unique_ptr<image_c> SliceArtRectangle(const image_c& srcImg, int x1, int y1, int x2, int y2)
+{
+	// Slice rectangle into temporary target image.
+	const auto srcFormat = srcImg.tex.format();
+	auto dstImg = std::make_unique<image_c>(srcImg.con);
+	dstImg->tex = gli::texture2d_array(srcFormat, glm::ivec2(x2 - x1, y2 - y1), 1, 1);
+	ArtSliceRectangle(srcImg.tex.data<byte>(0, 0, 0), srcImg.tex.extent().x, (int)component_count(srcFormat), x1, y1, x2, y2, dstImg->tex.data<byte>(0, 0, 0));
+	return dstImg;
 }
 
 SG_LUA_CPP_FUN_BEGIN(imgHandleLoadArtRectangle)
 {
 	ui_main_c* ui = GetUIPtr(L);
+	ui->LExpect(L, ui->renderer != NULL, "Renderer is not initialised");
 	imgHandle_s* imgHandle = GetImgHandle(L, ui, "LoadArtRectangle", false);
 
 	const int n = lua_gettop(L);
@@ -538,46 +674,41 @@ SG_LUA_CPP_FUN_BEGIN(imgHandleLoadArtRectangle)
 	if (y1 > y2)
 		std::swap(y1, y2);
 
-	auto* srcImg = artHandle->img.get();
-	const auto srcFormat = srcImg->tex.format();
-	auto extent = srcImg->tex.extent();
-	const int srcWidth = extent.x;
-	const int srcHeight = extent.y;
-	const int comp = (int)component_count(srcFormat);
+	// Only the bounds check has to wait on the art, and only for its size
+	int srcWidth, srcHeight;
+	const bool valid = artHandle->art->WaitForSize(srcWidth, srcHeight);
+	ui->LExpect(L, valid, "imgHandle:LoadArtRectangle(): art failed to decode");
 	ui->LExpect(L, x1 >= 0 && x2 <= srcWidth, "imgHandle:LoadArtRectangle(): X range %d to %d outside of the 0 to %d bounds", x1, x2, srcWidth);
 	ui->LExpect(L, y1 >= 0 && y2 <= srcHeight, "imgHandle:LoadArtRectangle(): Y range %d to %d outside of the 0 to %d bounds", y1, y2, srcHeight);
 
-	// Slice rectangle into temporary target image.
-	auto dstImg = std::make_unique<image_c>(ui->sys->con);
-	const int dstWidth = x2 - x1;
-	const int dstHeight = y2 - y1;
-
-	const int srcStride = srcWidth * comp;
-	const int dstStride = dstWidth * comp;
-	const int dstByteCount = dstHeight * dstStride;
-	dstImg->tex = gli::texture2d_array(srcFormat, glm::ivec2(dstWidth, dstHeight), 1, 1);
-
-	byte* srcPtr = srcImg->tex.data<byte>(0, 0, 0) + y1 * srcStride + x1 * comp;
-	byte* dstPtr = dstImg->tex.data<byte>(0, 0, 0);
-	for (int col = 0; col < (int)dstWidth; ++col) {
-		for (int row = 0; row < (int)dstHeight; ++row) {
-			memcpy(dstPtr, srcPtr, dstStride);
-			srcPtr += srcStride;
-			dstPtr += dstStride;
-		}
-	}
-
 	const int flags = ParseArtFlags(ui, L, 5, n);
 	delete imgHandle->hnd;
-	imgHandle->hnd = RegisterShaderFromImage(*ui->renderer, std::move(dstImg), flags);
+	imgHandle->hnd = ui->renderer->RegisterShaderFromImageAsync([art = artHandle->art, x1, y1, x2, y2]() -> std::unique_ptr<image_c> {
+		// Checked again against the decoded image, which may fail after the header was accepted
+		const image_c* srcImg = art->Image();
+		if (!srcImg || x2 > (int)srcImg->tex.extent().x || y2 > (int)srcImg->tex.extent().y)
+			return nullptr;
+		return SliceArtRectangle(*srcImg, x1, y1, x2, y2);
+	}, x2 - x1, y2 - y1, flags);
 
 	return 0;
 }
 SG_LUA_CPP_FUN_END()
 
+static std::unique_ptr<image_c> SliceArtArcBand(const image_c& srcImg, int xC, int yC, int rMin, int rMax)
+{
+	// Slice the band's bounding square into temporary target image.
+	const auto srcFormat = srcImg.tex.format();
+	auto dstImg = std::make_unique<image_c>(srcImg.con);
+	dstImg->tex = gli::texture2d_array(srcFormat, glm::ivec2(rMax, rMax), 1, 1);
+	ArtSliceArcBand(srcImg.tex.data<byte>(0, 0, 0), srcImg.tex.extent().x, (int)component_count(srcFormat), xC, yC, rMin, rMax, dstImg->tex.data<byte>(0, 0, 0));
+	return dstImg;
+}
+
 SG_LUA_CPP_FUN_BEGIN(imgHandleLoadArtArcBand)
 {
 	ui_main_c* ui = GetUIPtr(L);
+	ui->LExpect(L, ui->renderer != NULL, "Renderer is not initialised");
 	imgHandle_s* imgHandle = GetImgHandle(L, ui, "LoadArtArcBand", false);
 
 	const int n = lua_gettop(L);
@@ -602,98 +733,132 @@ SG_LUA_CPP_FUN_BEGIN(imgHandleLoadArtArcBand)
 	// Grab the art handle after extracting the parameters so that their error messages have the correct indices.
 	artHandle_s* artHandle = GetArtHandle(L, ui, "LoadArtArcBand");
 
-	auto* srcImg = artHandle->img.get();
-	const auto srcFormat = srcImg->tex.format();
-	const auto srcExtent = srcImg->tex.extent();
-	const int srcWidth = srcExtent.x;
-	const int srcHeight = srcExtent.y;
-	const int comp = (int)component_count(srcFormat);
+	// Only the bounds check has to wait on the art, and only for its size
+	int srcWidth, srcHeight;
+	const bool valid = artHandle->art->WaitForSize(srcWidth, srcHeight);
+	ui->LExpect(L, valid, "imgHandle:LoadArtArcBand(): art failed to decode");
 	ui->LExpect(L, xC >= 0 && xC <= srcWidth, "imgHandle:LoadArtArcBand(): X origin %d outside of the 0 to %d bounds", xC, srcWidth);
 	ui->LExpect(L, yC >= 0 && yC <= srcHeight, "imgHandle:LoadArtArcBand(): Y origin %d outside of the 0 to %d bounds", yC, srcHeight);
 
 	ui->LExpect(L, x1 >= 0 && x1 <= srcWidth, "imgHandle:LoadArtArcBand(): X corner %d outside of the 0 to %d bounds", x1, srcWidth);
 	ui->LExpect(L, y1 >= 0 && y1 <= srcHeight, "imgHandle:LoadArtArcBand(): Y corner %d outside of the 0 to %d bounds", y1, srcHeight);
 
+	const int flags = ParseArtFlags(ui, L, 5, n);
+	delete imgHandle->hnd;
+	imgHandle->hnd = ui->renderer->RegisterShaderFromImageAsync([art = artHandle->art, xC, yC, rMin, rMax]() -> std::unique_ptr<image_c> {
+		// Checked again against the decoded image, which may fail after the header was accepted
+		const image_c* srcImg = art->Image();
+		if (!srcImg || xC > (int)srcImg->tex.extent().x || yC > (int)srcImg->tex.extent().y)
+			return nullptr;
+		return SliceArtArcBand(*srcImg, xC, yC, rMin, rMax);
+	}, rMax, rMax, flags);
 
-	// Slice rectangle into temporary target image.
-	auto dstImg = std::make_unique<image_c>(ui->sys->con);
-	const int dstWidth = xC - x1;
-	const int dstHeight = yC - y1;
+	return 0;
+}
+SG_LUA_CPP_FUN_END()
 
-	const int srcStride = srcWidth * comp;
-	const int dstStride = dstWidth * comp;
-	const int dstByteCount = dstHeight * dstStride;
-	dstImg->tex = gli::texture2d_array(srcFormat, glm::ivec2(dstWidth, dstHeight), 1, 1);
+// =============
+// Display Lists
+// =============
 
-	const byte* srcData = srcImg->tex.data<byte>(0, 0, 0);
-	byte* dstData = dstImg->tex.data<byte>(0, 0, 0);
-	memset(dstData, 0x00, dstByteCount);
+/*
+* Display lists record the draw calls made between Begin and End and replay them
+* with a single call, optionally moved and scaled. Textures used by the recorded
+* draws are kept alive by the list until it is cleared or collected.
+*/
 
-	// Copy all pixels whose center are between the two radii, inclusive.
-	{
-		// By doubling all coordinates, we can reference both pixel edges and pixel centers.
-		// Even numbers are between pixel samples, odd numbers are on pixel samples.
-		// This makes the distance test math more robust.
-		// As this is ad-hoc 31.1 bit fixed point math, we should technically shift down the result of
-		// the multiplications that go into the squares but as the same number of operations occur on both
-		// sides of the squared equalities, it's fine. Just something to keep in mind for future changes.
-		const int rMinSq = (rMin * 2) * (rMin * 2), rMaxSq = (rMax * 2) * (rMax * 2);
-		const int width = dstWidth * 2, height = dstHeight * 2;
-		for (int row = 1; row < height; row += 2)
-		{
-			const int dy = height - row;
-			// Find the first pixel center that is inside the outer radius
-			int colLo = -1;
-			for (int x = 1; x < width; x += 2) {
-				const int dx = width - x;
-				const int rSq = dx * dx + dy * dy;
-				if (rSq <= rMaxSq) {
-					colLo = x;
-					break;
-				}
-			}
-			
-			// If no pixel was found to be inside, the row does not contribute.
-			if (colLo == -1)
-				continue;
+struct dlHandle_s {
+	r_IRenderer* renderer;		// Owns the list, and outlives the Lua state
+	r_displayList_c* list;
+};
 
-			int colHi = width;
-			// Find the first pixel center that is inside the inner radius
-			for (int x = colLo; x < width; x += 2) {
-				const int dx = width - x;
-				const int rSq = dx * dx + dy * dy;
-				if (rSq < rMinSq) {
-					colHi = x;
-					break;
-				}
-			}
+static int l_NewDisplayList(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	ui->LAssert(L, ui->renderer != NULL, "Renderer is not initialised");
+	dlHandle_s* dlHandle = (dlHandle_s*)lua_newuserdata(L, sizeof(dlHandle_s));
+	dlHandle->renderer = ui->renderer;
+	dlHandle->list = ui->renderer->NewDisplayList();
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_setmetatable(L, -2);
+	return 1;
+}
 
-			// We now have a half-open span of touched pixel centers (or the far border).
-			// Convert that to regular pixel coordinates and copy to the destination image.
-			const int xLo = colLo / 2;
-			const int xHi = colHi / 2;
-
-			if (xLo != xHi) {
-				const int y = row / 2;
-				const int spanByteSize = (xHi - xLo) * comp;
-				const int srcRow = y1 + y;
-				const int dstRow = y;
-				const int srcCol = x1 + xLo;
-				const int dstCol = xLo;
-				const byte* srcPtr = srcData + srcRow * srcStride + srcCol * comp;
-				byte* dstPtr = dstData + dstRow * dstStride + dstCol * comp;
-				memcpy(dstPtr, srcPtr, spanByteSize);
-			}
-		}
-	}
+static dlHandle_s* GetDisplayListHandle(lua_State* L, ui_main_c* ui, const char* method)
+{
+	ui->LAssert(L, ui->IsUserData(L, 1, "uidisplaylistmeta"), "dlHandle:%s() must be used on a display list handle", method);
+	dlHandle_s* dlHandle = (dlHandle_s*)lua_touserdata(L, 1);
+	lua_remove(L, 1);
+	return dlHandle;
+}
 
-	const int flags = ParseArtFlags(ui, L, 5, n);
-	delete imgHandle->hnd;
-	imgHandle->hnd = RegisterShaderFromImage(*ui->renderer, std::move(dstImg), flags);
+static int l_dlHandleGC(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	dlHandle_s* dlHandle = GetDisplayListHandle(L, ui, "__gc");
+	dlHandle->renderer->FreeDisplayList(dlHandle->list);
+	return 0;
+}
 
+static int l_dlHandleBegin(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	dlHandle_s* dlHandle = GetDisplayListHandle(L, ui, "Begin");
+	ui->LAssert(L, ui->renderEnable, "dlHandle:Begin() called outside of OnFrame");
+	ui->LAssert(L, ui->renderer->RecordingDisplayList() == NULL, "dlHandle:Begin(): a display list is already being recorded");
+	ui->renderer->BeginDisplayList(dlHandle->list);
 	return 0;
 }
-SG_LUA_CPP_FUN_END()
+
+static int l_dlHandleEnd(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	dlHandle_s* dlHandle = GetDisplayListHandle(L, ui, "End");
+	ui->LAssert(L, ui->renderer->RecordingDisplayList() == dlHandle->list, "dlHandle:End(): display list is not being recorded");
+	ui->renderer->EndDisplayList();
+	return 0;
+}
+
+static int l_dlHandleDraw(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	dlHandle_s* dlHandle = GetDisplayListHandle(L, ui, "Draw");
+	ui->LAssert(L, ui->renderEnable, "dlHandle:Draw() called outside of OnFrame");
+	ui->LAssert(L, ui->renderer->RecordingDisplayList() != dlHandle->list, "dlHandle:Draw(): display list can't be drawn while it is being recorded");
+	int n = lua_gettop(L);
+	ui->LAssert(L, n == 0 || n >= 2, "Usage: dlHandle:Draw([x, y[, scale]])");
+	glm::vec2 offset{};
+	float scale = 1.0f;
+	if (n >= 2) {
+		ui->LAssert(L, lua_isnumber(L, 1), "dlHandle:Draw() argument 1: expected number, got %s", luaL_typename(L, 1));
+		ui->LAssert(L, lua_isnumber(L, 2), "dlHandle:Draw() argument 2: expected number, got %s", luaL_typename(L, 2));
+		const float dpiScale = ui->renderer->VirtualScreenScaleFactor();
+		offset = { (float)lua_tonumber(L, 1) * dpiScale, (float)lua_tonumber(L, 2) * dpiScale };
+	}
+	if (n >= 3) {
+		ui->LAssert(L, lua_isnumber(L, 3), "dlHandle:Draw() argument 3: expected number, got %s", luaL_typename(L, 3));
+		scale = (float)lua_tonumber(L, 3);
+	}
+	ui->renderer->DrawDisplayList(dlHandle->list, offset, scale);
+	return 0;
+}
+
+static int l_dlHandleClear(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	dlHandle_s* dlHandle = GetDisplayListHandle(L, ui, "Clear");
+	ui->LAssert(L, ui->renderer->RecordingDisplayList() != dlHandle->list, "dlHandle:Clear(): display list can't be cleared while it is being recorded");
+	ui->renderer->ClearDisplayList(dlHandle->list);
+	return 0;
+}
+
+static int l_dlHandleIsEmpty(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	dlHandle_s* dlHandle = GetDisplayListHandle(L, ui, "IsEmpty");
+	lua_pushboolean(L, ui->renderer->IsDisplayListEmpty(dlHandle->list));
+	return 1;
+}
 
 // =========
 // Rendering
@@ -761,6 +926,7 @@ static int l_SetDrawLayer(lua_State* L)
 	ui_main_c* ui = GetUIPtr(L);
 	ui->LAssert(L, ui->renderer != NULL, "Renderer is not initialised");
 	ui->LAssert(L, ui->renderEnable, "SetDrawLayer() called outside of OnFrame");
+	ui->LAssert(L, ui->renderer->RecordingDisplayList() == NULL, "SetDrawLayer() called while recording a display list");
 	int n = lua_gettop(L);
 	ui->LAssert(L, n >= 1, "Usage: SetDrawLayer({layer|nil}[, subLayer])");
 	ui->LAssert(L, lua_isnumber(L, 1) || lua_isnil(L, 1), "SetDrawLayer() argument 1: expected number or nil, got %s", luaL_typename(L, 1));
@@ -1076,6 +1242,128 @@ static int l_DrawImageQuad(lua_State* L)
 	return 0;
 }
 
+// Number of elements in an FFI float array, or -1 for any other cdata
+// Pointers are refused, as only arrays keep their elements in the cdata's own storage
+static lua_Number FloatArrayLength(lua_State* L, int index)
+{
+	int top = lua_gettop(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+	lua_getfield(L, -1, "ffi");
+	if ( !lua_istable(L, -1) ) {
+		lua_settop(L, top);
+		return -1;
+	}
+	int ffi = lua_gettop(L);
+	lua_getfield(L, ffi, "typeof");
+	lua_pushvalue(L, index);
+	lua_call(L, 1, 1);
+	bool isFloatArray = luaL_callmeta(L, -1, "__tostring") && lua_isstring(L, -1) && strncmp(lua_tostring(L, -1), "ctype<float [", 13) == 0;
+	lua_Number length = -1;
+	if (isFloatArray) {
+		lua_getfield(L, ffi, "sizeof");
+		lua_pushvalue(L, index);
+		lua_call(L, 1, 1);
+		if (lua_isnumber(L, -1)) {
+			length = std::floor(lua_tonumber(L, -1) / sizeof(float));
+		}
+	}
+	lua_settop(L, top);
+	return length;
+}
+
+static int l_DrawImageBatch(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	ui->LAssert(L, ui->renderer != NULL, "Renderer is not initialised");
+	ui->LAssert(L, ui->renderEnable, "DrawImageBatch() called outside of OnFrame");
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 3, "Usage: DrawImageBatch({imgHandle|nil}, layout, data[, count[, stackIdx[, maskIdx]]])");
+	ui->LAssert(L, lua_isnil(L, 1) || ui->IsUserData(L, 1, "uiimghandlemeta"), "DrawImageBatch() argument 1: expected image handle or nil, got %s", luaL_typename(L, 1));
+	ui->LAssert(L, lua_isstring(L, 2), "DrawImageBatch() argument 2: expected string, got %s", luaL_typename(L, 2));
+
+	// LuaJIT's type tag for FFI cdata, which lua.h doesn't expose
+	const int luaTypeCData = 10;
+	const bool isCData = lua_type(L, 3) == luaTypeCData;
+	ui->LAssert(L, lua_istable(L, 3) || isCData, "DrawImageBatch() argument 3: expected table or cdata, got %s", luaL_typename(L, 3));
+	ui->LAssert(L, lua_isnoneornil(L, 4) || lua_isnumber(L, 4), "DrawImageBatch() argument 4: expected number or nil, got %s", luaL_typename(L, 4));
+
+	static const char* layoutMap[3] = { "RECT", "QUAD", NULL };
+	const int layout = luaL_checkoption(L, 2, NULL, layoutMap);
+	const size_t stride = layout == IB_RECT ? 8 : 16;
+
+	r_shaderHnd_c* hnd = NULL;
+	if (!lua_isnil(L, 1)) {
+		imgHandle_s* imgHandle = (imgHandle_s*)lua_touserdata(L, 1);
+		ui->LAssert(L, imgHandle->hnd != NULL, "DrawImageBatch(): image handle has no image loaded");
+		hnd = imgHandle->hnd;
+	}
+
+	std::optional<int> maxStackValue;
+	if (hnd)
+		maxStackValue = hnd->StackCount();
+	int stackLayer = 0;
+	std::optional<int> maskLayer{};
+	if (n >= 5) {
+		ui->LAssert(L, lua_isinteger(L, 5), "DrawImageBatch() argument 5: expected integer, got %s", luaL_typename(L, 5));
+		const int val = (int)lua_tointeger(L, 5);
+		ui->LAssert(L, val > 0, "DrawImageBatch() argument 5: expected positive integer, got %d", val);
+		if (maxStackValue.has_value())
+			ui->LAssert(L, val <= *maxStackValue, "DrawImageBatch() argument 5: expected valid stack index <= %d, got %d", *maxStackValue, val);
+		stackLayer = val - 1;
+	}
+	if (n >= 6) {
+		ui->LAssert(L, lua_isnil(L, 6) || lua_isinteger(L, 6), "DrawImageBatch() argument 6: expected integer or nil, got %s", luaL_typename(L, 6));
+		if (lua_isinteger(L, 6)) {
+			const int val = (int)lua_tointeger(L, 6);
+			ui->LAssert(L, val > 0, "DrawImageBatch() argument 6: expected positive integer, got %d", val);
+			if (maxStackValue.has_value())
+				ui->LAssert(L, val <= *maxStackValue, "DrawImageBatch() argument 6: expected valid stack index <= %d, got %d", *maxStackValue, val);
+			maskLayer = val - 1;
+		}
+	}
+
+	const float* data = nullptr;
+	size_t count = 0;
+	if (isCData) {
+		// FFI float arrays are recorded straight from their own storage
+		const lua_Number len = FloatArrayLength(L, 3);
+		ui->LAssert(L, len >= 0, "DrawImageBatch() argument 3: expected float array cdata");
+		count = (size_t)(len / stride);
+		if (!lua_isnoneornil(L, 4)) {
+			const lua_Number countVal = lua_tonumber(L, 4);
+			ui->LAssert(L, countVal >= 0 && countVal * stride <= len, "DrawImageBatch() argument 4: count %f exceeds the %d numbers in the array", countVal, (int)len);
+			count = (size_t)countVal;
+		}
+		ui->LAssert(L, count <= IB_MAX_COUNT, "DrawImageBatch(): %d images exceeds the maximum of %d per batch", (int)count, IB_MAX_COUNT);
+		data = (const float*)lua_topointer(L, 3);
+		ui->LAssert(L, data != NULL || count == 0, "DrawImageBatch() argument 3: cdata has no storage");
+	}
+	else {
+		const size_t len = lua_objlen(L, 3);
+		count = len / stride;
+		if (!lua_isnoneornil(L, 4)) {
+			const lua_Number countVal = lua_tonumber(L, 4);
+			ui->LAssert(L, countVal >= 0 && (size_t)countVal * stride <= len, "DrawImageBatch() argument 4: count %f exceeds the %d numbers in the table", countVal, (int)len);
+			count = (size_t)countVal;
+		}
+		ui->LAssert(L, count <= IB_MAX_COUNT, "DrawImageBatch(): %d images exceeds the maximum of %d per batch", (int)count, IB_MAX_COUNT);
+		auto& buffer = ui->drawBatchBuffer;
+		buffer.resize(count * stride);
+		for (size_t i = 0; i < count * stride; i++) {
+			lua_rawgeti(L, 3, (int)i + 1);
+			ui->LAssert(L, lua_isnumber(L, -1), "DrawImageBatch() argument 3: element %d: expected number, got %s", (int)i + 1, luaL_typename(L, -1));
+			buffer[i] = (float)lua_tonumber(L, -1);
+			lua_pop(L, 1);
+		}
+		data = buffer.data();
+	}
+
+	if (count > 0) {
+		ui->renderer->DrawImageBatch(hnd, layout, data, count, ui->renderer->VirtualScreenScaleFactor(), stackLayer, maskLayer);
+	}
+	return 0;
+}
+
 static int l_DrawString(lua_State* L)
 {
 	ui_main_c* ui = GetUIPtr(L);
@@ -1123,6 +1411,100 @@ static int l_DrawString(lua_State* L)
 	return 0;
 }
 
+// Find a string in a NULL-terminated option list, returns -1 if it isn't present
+static int FindOption(const char* name, const char* const list[])
+{
+	for (int i = 0; list[i]; i++) {
+		if (strcmp(name, list[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int l_DrawStringBatch(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	ui->LAssert(L, ui->renderer != NULL, "Renderer is not initialised");
+	ui->LAssert(L, ui->renderEnable, "DrawStringBatch() called outside of OnFrame");
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: DrawStringBatch({ {left, top, align, height, font, text}, ... })");
+	ui->LAssert(L, lua_istable(L, 1), "DrawStringBatch() argument 1: expected table, got %s", luaL_typename(L, 1));
+	static const char* alignMap[6] = { "LEFT", "CENTER", "RIGHT", "CENTER_X", "RIGHT_X", NULL };
+	static const char* fontMap[8] = { "FIXED", "VAR", "VAR BOLD", "FONTIN SC", "FONTIN SC ITALIC", "FONTIN", "FONTIN ITALIC", NULL };
+	const float dpiScale = ui->renderer->VirtualScreenScaleFactor();
+
+	// Lua strings are interned, so a run of records sharing the same align/font string or height
+	// can be recognised by identity and only resolved once
+	const char* lastAlignStr = nullptr;
+	const char* lastFontStr = nullptr;
+	lua_Number lastLogicalHeight = -1;
+	int align = 0;
+	int font = 0;
+	int scaledHeight = 1;
+
+	int count = (int)lua_objlen(L, 1);
+	for (int r = 1; r <= count; r++) {
+		lua_rawgeti(L, 1, r);
+		ui->LAssert(L, lua_istable(L, -1), "DrawStringBatch() record %d: expected table, got %s", r, luaL_typename(L, -1));
+		for (int f = 1; f <= 6; f++) {
+			lua_rawgeti(L, -f, f);
+		}
+		// Stack: record, left, top, align, height, font, text
+		ui->LAssert(L, lua_isnumber(L, -6), "DrawStringBatch() record %d field 1: expected number, got %s", r, luaL_typename(L, -6));
+		ui->LAssert(L, lua_isnumber(L, -5), "DrawStringBatch() record %d field 2: expected number, got %s", r, luaL_typename(L, -5));
+		ui->LAssert(L, lua_type(L, -4) == LUA_TSTRING || lua_isnil(L, -4), "DrawStringBatch() record %d field 3: expected string or nil, got %s", r, luaL_typename(L, -4));
+		ui->LAssert(L, lua_isnumber(L, -3), "DrawStringBatch() record %d field 4: expected number, got %s", r, luaL_typename(L, -3));
+		ui->LAssert(L, lua_type(L, -2) == LUA_TSTRING, "DrawStringBatch() record %d field 5: expected string, got %s", r, luaL_typename(L, -2));
+		ui->LAssert(L, lua_isstring(L, -1), "DrawStringBatch() record %d field 6: expected string, got %s", r, luaL_typename(L, -1));
+
+		const char* alignStr = lua_isnil(L, -4) ? alignMap[0] : lua_tostring(L, -4);
+		if (alignStr != lastAlignStr) {
+			align = FindOption(alignStr, alignMap);
+			ui->LAssert(L, align >= 0, "DrawStringBatch() record %d field 3: invalid option '%s'", r, alignStr);
+			lastAlignStr = alignStr;
+		}
+		const char* fontStr = lua_tostring(L, -2);
+		if (fontStr != lastFontStr) {
+			font = FindOption(fontStr, fontMap);
+			ui->LAssert(L, font >= 0, "DrawStringBatch() record %d field 5: invalid option '%s'", r, fontStr);
+			lastFontStr = fontStr;
+		}
+		const lua_Number logicalHeight = lua_tonumber(L, -3);
+		if (logicalHeight != lastLogicalHeight) {
+			scaledHeight = (int)std::lround(logicalHeight * dpiScale);
+			if (scaledHeight <= 1) {
+				scaledHeight = 1;
+			}
+			else {
+				scaledHeight = (scaledHeight + 1) & ~1;
+			}
+			lastLogicalHeight = logicalHeight;
+		}
+
+		ui->renderer->DrawString(
+			(float)lua_tonumber(L, -6) * dpiScale,
+			(float)lua_tonumber(L, -5) * dpiScale,
+			align,
+			scaledHeight,
+			NULL,
+			font,
+			lua_tostring(L, -1)
+		);
+		lua_pop(L, 7);
+	}
+
+	// Get the final color from the renderer after the strings have processed their color codes
+	col4_t finalColor;
+	ui->renderer->GetDrawColor(finalColor);
+	ui->lastColor[0] = finalColor[0];
+	ui->lastColor[1] = finalColor[1];
+	ui->lastColor[2] = finalColor[2];
+	ui->lastColor[3] = finalColor[3];
+
+	return 0;
+}
+
 static int l_DrawStringWidth(lua_State* L)
 {
 	ui_main_c* ui = GetUIPtr(L);
@@ -1203,27 +1585,75 @@ static int l_GetDPIScaleOverridePercent(lua_State* L)
 	return 1;
 }
 
+// Find the next color escape, memchr is vectorised by the C runtime so runs of plain text are skipped quickly
+static const char* FindColorEscape(const char* str, const char* end, int& escLen)
+{
+	while (str < end) {
+		str = (const char*)memchr(str, '^', end - str);
+		if (!str) {
+			break;
+		}
+		escLen = IsColorEscape(str);
+		if (escLen) {
+			return str;
+		}
+		str++;
+	}
+	escLen = 0;
+	return end;
+}
+
 static int l_StripEscapes(lua_State* L)
 {
 	ui_main_c* ui = GetUIPtr(L);
 	int n = lua_gettop(L);
 	ui->LAssert(L, n >= 1, "Usage: StripEscapes(string)");
 	ui->LAssert(L, lua_isstring(L, 1), "StripEscapes() argument 1: expected string, got %s", luaL_typename(L, 1));
-	const char* str = lua_tostring(L, 1);
-	char* strip = new char[strlen(str) + 1];
-	char* p = strip;
-	while (*str) {
-		int esclen = IsColorEscape(str);
-		if (esclen) {
-			str += esclen;
-		}
-		else {
-			*(p++) = *(str++);
+	const bool isString = lua_type(L, 1) == LUA_TSTRING;
+	size_t len = 0;
+	const char* str = lua_tolstring(L, 1, &len);
+	const char* end = str + len;
+	int escLen = 0;
+	const char* esc = FindColorEscape(str, end, escLen);
+	if (esc == end) {
+		// Nothing to strip, hand back the original string; numbers still come back as strings
+		if ( !isString ) {
+			lua_pushlstring(L, str, len);
+			return 1;
 		}
+		lua_settop(L, 1);
+		return 1;
+	}
+
+	// Copy the text between escapes into a stack buffer, Lua only allocates the final string
+	luaL_Buffer buf;
+	luaL_buffinit(L, &buf);
+	while (str < end) {
+		luaL_addlstring(&buf, str, esc - str);
+		str = esc + escLen;
+		esc = FindColorEscape(str, end, escLen);
 	}
-	*p = 0;
-	lua_pushstring(L, strip);
-	delete[] strip;
+	luaL_pushresult(&buf);
+	return 1;
+}
+
+static int l_StripEscapesLength(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: StripEscapesLength(string)");
+	ui->LAssert(L, lua_isstring(L, 1), "StripEscapesLength() argument 1: expected string, got %s", luaL_typename(L, 1));
+	size_t len = 0;
+	const char* str = lua_tolstring(L, 1, &len);
+	const char* end = str + len;
+	size_t stripLen = 0;
+	while (str < end) {
+		int escLen = 0;
+		const char* esc = FindColorEscape(str, end, escLen);
+		stripLen += esc - str;
+		str = esc + escLen;
+	}
+	lua_pushinteger(L, (lua_Integer)stripLen);
 	return 1;
 }
 
@@ -1642,52 +2072,552 @@ static int l_Inflate(lua_State* L)
 	}
 }
 
-static int l_GetTime(lua_State* L)
-{
-	ui_main_c* ui = GetUIPtr(L);
-	lua_pushinteger(L, ui->sys->GetTime());
-	return 1;
-}
-
-static int l_GetScriptPath(lua_State* L)
+static int l_DeflateParallel(lua_State* L)
 {
 	ui_main_c* ui = GetUIPtr(L);
-	lua_pushstring(L, ui->scriptPath.generic_u8string().c_str());
-	try
-	{
-		lua_pushstring(L, ui->scriptPath.generic_string().c_str());
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: DeflateParallel(string[, level[, threads]])");
+	ui->LAssert(L, lua_isstring(L, 1), "DeflateParallel() argument 1: expected string, got %s", luaL_typename(L, 1));
+	int level = 9;
+	if (n >= 2 && !lua_isnil(L, 2)) {
+		ui->LAssert(L, lua_isnumber(L, 2), "DeflateParallel() argument 2: expected number or nil, got %s", luaL_typename(L, 2));
+		level = (int)lua_tointeger(L, 2);
+		ui->LAssert(L, level >= 0 && level <= 9, "DeflateParallel() argument 2: level must be between 0 and 9, got %d", level);
+	}
+	int threads = 0;
+	if (n >= 3 && !lua_isnil(L, 3)) {
+		ui->LAssert(L, lua_isnumber(L, 3), "DeflateParallel() argument 3: expected number or nil, got %s", luaL_typename(L, 3));
+		threads = (int)lua_tointeger(L, 3);
+		ui->LAssert(L, threads >= 0, "DeflateParallel() argument 3: thread count must not be negative, got %d", threads);
+	}
+	size_t inLen;
+	const char* in = lua_tolstring(L, 1, &inLen);
+	// Same limit as Deflate, so that the output stays within what Inflate accepts
+	size_t const maxInLen = 128ull << 20;
+	if (inLen > maxInLen) {
+		lua_pushnil(L);
+		lua_pushstring(L, "Input larger than 128 MiB");
 		return 2;
 	}
-	catch (std::exception& e)
-	{
+	auto out = CompressDeflateParallel(gsl::as_bytes(gsl::make_span(in, inLen)), level, (size_t)threads);
+	if (!out) {
 		lua_pushnil(L);
-		lua_pushstring(L, e.what());
-		return 3;
+		lua_pushstring(L, "Compression failed");
+		return 2;
 	}
+	lua_pushlstring(L, out->data(), out->size());
+	return 1;
 }
 
-static int l_GetRuntimePath(lua_State* L)
+// ==================
+// Compression Streams
+// ==================
+
+/*
+* Streams compress or decompress data incrementally, taking input chunks and
+* returning the output produced so far. Input is read straight from the Lua
+* string and output is staged in a buffer owned by the stream, so memory use
+* is bounded by the chunk sizes instead of the size of the whole payload.
+*/
+
+struct zStreamHandle_s {
+	z_stream z{};
+	bool	deflating = false;
+	bool	finished = false;
+	bool	more = false;			// Output limit was hit, inflating only
+	std::vector<byte> out;
+	std::vector<byte> pendingIn;	// Input not consumed when the output limit was hit
+};
+
+// Most output one inflateHandle:Write() call returns, so a small chunk can't expand without bound
+static const size_t ZSTREAM_MAX_OUT = 16 << 20;
+
+static int l_NewDeflateStream(lua_State* L)
 {
 	ui_main_c* ui = GetUIPtr(L);
-	lua_pushstring(L, ui->sys->basePath.generic_u8string().c_str());
-	try
-	{
-		lua_pushstring(L, ui->sys->basePath.generic_string().c_str());
-		return 2;
-	}
-	catch (std::exception& e)
-	{
+	int n = lua_gettop(L);
+	int level = 9;
+	int windowBits = 15;
+	if (n >= 1 && !lua_isnil(L, 1)) {
+		ui->LAssert(L, lua_isnumber(L, 1), "NewDeflateStream() argument 1: expected number or nil, got %s", luaL_typename(L, 1));
+		level = (int)lua_tointeger(L, 1);
+		ui->LAssert(L, level >= 0 && level <= 9, "NewDeflateStream() argument 1: level must be between 0 and 9, got %d", level);
+	}
+	if (n >= 2 && !lua_isnil(L, 2)) {
+		ui->LAssert(L, lua_isnumber(L, 2), "NewDeflateStream() argument 2: expected number or nil, got %s", luaL_typename(L, 2));
+		windowBits = (int)lua_tointeger(L, 2);
+		const int bits = windowBits < 0 ? -windowBits : (windowBits > 15 ? windowBits - 16 : windowBits);
+		ui->LAssert(L, bits >= 9 && bits <= 15, "NewDeflateStream() argument 2: window bits must be 9 to 15 (negative for raw, +16 for gzip), got %d", windowBits);
+	}
+
+	zStreamHandle_s* zHandle = (zStreamHandle_s*)lua_newuserdata(L, sizeof(zStreamHandle_s));
+	new(zHandle) zStreamHandle_s();
+	zHandle->deflating = true;
+	int err = deflateInit2(&zHandle->z, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+	if (err != Z_OK) {
+		zHandle->~zStreamHandle_s();
 		lua_pushnil(L);
-		lua_pushstring(L, e.what());
-		return 3;
+		lua_pushstring(L, zError(err));
+		return 2;
 	}
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_setmetatable(L, -2);
+	return 1;
 }
 
-static int l_GetUserPath(lua_State* L)
+static int l_NewInflateStream(lua_State* L)
 {
 	ui_main_c* ui = GetUIPtr(L);
-	auto& userPath = ui->sys->userPath;
-	if (!userPath) {
+	int n = lua_gettop(L);
+	int windowBits = 15;
+	if (n >= 1 && !lua_isnil(L, 1)) {
+		ui->LAssert(L, lua_isnumber(L, 1), "NewInflateStream() argument 1: expected number or nil, got %s", luaL_typename(L, 1));
+		windowBits = (int)lua_tointeger(L, 1);
+		const int bits = windowBits < 0 ? -windowBits : windowBits & 15;
+		ui->LAssert(L, bits >= 8 && bits <= 15 && windowBits < 48, "NewInflateStream() argument 1: window bits must be 8 to 15 (negative for raw, +16 for gzip, +32 to detect), got %d", windowBits);
+	}
+
+	zStreamHandle_s* zHandle = (zStreamHandle_s*)lua_newuserdata(L, sizeof(zStreamHandle_s));
+	new(zHandle) zStreamHandle_s();
+	int err = inflateInit2(&zHandle->z, windowBits);
+	if (err != Z_OK) {
+		zHandle->~zStreamHandle_s();
+		lua_pushnil(L);
+		lua_pushstring(L, zError(err));
+		return 2;
+	}
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+static zStreamHandle_s* GetZStreamHandle(lua_State* L, ui_main_c* ui, const char* method, bool deflating)
+{
+	if (deflating) {
+		ui->LAssert(L, ui->IsUserData(L, 1, "uideflatestreammeta"), "deflateHandle:%s() must be used on a deflate stream", method);
+	}
+	else {
+		ui->LAssert(L, ui->IsUserData(L, 1, "uiinflatestreammeta"), "inflateHandle:%s() must be used on an inflate stream", method);
+	}
+	zStreamHandle_s* zHandle = (zStreamHandle_s*)lua_touserdata(L, 1);
+	lua_remove(L, 1);
+	return zHandle;
+}
+
+static int l_zStreamHandleGC(lua_State* L)
+{
+	zStreamHandle_s* zHandle = (zStreamHandle_s*)lua_touserdata(L, 1);
+	if (zHandle->deflating) {
+		deflateEnd(&zHandle->z);
+	}
+	else {
+		inflateEnd(&zHandle->z);
+	}
+	zHandle->~zStreamHandle_s();
+	return 0;
+}
+
+// Feed the given input through the stream, pushes the produced output or nil and an error message
+static int ZStreamProcess(lua_State* L, zStreamHandle_s* zHandle, const byte* in, size_t inLen, int flush)
+{
+	auto& z = zHandle->z;
+	auto& out = zHandle->out;
+	if (out.empty()) {
+		out.resize(1 << 16);
+	}
+	// Input left over from the previous call goes first
+	std::vector<byte> input;
+	if ( !zHandle->pendingIn.empty() ) {
+		input.swap(zHandle->pendingIn);
+		input.insert(input.end(), in, in + inLen);
+		in = input.data();
+		inLen = input.size();
+	}
+	z.next_in = (Bytef*)in;
+	z.avail_in = (uInt)inLen;
+	// Deflate output is bounded by its input, only inflating needs a limit
+	const size_t maxOut = zHandle->deflating ? SIZE_MAX : ZSTREAM_MAX_OUT;
+	zHandle->more = false;
+	size_t outLen = 0;
+	int err;
+	while (true) {
+		if (outLen == out.size()) {
+			if (out.size() >= maxOut) {
+				zHandle->more = true;
+				zHandle->pendingIn.assign(z.next_in, z.next_in + z.avail_in);
+				break;
+			}
+			out.resize((std::min)(out.size() * 2, maxOut));
+		}
+		z.next_out = out.data() + outLen;
+		z.avail_out = (uInt)(out.size() - outLen);
+		err = zHandle->deflating ? deflate(&z, flush) : inflate(&z, flush);
+		outLen = out.size() - z.avail_out;
+		if (err == Z_STREAM_END) {
+			zHandle->finished = true;
+			break;
+		}
+		if (err != Z_OK && err != Z_BUF_ERROR) {
+			lua_pushnil(L);
+			lua_pushstring(L, z.msg ? z.msg : zError(err));
+			return 2;
+		}
+		// Keep going while the output buffer is the limiting factor
+		if (z.avail_out != 0 && (flush != Z_FINISH || err == Z_BUF_ERROR) && (z.avail_in == 0 || err == Z_BUF_ERROR)) {
+			break;
+		}
+	}
+	lua_pushlstring(L, (const char*)out.data(), outLen);
+	// Large bursts don't get to pin their buffer for the life of the stream
+	if (out.size() > (1 << 20)) {
+		out = {};
+	}
+	return 1;
+}
+
+static int l_deflateHandleWrite(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	zStreamHandle_s* zHandle = GetZStreamHandle(L, ui, "Write", true);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: deflateHandle:Write(data)");
+	ui->LAssert(L, lua_isstring(L, 1), "deflateHandle:Write() argument 1: expected string, got %s", luaL_typename(L, 1));
+	ui->LAssert(L, !zHandle->finished, "deflateHandle:Write(): stream has already been finished");
+	size_t inLen;
+	const byte* in = (const byte*)lua_tolstring(L, 1, &inLen);
+	return ZStreamProcess(L, zHandle, in, inLen, Z_NO_FLUSH);
+}
+
+static int l_deflateHandleFinish(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	zStreamHandle_s* zHandle = GetZStreamHandle(L, ui, "Finish", true);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n == 0 || lua_isnil(L, 1) || lua_isstring(L, 1), "deflateHandle:Finish() argument 1: expected string or nil, got %s", luaL_typename(L, 1));
+	ui->LAssert(L, !zHandle->finished, "deflateHandle:Finish(): stream has already been finished");
+	size_t inLen = 0;
+	const byte* in = NULL;
+	if (n >= 1 && !lua_isnil(L, 1)) {
+		in = (const byte*)lua_tolstring(L, 1, &inLen);
+	}
+	int ret = ZStreamProcess(L, zHandle, in, inLen, Z_FINISH);
+	zHandle->out = {};
+	return ret;
+}
+
+static int l_inflateHandleWrite(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	zStreamHandle_s* zHandle = GetZStreamHandle(L, ui, "Write", false);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: inflateHandle:Write(data)");
+	ui->LAssert(L, lua_isstring(L, 1), "inflateHandle:Write() argument 1: expected string, got %s", luaL_typename(L, 1));
+	if (zHandle->finished) {
+		// Trailing data after the end of the stream is ignored
+		lua_pushliteral(L, "");
+		lua_pushboolean(L, 1);
+		lua_pushboolean(L, 0);
+		return 3;
+	}
+	size_t inLen;
+	const byte* in = (const byte*)lua_tolstring(L, 1, &inLen);
+	int ret = ZStreamProcess(L, zHandle, in, inLen, Z_NO_FLUSH);
+	if (ret == 2) {
+		return 2;
+	}
+	lua_pushboolean(L, zHandle->finished);
+	lua_pushboolean(L, zHandle->more);
+	return 3;
+}
+
+// ==========
+// Zstandard
+// ==========
+
+static int l_CompressZstd(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: CompressZstd(string[, level])");
+	ui->LAssert(L, lua_isstring(L, 1), "CompressZstd() argument 1: expected string, got %s", luaL_typename(L, 1));
+	std::optional<int> level;
+	if (n >= 2 && !lua_isnil(L, 2)) {
+		ui->LAssert(L, lua_isnumber(L, 2), "CompressZstd() argument 2: expected number or nil, got %s", luaL_typename(L, 2));
+		level = (int)lua_tointeger(L, 2);
+		ui->LAssert(L, *level >= ZSTD_minCLevel() && *level <= ZSTD_maxCLevel(), "CompressZstd() argument 2: level must be between %d and %d, got %d", ZSTD_minCLevel(), ZSTD_maxCLevel(), *level);
+	}
+	size_t inLen;
+	const char* in = lua_tolstring(L, 1, &inLen);
+	auto out = CompressZstandard(gsl::as_bytes(gsl::make_span(in, inLen)), level);
+	if (!out) {
+		lua_pushnil(L);
+		lua_pushstring(L, "Compression failed");
+		return 2;
+	}
+	lua_pushlstring(L, out->data(), out->size());
+	return 1;
+}
+
+static int l_DecompressZstd(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: DecompressZstd(string)");
+	ui->LAssert(L, lua_isstring(L, 1), "DecompressZstd() argument 1: expected string, got %s", luaL_typename(L, 1));
+	size_t inLen;
+	const char* in = lua_tolstring(L, 1, &inLen);
+	auto out = DecompressZstandard(gsl::as_bytes(gsl::make_span(in, inLen)));
+	if (!out) {
+		lua_pushnil(L);
+		lua_pushstring(L, "Invalid or corrupt data");
+		return 2;
+	}
+	lua_pushlstring(L, out->data(), out->size());
+	return 1;
+}
+
+/*
+* Zstandard handles keep their compression and decompression contexts alive between calls,
+* which avoids reallocating the match tables for every payload, and optionally hold a
+* digested dictionary for compressing many small, similar payloads.
+*/
+
+struct zstdHandle_s {
+	ZSTD_CCtx* cctx = nullptr;
+	ZSTD_DCtx* dctx = nullptr;
+	ZSTD_CDict* cdict = nullptr;
+	ZSTD_DDict* ddict = nullptr;
+	std::vector<char> out;
+
+	~zstdHandle_s()
+	{
+		ZSTD_freeCCtx(cctx);
+		ZSTD_freeDCtx(dctx);
+		ZSTD_freeCDict(cdict);
+		ZSTD_freeDDict(ddict);
+	}
+};
+
+static int l_NewZstdHandle(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	int level = ZSTD_defaultCLevel();
+	if (n >= 1 && !lua_isnil(L, 1)) {
+		ui->LAssert(L, lua_isnumber(L, 1), "NewZstdHandle() argument 1: expected number or nil, got %s", luaL_typename(L, 1));
+		level = (int)lua_tointeger(L, 1);
+		ui->LAssert(L, level >= ZSTD_minCLevel() && level <= ZSTD_maxCLevel(), "NewZstdHandle() argument 1: level must be between %d and %d, got %d", ZSTD_minCLevel(), ZSTD_maxCLevel(), level);
+	}
+	if (n >= 2 && !lua_isnil(L, 2)) {
+		ui->LAssert(L, lua_isstring(L, 2), "NewZstdHandle() argument 2: expected string or nil, got %s", luaL_typename(L, 2));
+	}
+
+	zstdHandle_s* zHandle = (zstdHandle_s*)lua_newuserdata(L, sizeof(zstdHandle_s));
+	new(zHandle) zstdHandle_s();
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_setmetatable(L, -2);
+	zHandle->cctx = ZSTD_createCCtx();
+	zHandle->dctx = ZSTD_createDCtx();
+	ui->LAssert(L, zHandle->cctx && zHandle->dctx, "NewZstdHandle(): couldn't create Zstandard contexts");
+	ZSTD_CCtx_setParameter(zHandle->cctx, ZSTD_c_compressionLevel, level);
+	if (n >= 2 && !lua_isnil(L, 2)) {
+		size_t dictLen;
+		const char* dict = lua_tolstring(L, 2, &dictLen);
+		zHandle->cdict = ZSTD_createCDict(dict, dictLen, level);
+		zHandle->ddict = ZSTD_createDDict(dict, dictLen);
+		ui->LAssert(L, zHandle->cdict && zHandle->ddict, "NewZstdHandle() argument 2: couldn't load dictionary");
+		ZSTD_CCtx_refCDict(zHandle->cctx, zHandle->cdict);
+		ZSTD_DCtx_refDDict(zHandle->dctx, zHandle->ddict);
+	}
+	return 1;
+}
+
+static zstdHandle_s* GetZstdHandle(lua_State* L, ui_main_c* ui, const char* method)
+{
+	ui->LAssert(L, ui->IsUserData(L, 1, "uizstdmeta"), "zstdHandle:%s() must be used on a Zstandard handle", method);
+	zstdHandle_s* zHandle = (zstdHandle_s*)lua_touserdata(L, 1);
+	lua_remove(L, 1);
+	return zHandle;
+}
+
+static int l_zstdHandleGC(lua_State* L)
+{
+	zstdHandle_s* zHandle = (zstdHandle_s*)lua_touserdata(L, 1);
+	zHandle->~zstdHandle_s();
+	return 0;
+}
+
+static int l_zstdHandleCompress(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	zstdHandle_s* zHandle = GetZstdHandle(L, ui, "Compress");
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: zstdHandle:Compress(string)");
+	ui->LAssert(L, lua_isstring(L, 1), "zstdHandle:Compress() argument 1: expected string, got %s", luaL_typename(L, 1));
+	size_t inLen;
+	const char* in = lua_tolstring(L, 1, &inLen);
+	ZSTD_CCtx_reset(zHandle->cctx, ZSTD_reset_session_only);
+	auto out = CompressZstandard(zHandle->cctx, gsl::as_bytes(gsl::make_span(in, inLen)));
+	if (!out) {
+		lua_pushnil(L);
+		lua_pushstring(L, "Compression failed");
+		return 2;
+	}
+	lua_pushlstring(L, out->data(), out->size());
+	return 1;
+}
+
+static int l_zstdHandleDecompress(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	zstdHandle_s* zHandle = GetZstdHandle(L, ui, "Decompress");
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: zstdHandle:Decompress(string)");
+	ui->LAssert(L, lua_isstring(L, 1), "zstdHandle:Decompress() argument 1: expected string, got %s", luaL_typename(L, 1));
+	size_t inLen;
+	const char* in = lua_tolstring(L, 1, &inLen);
+	auto out = DecompressZstandard(zHandle->dctx, gsl::as_bytes(gsl::make_span(in, inLen)));
+	if (!out) {
+		lua_pushnil(L);
+		lua_pushstring(L, "Invalid or corrupt data");
+		return 2;
+	}
+	lua_pushlstring(L, out->data(), out->size());
+	return 1;
+}
+
+static int l_zstdHandleCompressStream(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	zstdHandle_s* zHandle = GetZstdHandle(L, ui, "CompressStream");
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: zstdHandle:CompressStream(string[, finish])");
+	ui->LAssert(L, lua_isstring(L, 1), "zstdHandle:CompressStream() argument 1: expected string, got %s", luaL_typename(L, 1));
+	const ZSTD_EndDirective mode = lua_toboolean(L, 2) ? ZSTD_e_end : ZSTD_e_continue;
+	size_t inLen;
+	const char* in = lua_tolstring(L, 1, &inLen);
+	auto& out = zHandle->out;
+	if (out.empty()) {
+		out.resize(ZSTD_CStreamOutSize());
+	}
+	ZSTD_inBuffer input = { in, inLen, 0 };
+	size_t outLen = 0;
+	while (true) {
+		if (outLen == out.size()) {
+			out.resize(out.size() * 2);
+		}
+		ZSTD_outBuffer output = { out.data() + outLen, out.size() - outLen, 0 };
+		const size_t rc = ZSTD_compressStream2(zHandle->cctx, &output, &input, mode);
+		if (ZSTD_isError(rc)) {
+			ZSTD_CCtx_reset(zHandle->cctx, ZSTD_reset_session_only);
+			lua_pushnil(L);
+			lua_pushstring(L, ZSTD_getErrorName(rc));
+			return 2;
+		}
+		outLen += output.pos;
+		// Ending the frame is done once nothing is left to flush, otherwise once the input is consumed
+		if (mode == ZSTD_e_end ? rc == 0 : input.pos == input.size) {
+			break;
+		}
+	}
+	lua_pushlstring(L, out.data(), outLen);
+	return 1;
+}
+
+static int l_zstdHandleDecompressStream(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	zstdHandle_s* zHandle = GetZstdHandle(L, ui, "DecompressStream");
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: zstdHandle:DecompressStream(string)");
+	ui->LAssert(L, lua_isstring(L, 1), "zstdHandle:DecompressStream() argument 1: expected string, got %s", luaL_typename(L, 1));
+	size_t inLen;
+	const char* in = lua_tolstring(L, 1, &inLen);
+	auto& out = zHandle->out;
+	if (out.empty()) {
+		out.resize(ZSTD_DStreamOutSize());
+	}
+	ZSTD_inBuffer input = { in, inLen, 0 };
+	size_t outLen = 0;
+	size_t rc;
+	while (true) {
+		if (outLen == out.size()) {
+			out.resize(out.size() * 2);
+		}
+		ZSTD_outBuffer output = { out.data() + outLen, out.size() - outLen, 0 };
+		rc = ZSTD_decompressStream(zHandle->dctx, &output, &input);
+		if (ZSTD_isError(rc)) {
+			ZSTD_DCtx_reset(zHandle->dctx, ZSTD_reset_session_only);
+			lua_pushnil(L);
+			lua_pushstring(L, ZSTD_getErrorName(rc));
+			return 2;
+		}
+		outLen += output.pos;
+		if (input.pos == input.size && output.pos < output.size) {
+			break;
+		}
+	}
+	lua_pushlstring(L, out.data(), outLen);
+	lua_pushboolean(L, rc == 0);
+	return 2;
+}
+
+static int l_zstdHandleReset(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	zstdHandle_s* zHandle = GetZstdHandle(L, ui, "Reset");
+	ZSTD_CCtx_reset(zHandle->cctx, ZSTD_reset_session_only);
+	ZSTD_DCtx_reset(zHandle->dctx, ZSTD_reset_session_only);
+	zHandle->out = {};
+	return 0;
+}
+
+static int l_GetTime(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	lua_pushinteger(L, ui->sys->GetTime());
+	return 1;
+}
+
+static int l_GetScriptPath(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	lua_pushstring(L, ui->scriptPath.generic_u8string().c_str());
+	try
+	{
+		lua_pushstring(L, ui->scriptPath.generic_string().c_str());
+		return 2;
+	}
+	catch (std::exception& e)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, e.what());
+		return 3;
+	}
+}
+
+static int l_GetRuntimePath(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	lua_pushstring(L, ui->sys->basePath.generic_u8string().c_str());
+	try
+	{
+		lua_pushstring(L, ui->sys->basePath.generic_string().c_str());
+		return 2;
+	}
+	catch (std::exception& e)
+	{
+		lua_pushnil(L);
+		lua_pushstring(L, e.what());
+		return 3;
+	}
+}
+
+static int l_GetUserPath(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	auto& userPath = ui->sys->userPath;
+	if (!userPath) {
 		lua_pushnil(L);
 		lua_pushnil(L);
 		if (auto& reason = ui->sys->userPathReason)
@@ -1782,18 +2712,8 @@ static int l_GetWorkDir(lua_State* L)
 	return 1;
 }
 
-static int l_LaunchSubScript(lua_State* L)
+static dword AllocSubScriptSlot(ui_main_c* ui)
 {
-	ui_main_c* ui = GetUIPtr(L);
-	int n = lua_gettop(L);
-	ui->LAssert(L, n >= 3, "Usage: LaunchSubScript(scriptText, funcList, subList[, ...])");
-	for (int i = 1; i <= 3; i++) {
-		ui->LAssert(L, lua_isstring(L, i), "LaunchSubScript() argument %d: expected string, got %s", i, luaL_typename(L, i));
-	}
-	for (int i = 4; i <= n; i++) {
-		ui->LAssert(L, lua_isnil(L, i) || lua_isboolean(L, i) || lua_isnumber(L, i) || lua_isstring(L, i),
-			"LaunchSubScript() argument %d: only nil, boolean, number and string types can be passed to sub script", i);
-	}
 	dword slot = -1;
 	for (dword i = 0; i < ui->subScriptSize; i++) {
 		if (!ui->subScriptList[i]) {
@@ -1809,6 +2729,18 @@ static int l_LaunchSubScript(lua_State* L)
 			ui->subScriptList[i] = NULL;
 		}
 	}
+	return slot;
+}
+
+static int l_LaunchSubScript(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 3, "Usage: LaunchSubScript(scriptText, funcList, subList[, ...])");
+	for (int i = 1; i <= 3; i++) {
+		ui->LAssert(L, lua_isstring(L, i), "LaunchSubScript() argument %d: expected string, got %s", i, luaL_typename(L, i));
+	}
+	dword slot = AllocSubScriptSlot(ui);
 	ui->subScriptList[slot] = ui_ISubScript::GetHandle(ui, slot);
 	if (ui->subScriptList[slot]->Start()) {
 		lua_pushlightuserdata(L, (void*)(uintptr_t)slot);
@@ -1828,8 +2760,7 @@ static int l_AbortSubScript(lua_State* L)
 	dword slot = (dword)(uintptr_t)lua_touserdata(L, 1);
 	ui->LAssert(L, slot < ui->subScriptSize && ui->subScriptList[slot], "AbortSubScript() argument 1: invalid subscript ID");
 	ui->LAssert(L, ui->subScriptList[slot]->IsRunning(), "AbortSubScript(): subscript isn't running");
-	ui_ISubScript::FreeHandle(ui->subScriptList[slot]);
-	ui->subScriptList[slot] = NULL;
+	ui->subScriptList[slot]->Abort();
 	return 0;
 }
 
@@ -1845,6 +2776,250 @@ static int l_IsSubScriptRunning(lua_State* L)
 	return 1;
 }
 
+struct subScriptJobHandle_s {
+	std::shared_ptr<ui_subScriptJob_s> job;
+};
+
+// Job handle metatable is upvalue 1 of the calling function
+static void PushSubScriptJob(lua_State* L, std::shared_ptr<ui_subScriptJob_s> job)
+{
+	subScriptJobHandle_s* jobHandle = (subScriptJobHandle_s*)lua_newuserdata(L, sizeof(subScriptJobHandle_s));
+	new(jobHandle) subScriptJobHandle_s();
+	jobHandle->job = std::move(job);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_setmetatable(L, -2);
+}
+
+static int l_LaunchSubScriptJob(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 3, "Usage: LaunchSubScriptJob(scriptText, funcList, subList[, ...])");
+	for (int i = 1; i <= 3; i++) {
+		ui->LAssert(L, lua_isstring(L, i), "LaunchSubScriptJob() argument %d: expected string, got %s", i, luaL_typename(L, i));
+	}
+	auto job = std::make_shared<ui_subScriptJob_s>();
+	dword slot = AllocSubScriptSlot(ui);
+	ui->subScriptList[slot] = ui_ISubScript::GetHandle(ui, slot, job);
+	ui->subScriptList[slot]->Start();
+	PushSubScriptJob(L, std::move(job));
+	return 1;
+}
+
+static int l_ParallelMap(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 2, "Usage: ParallelMap(scriptText, items[, maxWorkers])");
+	ui->LAssert(L, lua_isstring(L, 1), "ParallelMap() argument 1: expected string, got %s", luaL_typename(L, 1));
+	ui->LAssert(L, lua_istable(L, 2), "ParallelMap() argument 2: expected table, got %s", luaL_typename(L, 2));
+	int maxWorkers = std::max(ui->sys->processorCount, 1);
+	if (n >= 3 && !lua_isnil(L, 3)) {
+		ui->LAssert(L, lua_isnumber(L, 3), "ParallelMap() argument 3: expected number or nil, got %s", luaL_typename(L, 3));
+		maxWorkers = (int)lua_tointeger(L, 3);
+		ui->LAssert(L, maxWorkers >= 1, "ParallelMap() argument 3: must be at least 1, got %d", maxWorkers);
+	}
+	lua_settop(L, 2);
+	auto job = std::make_shared<ui_subScriptJob_s>();
+	dword slot = AllocSubScriptSlot(ui);
+	ui->subScriptList[slot] = ui_ISubScript::GetMapHandle(ui, slot, job, maxWorkers);
+	ui->subScriptList[slot]->Start();
+	PushSubScriptJob(L, std::move(job));
+	return 1;
+}
+
+static ui_subScriptJob_s* GetSubScriptJob(lua_State* L, ui_main_c* ui, const char* method)
+{
+	ui->LAssert(L, ui->IsUserData(L, 1, "uisubscriptjobmeta"), "job:%s() must be used on a subscript job", method);
+	subScriptJobHandle_s* jobHandle = (subScriptJobHandle_s*)lua_touserdata(L, 1);
+	lua_remove(L, 1);
+	return jobHandle->job.get();
+}
+
+static int l_subScriptJobGC(lua_State* L)
+{
+	subScriptJobHandle_s* jobHandle = (subScriptJobHandle_s*)lua_touserdata(L, 1);
+	ui_subScriptJob_s* job = jobHandle->job.get();
+	if (job->subScript) {
+		// Nothing can collect the outcome any more
+		job->subScript->Abort();
+	}
+	if (job->resultsRef != LUA_NOREF) {
+		luaL_unref(L, LUA_REGISTRYINDEX, job->resultsRef);
+	}
+	jobHandle->~subScriptJobHandle_s();
+	return 0;
+}
+
+static int l_subScriptJobStatus(lua_State* L)
+{
+	static const char* const stateNames[] = { "RUNNING", "DONE", "FAILED", "CANCELLED", "TIMEDOUT" };
+	ui_main_c* ui = GetUIPtr(L);
+	ui_subScriptJob_s* job = GetSubScriptJob(L, ui, "Status");
+	lua_pushstring(L, stateNames[job->state]);
+	lua_pushnumber(L, job->progress);
+	return 2;
+}
+
+static int l_subScriptJobResults(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	ui_subScriptJob_s* job = GetSubScriptJob(L, ui, "Results");
+	if (job->state == SS_JOB_RUNNING) {
+		lua_pushnil(L);
+		lua_pushstring(L, "Sub script is still running");
+		return 2;
+	}
+	if (job->state != SS_JOB_DONE) {
+		lua_pushnil(L);
+		lua_pushstring(L, job->error.c_str());
+		return 2;
+	}
+	lua_rawgeti(L, LUA_REGISTRYINDEX, job->resultsRef);
+	lua_getfield(L, -1, "n");
+	int n = (int)lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	ui->LAssert(L, lua_checkstack(L, n), "job:Results(): too many results");
+	for (int i = 1; i <= n; i++) {
+		lua_rawgeti(L, -i, i);
+	}
+	return n;
+}
+
+static int l_subScriptJobCancel(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	ui_subScriptJob_s* job = GetSubScriptJob(L, ui, "Cancel");
+	int n = lua_gettop(L);
+	int graceMsec = 1000;
+	if (n >= 1 && !lua_isnil(L, 1)) {
+		ui->LAssert(L, lua_isnumber(L, 1), "job:Cancel() argument 1: expected number or nil, got %s", luaL_typename(L, 1));
+		graceMsec = (int)lua_tointeger(L, 1);
+	}
+	if (job->subScript) {
+		job->subScript->Cancel(graceMsec);
+	}
+	return 0;
+}
+
+static int l_subScriptJobSetTimeout(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	ui_subScriptJob_s* job = GetSubScriptJob(L, ui, "SetTimeout");
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: job:SetTimeout(msec)");
+	ui->LAssert(L, lua_isnumber(L, 1), "job:SetTimeout() argument 1: expected number, got %s", luaL_typename(L, 1));
+	if (job->subScript) {
+		job->subScript->SetTimeout((int)lua_tointeger(L, 1));
+	}
+	return 0;
+}
+
+static int l_PublishSnapshot(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 2, "Usage: PublishSnapshot(name, value)");
+	ui->LAssert(L, lua_isstring(L, 1), "PublishSnapshot() argument 1: expected string, got %s", luaL_typename(L, 1));
+	if ( !ui->snapshots->Publish(L, lua_tostring(L, 1), 2) ) {
+		lua_pushnil(L);
+		lua_insert(L, -2);
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+// ===============
+// Async File I/O
+// ===============
+
+static std::filesystem::path AsyncFilePath(const char* path)
+{
+	// Resolved now, as the worker thread may run while the process is in a different working directory
+	std::error_code ec;
+	auto absPath = std::filesystem::absolute(std::filesystem::u8path(path), ec);
+	return ec ? std::filesystem::u8path(path) : absPath;
+}
+
+static int l_ReadFileAsync(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 2, "Usage: ReadFileAsync(path, callback[, decompress])");
+	ui->LAssert(L, lua_isstring(L, 1), "ReadFileAsync() argument 1: expected string, got %s", luaL_typename(L, 1));
+	ui->LAssert(L, lua_isfunction(L, 2) || lua_isnil(L, 2), "ReadFileAsync() argument 2: expected function or nil, got %s", luaL_typename(L, 2));
+	ui_asyncCodec_e codec = ASYNC_CODEC_NONE;
+	if (n >= 3 && !lua_isnil(L, 3)) {
+		ui->LAssert(L, lua_isstring(L, 3), "ReadFileAsync() argument 3: expected string or nil, got %s", luaL_typename(L, 3));
+		static const char* codecMap[] = { "NONE", "DEFLATE", "ZSTD", NULL };
+		int codecIdx = FindOption(lua_tostring(L, 3), codecMap);
+		ui->LAssert(L, codecIdx >= 0, "ReadFileAsync() argument 3: invalid decompression mode '%s'", lua_tostring(L, 3));
+		codec = (ui_asyncCodec_e)codecIdx;
+	}
+	auto path = AsyncFilePath(lua_tostring(L, 1));
+	lua_settop(L, 2);
+	int callbackRef = lua_isnil(L, 2) ? LUA_NOREF : luaL_ref(L, LUA_REGISTRYINDEX);
+	dword id = ui->asyncFile->Read(path, codec, callbackRef);
+	lua_pushlightuserdata(L, (void*)(uintptr_t)id);
+	return 1;
+}
+
+static int l_WriteFileAsync(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 2, "Usage: WriteFileAsync(path, data[, callback[, append]])");
+	ui->LAssert(L, lua_isstring(L, 1), "WriteFileAsync() argument 1: expected string, got %s", luaL_typename(L, 1));
+	ui->LAssert(L, lua_type(L, 2) == LUA_TSTRING, "WriteFileAsync() argument 2: expected string, got %s", luaL_typename(L, 2));
+	ui->LAssert(L, n < 3 || lua_isfunction(L, 3) || lua_isnil(L, 3), "WriteFileAsync() argument 3: expected function or nil, got %s", luaL_typename(L, 3));
+	auto path = AsyncFilePath(lua_tostring(L, 1));
+	bool append = lua_toboolean(L, 4) != 0;
+	lua_settop(L, 3);
+	int callbackRef = lua_isnil(L, 3) ? LUA_NOREF : luaL_ref(L, LUA_REGISTRYINDEX);
+	lua_settop(L, 2);
+	// The worker reads straight from the Lua string, the reference keeps it alive until the write is delivered
+	size_t dataLen;
+	const char* data = lua_tolstring(L, 2, &dataLen);
+	int dataRef = luaL_ref(L, LUA_REGISTRYINDEX);
+	dword id = ui->asyncFile->Write(path, data, dataLen, dataRef, append, callbackRef);
+	lua_pushlightuserdata(L, (void*)(uintptr_t)id);
+	return 1;
+}
+
+static int l_CancelFileAsync(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: CancelFileAsync(id)");
+	ui->LAssert(L, lua_islightuserdata(L, 1), "CancelFileAsync() argument 1: expected async file ID, got %s", luaL_typename(L, 1));
+	lua_pushboolean(L, ui->asyncFile->Cancel((dword)(uintptr_t)lua_touserdata(L, 1)));
+	return 1;
+}
+
+static int l_GetFileAsyncStatus(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	ui->LAssert(L, n >= 1, "Usage: GetFileAsyncStatus(id)");
+	ui->LAssert(L, lua_islightuserdata(L, 1), "GetFileAsyncStatus() argument 1: expected async file ID, got %s", luaL_typename(L, 1));
+	switch (ui->asyncFile->GetStatus((dword)(uintptr_t)lua_touserdata(L, 1))) {
+	case ASYNC_STATUS_QUEUED:
+		lua_pushstring(L, "QUEUED");
+		break;
+	case ASYNC_STATUS_RUNNING:
+		lua_pushstring(L, "RUNNING");
+		break;
+	case ASYNC_STATUS_DONE:
+		lua_pushstring(L, "DONE");
+		break;
+	default:
+		lua_pushnil(L);
+		break;
+	}
+	return 1;
+}
+
 SG_LUA_CPP_FUN_BEGIN(LoadModule)
 {
 	ui_main_c* ui = GetUIPtr(L);
@@ -1859,7 +3034,7 @@ SG_LUA_CPP_FUN_BEGIN(LoadModule)
 
 	ui->sys->SetWorkDir(ui->scriptPath);
 	auto fileStr = fileName.generic_u8string();
-	int err = luaL_loadfile(L, fileStr.c_str());
+	int err = ui->moduleCache->Load(L, fileName);
 	ui->sys->SetWorkDir(ui->scriptWorkDir);
 	ui->LExpect(L, err == 0, "LoadModule() error loading '%s' (%d):\n%s", fileStr.c_str(), err, lua_tostring(L, -1));
 	lua_replace(L, 1);	// Replace module name with module main chunk
@@ -1881,7 +3056,7 @@ SG_LUA_CPP_FUN_BEGIN(PLoadModule)
 	}
 
 	ui->sys->SetWorkDir(ui->scriptPath);
-	int err = luaL_loadfile(L, fileName.generic_u8string().c_str());
+	int err = ui->moduleCache->Load(L, fileName);
 	ui->sys->SetWorkDir(ui->scriptWorkDir);
 	if (err) {
 		return 1;
@@ -2065,8 +3240,24 @@ static int l_SetProfiling(lua_State* L)
 {
 	ui_main_c* ui = GetUIPtr(L);
 	int n = lua_gettop(L);
-	ui->LAssert(L, n >= 1, "Usage: SetProfiling(isEnabled)");
-	ui->debug->SetProfiling(lua_toboolean(L, 1) == 1);
+	ui->LAssert(L, n >= 1, "Usage: SetProfiling(isEnabled[, outputBase])");
+	bool enable = lua_toboolean(L, 1) == 1;
+	if (enable && ui->debug->IsProfiling()) {
+		// The session keeps the output it was started with
+		ui->LAssert(L, n < 2 || lua_isnil(L, 2), "SetProfiling(): can't change the output base while profiling");
+	}
+	else if (enable) {
+		std::optional<std::filesystem::path> outputBase;
+		if (n >= 2 && !lua_isnil(L, 2)) {
+			ui->LAssert(L, lua_isstring(L, 2), "SetProfiling() argument 2: expected string or nil, got %s", luaL_typename(L, 2));
+			std::error_code ec;
+			auto path = std::filesystem::u8path(lua_tostring(L, 2));
+			auto absPath = std::filesystem::absolute(path, ec);
+			outputBase = ec ? path : absPath;
+		}
+		ui->debug->SetProfileOutput(outputBase);
+	}
+	ui->debug->SetProfiling(enable);
 	return 0;
 }
 
@@ -2107,6 +3298,77 @@ static int l_SetForeground(lua_State* L)
 	return 0;
 }
 
+// ==================
+// Coroutine Tracking
+// ==================
+
+// coroutine.resume() replacement, upvalues are the original resume and the weak-keyed set of suspended coroutines
+// Keeps ui_main_c::suspendedCoroutines up to date, so coroutine._list only needs checking while something is suspended
+static int l_TrackedResume(lua_State* L)
+{
+	ui_main_c* ui = GetUIPtr(L);
+	int n = lua_gettop(L);
+	lua_State* co = lua_tothread(L, 1);
+	if (co) {
+		lua_pushvalue(L, 1);
+		lua_rawget(L, lua_upvalueindex(2));
+		if (!lua_isnil(L, -1)) {
+			lua_pushvalue(L, 1);
+			lua_pushnil(L);
+			lua_rawset(L, lua_upvalueindex(2));
+			ui->suspendedCoroutines--;
+		}
+		lua_pop(L, 1);
+	}
+	lua_pushvalue(L, 1);
+	lua_insert(L, 1); // Keep the coroutine below the results
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_insert(L, 2);
+	lua_call(L, n, LUA_MULTRET);
+	if (co && lua_status(co) == LUA_YIELD) {
+		lua_pushvalue(L, 1);
+		lua_pushboolean(L, 1);
+		lua_rawset(L, lua_upvalueindex(2));
+		ui->suspendedCoroutines++;
+	}
+	lua_remove(L, 1);
+	return lua_gettop(L);
+}
+
+// Function returned by coroutine.wrap(), upvalues are the tracked resume and the coroutine
+static int l_TrackedWrapAux(lua_State* L)
+{
+	int n = lua_gettop(L);
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_insert(L, 1);
+	lua_pushvalue(L, lua_upvalueindex(2));
+	lua_insert(L, 2);
+	lua_call(L, n + 1, LUA_MULTRET);
+	if (!lua_toboolean(L, 1)) {
+		// As lua_auxwrap(), add position information to error messages
+		if (lua_isstring(L, -1)) {
+			luaL_where(L, 1);
+			lua_insert(L, -2);
+			lua_concat(L, 2);
+		}
+		return lua_error(L);
+	}
+	lua_remove(L, 1);
+	return lua_gettop(L);
+}
+
+// coroutine.wrap() replacement, upvalues are the original create and the tracked resume
+static int l_TrackedWrap(lua_State* L)
+{
+	lua_pushvalue(L, lua_upvalueindex(1));
+	lua_insert(L, 1);
+	lua_call(L, lua_gettop(L) - 1, 1);
+	lua_pushvalue(L, lua_upvalueindex(2));
+	lua_insert(L, -2);
+	lua_pushcclosure(L, l_TrackedWrapAux, 2);
+	return 1;
+}
+
 // ==============================
 // Library and API Initialisation
 // ==============================
@@ -2119,6 +3381,27 @@ int ui_main_c::InitAPI(lua_State* L)
 	sol::state_view lua(L);
 	luaL_openlibs(L);
 
+	// Replace coroutine.resume/wrap with versions that track suspended coroutines
+	{
+		lua_newtable(L);		// Suspended coroutine set
+		lua_newtable(L);
+		lua_pushstring(L, "k");
+		lua_setfield(L, -2, "__mode");
+		lua_setmetatable(L, -2);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, "uisuspendedcoroutines");
+		lua_getglobal(L, "coroutine");
+		lua_getfield(L, -1, "resume");
+		lua_pushvalue(L, -3);
+		lua_pushcclosure(L, l_TrackedResume, 2);
+		lua_getfield(L, -2, "create");
+		lua_pushvalue(L, -2);
+		lua_pushcclosure(L, l_TrackedWrap, 2);
+		lua_setfield(L, -3, "wrap");
+		lua_setfield(L, -2, "resume");
+		lua_pop(L, 2);
+	}
+
 	// Add "lua/" subdir for non-JIT Lua
 	{
 		lua_getglobal(L, "package");
@@ -2178,8 +3461,76 @@ int ui_main_c::InitAPI(lua_State* L)
 	lua_setfield(L, -2, "__gc");
 	lua_pushcfunction(L, l_artHandleSize);
 	lua_setfield(L, -2, "Size");
+	lua_pushcfunction(L, l_artHandleIsLoading);
+	lua_setfield(L, -2, "IsLoading");
 	lua_setfield(L, LUA_REGISTRYINDEX, "uiarthandlemeta");
 
+	// Compression streams
+	lua_newtable(L);		// Deflate stream metatable
+	lua_pushvalue(L, -1);	// Push deflate stream metatable
+	ADDFUNCCL(NewDeflateStream, 1);
+	lua_pushvalue(L, -1);	// Push deflate stream metatable
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, l_zStreamHandleGC);
+	lua_setfield(L, -2, "__gc");
+	lua_pushcfunction(L, l_deflateHandleWrite);
+	lua_setfield(L, -2, "Write");
+	lua_pushcfunction(L, l_deflateHandleFinish);
+	lua_setfield(L, -2, "Finish");
+	lua_setfield(L, LUA_REGISTRYINDEX, "uideflatestreammeta");
+	lua_newtable(L);		// Inflate stream metatable
+	lua_pushvalue(L, -1);	// Push inflate stream metatable
+	ADDFUNCCL(NewInflateStream, 1);
+	lua_pushvalue(L, -1);	// Push inflate stream metatable
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, l_zStreamHandleGC);
+	lua_setfield(L, -2, "__gc");
+	lua_pushcfunction(L, l_inflateHandleWrite);
+	lua_setfield(L, -2, "Write");
+	lua_setfield(L, LUA_REGISTRYINDEX, "uiinflatestreammeta");
+
+	// Zstandard
+	ADDFUNC(CompressZstd);
+	ADDFUNC(DecompressZstd);
+	lua_newtable(L);		// Zstandard handle metatable
+	lua_pushvalue(L, -1);	// Push Zstandard handle metatable
+	ADDFUNCCL(NewZstdHandle, 1);
+	lua_pushvalue(L, -1);	// Push Zstandard handle metatable
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, l_zstdHandleGC);
+	lua_setfield(L, -2, "__gc");
+	lua_pushcfunction(L, l_zstdHandleCompress);
+	lua_setfield(L, -2, "Compress");
+	lua_pushcfunction(L, l_zstdHandleDecompress);
+	lua_setfield(L, -2, "Decompress");
+	lua_pushcfunction(L, l_zstdHandleCompressStream);
+	lua_setfield(L, -2, "CompressStream");
+	lua_pushcfunction(L, l_zstdHandleDecompressStream);
+	lua_setfield(L, -2, "DecompressStream");
+	lua_pushcfunction(L, l_zstdHandleReset);
+	lua_setfield(L, -2, "Reset");
+	lua_setfield(L, LUA_REGISTRYINDEX, "uizstdmeta");
+
+	// Display lists
+	lua_newtable(L);		// Display list metatable
+	lua_pushvalue(L, -1);	// Push display list metatable
+	ADDFUNCCL(NewDisplayList, 1);
+	lua_pushvalue(L, -1);	// Push display list metatable
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, l_dlHandleGC);
+	lua_setfield(L, -2, "__gc");
+	lua_pushcfunction(L, l_dlHandleBegin);
+	lua_setfield(L, -2, "Begin");
+	lua_pushcfunction(L, l_dlHandleEnd);
+	lua_setfield(L, -2, "End");
+	lua_pushcfunction(L, l_dlHandleDraw);
+	lua_setfield(L, -2, "Draw");
+	lua_pushcfunction(L, l_dlHandleClear);
+	lua_setfield(L, -2, "Clear");
+	lua_pushcfunction(L, l_dlHandleIsEmpty);
+	lua_setfield(L, -2, "IsEmpty");
+	lua_setfield(L, LUA_REGISTRYINDEX, "uidisplaylistmeta");
+
 	sol::usertype<Texture_c> textureType = lua.new_usertype<Texture_c>("Texture",
 		sol::constructors<Texture_c()>());
 
@@ -2222,10 +3573,13 @@ int ui_main_c::InitAPI(lua_State* L)
 	ADDFUNC(GetDPIScaleOverridePercent);
 	ADDFUNC(DrawImage);
 	ADDFUNC(DrawImageQuad);
+	ADDFUNC(DrawImageBatch);
 	ADDFUNC(DrawString);
+	ADDFUNC(DrawStringBatch);
 	ADDFUNC(DrawStringWidth);
 	ADDFUNC(DrawStringCursorIndex);
 	ADDFUNC(StripEscapes);
+	ADDFUNC(StripEscapesLength);
 	ADDFUNC(GetAsyncCount);
 	ADDFUNC(RenderInit);
 
@@ -2258,6 +3612,7 @@ int ui_main_c::InitAPI(lua_State* L)
 	ADDFUNC(Paste);
 	ADDFUNC(Deflate);
 	ADDFUNC(Inflate);
+	ADDFUNC(DeflateParallel);
 	ADDFUNC(GetTime);
 	ADDFUNC(GetScriptPath);
 	ADDFUNC(GetRuntimePath);
@@ -2269,6 +3624,29 @@ int ui_main_c::InitAPI(lua_State* L)
 	ADDFUNC(LaunchSubScript);
 	ADDFUNC(AbortSubScript);
 	ADDFUNC(IsSubScriptRunning);
+	lua_newtable(L);		// Subscript job metatable
+	lua_pushvalue(L, -1);	// Push subscript job metatable
+	ADDFUNCCL(LaunchSubScriptJob, 1);
+	lua_pushvalue(L, -1);	// Push subscript job metatable
+	ADDFUNCCL(ParallelMap, 1);
+	lua_pushvalue(L, -1);	// Push subscript job metatable
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, l_subScriptJobGC);
+	lua_setfield(L, -2, "__gc");
+	lua_pushcfunction(L, l_subScriptJobStatus);
+	lua_setfield(L, -2, "Status");
+	lua_pushcfunction(L, l_subScriptJobResults);
+	lua_setfield(L, -2, "Results");
+	lua_pushcfunction(L, l_subScriptJobCancel);
+	lua_setfield(L, -2, "Cancel");
+	lua_pushcfunction(L, l_subScriptJobSetTimeout);
+	lua_setfield(L, -2, "SetTimeout");
+	lua_setfield(L, LUA_REGISTRYINDEX, "uisubscriptjobmeta");
+	ADDFUNC(PublishSnapshot);
+	ADDFUNC(ReadFileAsync);
+	ADDFUNC(WriteFileAsync);
+	ADDFUNC(CancelFileAsync);
+	ADDFUNC(GetFileAsyncStatus);
 	ADDFUNC(LoadModule);
 	ADDFUNC(PLoadModule);
 	ADDFUNC(PCall);
@@ -2292,6 +3670,9 @@ int ui_main_c::InitAPI(lua_State* L)
 	lua_setfield(L, -2, "exit");
 	lua_pop(L, 1);		// Pop 'os' table
 
+	// GetSnapshot() and friends, shared with subscripts
+	GetUIPtr(L)->snapshots->OpenLibrary(L);
+
 	return 0;
 }
 
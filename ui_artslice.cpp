@@ -0,0 +1,113 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// Module: UI Art Slicing
+//
+
+#include "ui_artslice.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Kept free of the engine and Lua headers so test/artslice_test.cpp can build it on its own
+
+// =========
+// Functions
+// =========
+
+void ArtSliceRectangle(const uint8_t* src, int srcWidth, int comp, int x1, int y1, int x2, int y2, uint8_t* dst)
+{
+	const int dstWidth = x2 - x1;
+	const int dstHeight = y2 - y1;
+
+	const int srcStride = srcWidth * comp;
+	const int dstStride = dstWidth * comp;
+
+	// Each destination row is one contiguous run of the source row.
+	const uint8_t* srcPtr = src + y1 * srcStride + x1 * comp;
+	uint8_t* dstPtr = dst;
+	for (int row = 0; row < dstHeight; ++row) {
+		memcpy(dstPtr, srcPtr, dstStride);
+		srcPtr += srcStride;
+		dstPtr += dstStride;
+	}
+}
+
+// Largest s such that s * s <= v, for v >= 0.
+static int ISqrt(int v)
+{
+	int s = (int)std::sqrt((double)v);
+	while (s > 0 && s * s > v)
+		--s;
+	while ((s + 1) * (s + 1) <= v)
+		++s;
+	return s;
+}
+
+void ArtSliceArcBand(const uint8_t* src, int srcWidth, int comp, int xC, int yC, int rMin, int rMax, uint8_t* dst)
+{
+	const int x1 = xC - rMax;
+	const int y1 = yC - rMax;
+
+	const int dstWidth = xC - x1;
+	const int dstHeight = yC - y1;
+
+	const int srcStride = srcWidth * comp;
+	const int dstStride = dstWidth * comp;
+	const int dstByteCount = dstHeight * dstStride;
+	memset(dst, 0x00, dstByteCount);
+
+	// Copy all pixels whose center are between the two radii, inclusive.
+	{
+		// By doubling all coordinates, we can reference both pixel edges and pixel centers.
+		// Even numbers are between pixel samples, odd numbers are on pixel samples.
+		// This makes the distance test math more robust.
+		// As this is ad-hoc 31.1 bit fixed point math, we should technically shift down the result of
+		// the multiplications that go into the squares but as the same number of operations occur on both
+		// sides of the squared equalities, it's fine. Just something to keep in mind for future changes.
+		const int rMinSq = (rMin * 2) * (rMin * 2), rMaxSq = (rMax * 2) * (rMax * 2);
+		const int width = dstWidth * 2, height = dstHeight * 2;
+		for (int row = 1; row < height; row += 2)
+		{
+			const int dy = height - row;
+			// Pixel centers sit on odd coordinates and width is even, so dx = width - x is odd as well.
+			// Solve for the first pixel center that is inside the outer radius: the largest odd dx
+			// with dx * dx <= rMaxSq - dy * dy, clamped to the first pixel center of the row.
+			const int outerSq = rMaxSq - dy * dy;
+			int dxLo = outerSq < 0 ? -1 : std::min(ISqrt(outerSq), width - 1);
+			if (!(dxLo & 1))
+				--dxLo;
+
+			// If no pixel was found to be inside, the row does not contribute.
+			if (dxLo < 1)
+				continue;
+			const int colLo = width - dxLo;
+
+			// Likewise the first pixel center that is inside the inner radius is the largest odd dx
+			// with dx * dx < rMinSq - dy * dy, but not before colLo. Without one the span runs to the far border.
+			const int innerSq = rMinSq - dy * dy;
+			int dxHi = innerSq <= 0 ? -1 : std::min(ISqrt(innerSq - 1), dxLo);
+			if (!(dxHi & 1))
+				--dxHi;
+			const int colHi = dxHi < 1 ? width : width - dxHi;
+
+			// We now have a half-open span of touched pixel centers (or the far border).
+			// Convert that to regular pixel coordinates and copy to the destination image.
+			const int xLo = colLo / 2;
+			const int xHi = colHi / 2;
+
+			if (xLo != xHi) {
+				const int y = row / 2;
+				const int spanByteSize = (xHi - xLo) * comp;
+				const int srcRow = y1 + y;
+				const int dstRow = y;
+				const int srcCol = x1 + xLo;
+				const int dstCol = xLo;
+				const uint8_t* srcPtr = src + srcRow * srcStride + srcCol * comp;
+				uint8_t* dstPtr = dst + dstRow * dstStride + dstCol * comp;
+				memcpy(dstPtr, srcPtr, spanByteSize);
+			}
+		}
+	}
+}
@@ -0,0 +1,20 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// UI Art Slicing Header
+//
+
+#include <cstdint>
+
+// =========
+// Functions
+// =========
+
+// Both work on tightly packed images of comp bytes per pixel, and leave bounds checks to the caller
+
+// Copies the pixels from x1, y1 up to x2, y2 into dst, which holds (x2 - x1) * (y2 - y1) pixels
+void	ArtSliceRectangle(const uint8_t* src, int srcWidth, int comp, int x1, int y1, int x2, int y2, uint8_t* dst);
+
+// Copies the pixels above and left of xC, yC whose centers lie between rMin and rMax into dst,
+// which holds rMax * rMax pixels; pixels outside the band are cleared
+void	ArtSliceArcBand(const uint8_t* src, int srcWidth, int comp, int xC, int yC, int rMin, int rMax, uint8_t* dst);
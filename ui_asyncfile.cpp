@@ -0,0 +1,353 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// Module: UI Async File
+//
+
+#include "ui_local.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "core/core_compress.h"
+
+// =======
+// Classes
+// =======
+
+struct ui_asyncFileReq_s {
+	dword	id = 0;
+	bool	write = false;
+	bool	append = false;
+	ui_asyncCodec_e codec = ASYNC_CODEC_NONE;
+	std::filesystem::path path;
+	const char* data = nullptr;		// Write payload, a Lua string kept alive by dataRef
+	size_t	dataLen = 0;
+	int		dataRef = LUA_NOREF;
+	int		callbackRef = LUA_NOREF;
+	ui_asyncStatus_e status = ASYNC_STATUS_QUEUED;	// Guarded by the handler mutex
+	std::atomic<bool> cancelled = false;
+	std::string result;
+	std::string error;
+};
+
+// ========================
+// ui_IAsyncFile Interface
+// ========================
+
+class ui_asyncFile_c: public ui_IAsyncFile {
+public:
+	// Interface
+	dword	Read(const std::filesystem::path& path, ui_asyncCodec_e codec, int callbackRef);
+	dword	Write(const std::filesystem::path& path, const char* data, size_t dataLen, int dataRef, bool append, int callbackRef);
+	bool	Cancel(dword id);
+	ui_asyncStatus_e GetStatus(dword id);
+	bool	HasPending();
+	void	AsyncFileFrame();
+
+	// Encapsulated
+	ui_asyncFile_c(ui_main_c* ui);
+	~ui_asyncFile_c();
+
+	ui_main_c* ui = nullptr;
+	dword	nextId = 1;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool	stopping = false;								// Guarded by mutex
+	std::deque<ui_asyncFileReq_s*> queue;					// Guarded by mutex
+	std::vector<ui_asyncFileReq_s*> completed;				// Guarded by mutex
+	std::unordered_map<dword, std::unique_ptr<ui_asyncFileReq_s>> requests;	// Main thread only
+
+	dword	Submit(std::unique_ptr<ui_asyncFileReq_s> req);
+	void	Release(ui_asyncFileReq_s* req);
+	void	WorkerProc();
+	void	ProcessRead(ui_asyncFileReq_s* req);
+	void	ProcessWrite(ui_asyncFileReq_s* req);
+};
+
+ui_IAsyncFile* ui_IAsyncFile::GetHandle(ui_main_c* ui)
+{
+	return new ui_asyncFile_c(ui);
+}
+
+void ui_IAsyncFile::FreeHandle(ui_IAsyncFile* hnd)
+{
+	delete (ui_asyncFile_c*)hnd;
+}
+
+ui_asyncFile_c::ui_asyncFile_c(ui_main_c* ui)
+	: ui(ui)
+{
+}
+
+ui_asyncFile_c::~ui_asyncFile_c()
+{
+	// Reads are dropped, but writes still get finished so saves made on the way out aren't lost
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+		queue.erase(std::remove_if(queue.begin(), queue.end(), [](ui_asyncFileReq_s* req) { return !req->write; }), queue.end());
+	}
+	for (auto& [id, req] : requests) {
+		if (!req->write) {
+			req->cancelled = true;
+		}
+	}
+	wake.notify_all();
+	if (worker.joinable()) {
+		worker.join();
+	}
+	// Registry references die with the Lua state, which is closed right after this
+}
+
+// ===================
+// Request Processing
+// ===================
+
+static bool InflateAll(const std::string& src, std::string& out, const std::atomic<bool>& cancelled)
+{
+	z_stream z{};
+	if (inflateInit2(&z, 15 + 32) != Z_OK) {
+		return false;
+	}
+	out.resize(std::max<size_t>(src.size() * 4, 1 << 16));
+	z.next_in = (Bytef*)src.data();
+	z.avail_in = (uInt)src.size();
+	size_t outLen = 0;
+	int err;
+	do {
+		if (outLen == out.size()) {
+			out.resize(out.size() * 2);
+		}
+		z.next_out = (Bytef*)out.data() + outLen;
+		z.avail_out = (uInt)(out.size() - outLen);
+		err = inflate(&z, Z_NO_FLUSH);
+		outLen = out.size() - z.avail_out;
+	} while (err == Z_OK && !cancelled);
+	inflateEnd(&z);
+	out.resize(outLen);
+	return err == Z_STREAM_END;
+}
+
+void ui_asyncFile_c::ProcessRead(ui_asyncFileReq_s* req)
+{
+	std::ifstream in(req->path, std::ios::binary | std::ios::ate);
+	if (!in) {
+		req->error = "Couldn't open file";
+		return;
+	}
+	const size_t size = (size_t)in.tellg();
+	in.seekg(0);
+	std::string raw(size, '\0');
+	// Read in slices so that cancellation doesn't have to wait for the whole file
+	constexpr size_t sliceSize = 1 << 20;
+	for (size_t pos = 0; pos < size && !req->cancelled; pos += sliceSize) {
+		if (!in.read(raw.data() + pos, std::min(sliceSize, size - pos))) {
+			req->error = "Couldn't read file";
+			return;
+		}
+	}
+	if (req->cancelled) {
+		return;
+	}
+
+	switch (req->codec) {
+	case ASYNC_CODEC_NONE:
+		req->result = std::move(raw);
+		break;
+	case ASYNC_CODEC_DEFLATE:
+		if (!InflateAll(raw, req->result, req->cancelled)) {
+			req->result.clear();
+			req->error = "Invalid or corrupt data";
+		}
+		break;
+	case ASYNC_CODEC_ZSTD:
+		if (auto out = DecompressZstandard(gsl::as_bytes(gsl::make_span(raw.data(), raw.size())))) {
+			req->result.assign(out->data(), out->size());
+		} else {
+			req->error = "Invalid or corrupt data";
+		}
+		break;
+	}
+}
+
+void ui_asyncFile_c::ProcessWrite(ui_asyncFileReq_s* req)
+{
+	// Replacing writes go through a temporary file so an interrupted save never leaves a truncated file behind
+	std::filesystem::path target = req->path;
+	std::filesystem::path outPath = req->append ? target : std::filesystem::path(target).concat(".tmp");
+	{
+		std::ofstream out(outPath, std::ios::binary | (req->append ? std::ios::app : std::ios::trunc));
+		if (!out) {
+			req->error = "Couldn't open file for writing";
+			return;
+		}
+		out.write(req->data, req->dataLen);
+		out.close();
+		if (!out) {
+			req->error = "Couldn't write file";
+			return;
+		}
+	}
+	if (!req->append) {
+		std::error_code ec;
+		if (req->cancelled) {
+			std::filesystem::remove(outPath, ec);
+			return;
+		}
+		std::filesystem::rename(outPath, target, ec);
+		if (ec) {
+			std::filesystem::remove(outPath, ec);
+			req->error = "Couldn't replace file";
+		}
+	}
+}
+
+void ui_asyncFile_c::WorkerProc()
+{
+	std::unique_lock lock(mutex);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || !queue.empty(); });
+		if (queue.empty()) {
+			// Stopping, with every remaining write done
+			break;
+		}
+		ui_asyncFileReq_s* req = queue.front();
+		queue.pop_front();
+		req->status = ASYNC_STATUS_RUNNING;
+		lock.unlock();
+
+		if (!req->cancelled) {
+			if (req->write) {
+				ProcessWrite(req);
+			} else {
+				ProcessRead(req);
+			}
+		}
+
+		lock.lock();
+		req->status = ASYNC_STATUS_DONE;
+		completed.push_back(req);
+	}
+}
+
+// ===================
+// Main Thread Access
+// ===================
+
+dword ui_asyncFile_c::Submit(std::unique_ptr<ui_asyncFileReq_s> req)
+{
+	dword id = nextId++;
+	req->id = id;
+	{
+		std::lock_guard lock(mutex);
+		queue.push_back(req.get());
+		if (!worker.joinable()) {
+			worker = std::thread(&ui_asyncFile_c::WorkerProc, this);
+		}
+	}
+	requests.emplace(id, std::move(req));
+	wake.notify_one();
+	return id;
+}
+
+void ui_asyncFile_c::Release(ui_asyncFileReq_s* req)
+{
+	luaL_unref(ui->L, LUA_REGISTRYINDEX, req->callbackRef);
+	luaL_unref(ui->L, LUA_REGISTRYINDEX, req->dataRef);
+	requests.erase(req->id);
+}
+
+dword ui_asyncFile_c::Read(const std::filesystem::path& path, ui_asyncCodec_e codec, int callbackRef)
+{
+	auto req = std::make_unique<ui_asyncFileReq_s>();
+	req->path = path;
+	req->codec = codec;
+	req->callbackRef = callbackRef;
+	return Submit(std::move(req));
+}
+
+dword ui_asyncFile_c::Write(const std::filesystem::path& path, const char* data, size_t dataLen, int dataRef, bool append, int callbackRef)
+{
+	auto req = std::make_unique<ui_asyncFileReq_s>();
+	req->write = true;
+	req->append = append;
+	req->path = path;
+	req->data = data;
+	req->dataLen = dataLen;
+	req->dataRef = dataRef;
+	req->callbackRef = callbackRef;
+	return Submit(std::move(req));
+}
+
+bool ui_asyncFile_c::Cancel(dword id)
+{
+	auto it = requests.find(id);
+	if (it == requests.end() || it->second->cancelled) {
+		return false;
+	}
+	ui_asyncFileReq_s* req = it->second.get();
+	std::unique_lock lock(mutex);
+	if (req->status == ASYNC_STATUS_QUEUED) {
+		queue.erase(std::find(queue.begin(), queue.end(), req));
+		lock.unlock();
+		Release(req);
+	} else {
+		// Worker still owns it or it's awaiting delivery; it gets dropped once it comes back
+		req->cancelled = true;
+	}
+	return true;
+}
+
+ui_asyncStatus_e ui_asyncFile_c::GetStatus(dword id)
+{
+	auto it = requests.find(id);
+	if (it == requests.end() || it->second->cancelled) {
+		return ASYNC_STATUS_UNKNOWN;
+	}
+	std::lock_guard lock(mutex);
+	return it->second->status;
+}
+
+bool ui_asyncFile_c::HasPending()
+{
+	return !requests.empty();
+}
+
+void ui_asyncFile_c::AsyncFileFrame()
+{
+	std::vector<ui_asyncFileReq_s*> done;
+	{
+		std::lock_guard lock(mutex);
+		done.swap(completed);
+	}
+	for (ui_asyncFileReq_s* req : done) {
+		// Checked here rather than when swapping, as earlier callbacks may cancel later requests
+		if (!req->cancelled && req->callbackRef != LUA_NOREF) {
+			lua_State* L = ui->L;
+			lua_rawgeti(L, LUA_REGISTRYINDEX, req->callbackRef);
+			lua_pushlightuserdata(L, (void*)(uintptr_t)req->id);
+			int narg = 2;
+			if (!req->error.empty()) {
+				lua_pushnil(L);
+				lua_pushstring(L, req->error.c_str());
+				narg++;
+			} else if (req->write) {
+				lua_pushboolean(L, 1);
+			} else {
+				lua_pushlstring(L, req->result.data(), req->result.size());
+				req->result = {};
+			}
+			ui->PCall(narg, 0);
+		}
+		Release(req);
+	}
+}
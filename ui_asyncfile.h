@@ -0,0 +1,41 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// UI Async File Header
+//
+
+// =======
+// Classes
+// =======
+
+enum ui_asyncCodec_e {
+	ASYNC_CODEC_NONE,
+	ASYNC_CODEC_DEFLATE,	// zlib or gzip, detected from the header
+	ASYNC_CODEC_ZSTD,
+};
+
+enum ui_asyncStatus_e {
+	ASYNC_STATUS_UNKNOWN,	// Never issued, cancelled or already delivered
+	ASYNC_STATUS_QUEUED,
+	ASYNC_STATUS_RUNNING,
+	ASYNC_STATUS_DONE,		// Finished, callback runs on the next frame
+};
+
+// ==========
+// Interfaces
+// ==========
+
+// UI Async File Handler
+class ui_IAsyncFile {
+public:
+	static ui_IAsyncFile* GetHandle(class ui_main_c*);
+	static void FreeHandle(ui_IAsyncFile*);
+
+	// Callback and data references are registry references owned by the handler from here on
+	virtual dword	Read(const std::filesystem::path& path, ui_asyncCodec_e codec, int callbackRef) = 0;
+	virtual dword	Write(const std::filesystem::path& path, const char* data, size_t dataLen, int dataRef, bool append, int callbackRef) = 0;
+	virtual bool	Cancel(dword id) = 0;
+	virtual ui_asyncStatus_e GetStatus(dword id) = 0;
+	virtual bool	HasPending() = 0;
+	virtual void	AsyncFileFrame() = 0;
+};
@@ -6,35 +6,50 @@
 
 #include "ui_local.h"
 
+#include "luajit.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
 // =======
 // Classes
 // =======
 
-struct d_lineHit_s {
-	char* source;
-	char* name;
-	int		line;
-	int		count;
+struct d_hit_s {
+	std::string key;
+	int		count = 0;
 };
 
-struct d_callHit_s {
-	char* source;
-	char* name;
-	int		count;
-	int		lineHitNum;
-	int		lineHitSz;
-	d_lineHit_s* lineHits;
+struct d_sample_s {
+	int64_t	usec = 0;			// Since profiling started
+	int		stack = 0;			// Index into stacks
+	int		count = 0;
+};
+
+struct d_frame_s {
+	int64_t	startUsec = 0;
+	int64_t	endUsec = 0;
+	int		index = 0;
 };
 
 // ===================
 // ui_IDebug Interface
 // ===================
 
-class ui_debug_c : public ui_IDebug, public thread_c {
+class ui_debug_c : public ui_IDebug {
 public:
 	// Interface
 	void	SetProfiling(bool enable) override;
 	void	ToggleProfiling() override;
+	bool	IsProfiling() override;
+	void	AddPCallOverhead(double msec) override;
+	void	SetProfileOutput(std::optional<std::filesystem::path> base) override;
+	void	FrameBegin() override;
+	void	FrameEnd() override;
 
 	// Encapsulated
 	ui_debug_c(ui_main_c* ui);
@@ -42,24 +57,35 @@ public:
 
 	ui_main_c* ui = nullptr;
 
-	volatile bool	doRun = false;
-	volatile bool	isRunning = false;
-
-	volatile bool	profiling = false;
+	bool	profiling = false;
 
-	volatile bool	hookHold = false;
-	volatile bool	hookHolding = false;
+	// Filled in by the sampler, which LuaJIT runs on the main thread between instructions
+	int		sampleCount = 0;
+	int		vmStateSamples[128] = { };
+	std::unordered_map<std::string, int> stackIndex;	// Folded stack, root first, ending with the current line
+	std::vector<d_hit_s> stacks;						// Samples per folded stack
+	std::string sampleKey;
 
-	volatile int	lineHitNum = 0;
-	int		lineHitSz = 0;
-	d_lineHit_s* lineHits = nullptr;
+	// Timeline, only recorded when there is somewhere to write it
+	std::optional<std::filesystem::path> outputBase;
+	bool	recordTimeline = false;
+	std::chrono::steady_clock::time_point startTime;
+	int64_t	zoneStartNsec = 0;		// Zone clock at startTime
+	bool	zonesWereEnabled = false;
+	bool	allocWasSampling = false;
+	std::vector<d_sample_s> timeline;
+	std::vector<d_frame_s> frames;
+	std::optional<int64_t> frameStart;
+	int		frameIndex = 0;
 
-	volatile int	callHitNum = 0;
-	int		callHitSz = 0;
-	int		callHitInitCount = 0;
-	d_callHit_s* callHits = nullptr;
+	int		pcallCount = 0;			// Main thread only
+	double	pcallOverhead = 0.0;
 
-	void	ThreadProc();
+	void	Sample(lua_State* L, int samples, int vmstate);
+	void	PrintReport();
+	int64_t	Now();
+	void	WriteFolded(const std::filesystem::path& fileName);
+	void	WriteTrace(const std::filesystem::path& fileName);
 };
 
 ui_IDebug* ui_IDebug::GetHandle(ui_main_c* ui)
@@ -73,223 +99,330 @@ void ui_IDebug::FreeHandle(ui_IDebug* hnd)
 }
 
 ui_debug_c::ui_debug_c(ui_main_c* ui)
-	: thread_c(ui->sys), ui(ui)
+	: ui(ui)
 {
-	profiling = false;
+}
 
-	hookHold = false;
-	hookHolding = false;
+ui_debug_c::~ui_debug_c()
+{
+	if (profiling) {
+		luaJIT_profile_stop(ui->L);
+	}
+}
 
-	lineHitNum = 0;
-	lineHitSz = 16;
-	lineHits = new d_lineHit_s[lineHitSz];
+// ==============
+// UI Debug Class
+// ==============
 
-	callHitNum = 0;
-	callHitSz = 16;
-	callHitInitCount = 0;
-	callHits = new d_callHit_s[callHitSz];
+static void ProfileCallback(void* data, lua_State* L, int samples, int vmstate)
+{
+	((ui_debug_c*)data)->Sample(L, samples, vmstate);
+}
 
-	doRun = true;
-	ThreadStart();
+void ui_debug_c::Sample(lua_State* L, int samples, int vmstate)
+{
+	// One hash lookup per sample; splitting the stacks up for the report is left until profiling stops
+	size_t len;
+	const char* stack = luaJIT_profile_dumpstack(L, "pF;", -100, &len);
+	sampleKey.assign(stack, len);
+	const char* line = luaJIT_profile_dumpstack(L, "pl", 1, &len);
+	sampleKey.append(line, len);
+	auto it = stackIndex.find(sampleKey);
+	if (it == stackIndex.end()) {
+		it = stackIndex.emplace(sampleKey, (int)stacks.size()).first;
+		stacks.push_back({ sampleKey, 0 });
+	}
+	stacks[it->second].count += samples;
+	if (recordTimeline) {
+		timeline.push_back({ Now(), it->second, samples });
+	}
+	sampleCount += samples;
+	vmStateSamples[vmstate & 127] += samples;
 }
 
-ui_debug_c::~ui_debug_c()
+// Splits a folded stack into its function frames, leaving out the current line at the end
+static void SplitStack(const std::string& stack, std::vector<std::string>& funcs)
+{
+	funcs.clear();
+	size_t start = 0, end;
+	while ((end = stack.find(';', start)) != std::string::npos) {
+		funcs.emplace_back(stack, start, end - start);
+		start = end + 1;
+	}
+}
+
+static void SortHits(std::vector<d_hit_s>& hits, const std::unordered_map<std::string, int>& counts)
+{
+	hits.clear();
+	hits.reserve(counts.size());
+	for (auto& [key, count] : counts) {
+		hits.push_back({ key, count });
+	}
+	std::sort(hits.begin(), hits.end(), [](const d_hit_s& a, const d_hit_s& b) {
+		return a.count != b.count ? a.count > b.count : a.key < b.key;
+	});
+}
+
+void ui_debug_c::PrintReport()
 {
-	profiling = false;
-	while (lineHitNum || callHitNum);
-	doRun = false;
-	while (isRunning);
-	delete lineHits;
-	for (int i = 0; i < callHitInitCount; i++) {
-		delete callHits[i].lineHits;
+	if ( !sampleCount ) {
+		return;
+	}
+	auto pct = [this](int count) { return count * 100.0 / sampleCount; };
+
+	// Split each stack into its frames: functions root first, then the current line
+	std::unordered_map<std::string, int> lineSamples;
+	std::unordered_map<std::string, int> callSamples;
+	std::unordered_map<std::string, std::unordered_map<std::string, int>> callLineSamples;
+	std::vector<std::string> funcs;
+	for (auto& [stack, count] : stacks) {
+		SplitStack(stack, funcs);
+		const std::string line = stack.substr(stack.rfind(';') + 1);
+		const std::string leaf = funcs.empty() ? "?" : funcs.back();
+		lineSamples[line + " in '" + leaf + "'"] += count;
+
+		// Inclusive time, counting recursive functions once per sample
+		std::sort(funcs.begin(), funcs.end());
+		funcs.erase(std::unique(funcs.begin(), funcs.end()), funcs.end());
+		for (auto& func : funcs) {
+			callSamples[func] += count;
+		}
+		callLineSamples[leaf][line] += count;
+	}
+
+	std::vector<d_hit_s> hits;
+	static const struct {
+		int		state;
+		const char* name;
+	} vmStates[] = { { 'N', "compiled" }, { 'I', "interpreted" }, { 'C', "C code" }, { 'G', "GC" }, { 'J', "JIT compiler" } };
+	ui->sys->con->Printf("%d samples:", sampleCount);
+	for (auto& vmState : vmStates) {
+		if (vmStateSamples[vmState.state]) {
+			ui->sys->con->Printf(" %s %.1f%%", vmState.name, pct(vmStateSamples[vmState.state]));
+		}
+	}
+	ui->sys->con->Printf("\nHot lines:\n");
+	SortHits(hits, lineSamples);
+	for (size_t l = 0; l < hits.size() && l < 20; l++) {
+		ui->sys->con->Printf("%s: %d (%.1f%%)\n", hits[l].key.c_str(), hits[l].count, pct(hits[l].count));
+	}
+	ui->sys->con->Printf("Hot calls:\n");
+	SortHits(hits, callSamples);
+	std::vector<d_hit_s> lineHits;
+	for (size_t c = 0; c < hits.size() && c < 10; c++) {
+		ui->sys->con->Printf("%s: %d (%.1f%%)\n", hits[c].key.c_str(), hits[c].count, pct(hits[c].count));
+		SortHits(lineHits, callLineSamples[hits[c].key]);
+		for (size_t l = 0; l < lineHits.size() && l < 5; l++) {
+			ui->sys->con->Printf("\t%s: %d\n", lineHits[l].key.c_str(), lineHits[l].count);
+		}
 	}
-	delete callHits;
 }
 
 // ==============
-// UI Debug Class
+// Profile Export
 // ==============
 
-// Grab UI main pointer from the registry
-static ui_debug_c* GetDebugPtr(lua_State* L)
+int64_t ui_debug_c::Now()
 {
-	lua_rawgeti(L, LUA_REGISTRYINDEX, 0);
-	ui_main_c* ui = (ui_main_c*)lua_touserdata(L, -1);
-	lua_pop(L, 1);
-	return (ui_debug_c*)ui->debug;
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
 }
 
-static void debugHook(lua_State* L, lua_Debug* ar)
+void ui_debug_c::FrameBegin()
 {
-	ui_debug_c* d = GetDebugPtr(L);
-	d->hookHolding = true;
-	while (d->hookHold);
-	d->hookHolding = false;
+	if (recordTimeline) {
+		frameStart = Now();
+	}
 }
 
-static int lineComp(const void* aVoid, const void* bVoid)
+void ui_debug_c::FrameEnd()
 {
-	d_lineHit_s* a = (d_lineHit_s*)aVoid;
-	d_lineHit_s* b = (d_lineHit_s*)bVoid;
-	if (a->count == b->count) {
-		return 0;
-	}
-	else {
-		return a->count > b->count ? -1 : 1;
+	if (recordTimeline && frameStart) {
+		frames.push_back({ *frameStart, Now(), frameIndex++ });
+		frameStart.reset();
 	}
 }
 
-static int callComp(const void* aVoid, const void* bVoid)
+void ui_debug_c::WriteFolded(const std::filesystem::path& fileName)
 {
-	d_callHit_s* a = (d_callHit_s*)aVoid;
-	d_callHit_s* b = (d_callHit_s*)bVoid;
-	if (a->count == b->count) {
-		return 0;
+	// Stacks are rooted under their frame, with frames over twice the median time called out by number,
+	// so a flame graph shows where the time in slow frames went
+	int64_t slowUsec = INT64_MAX;
+	if ( !frames.empty() ) {
+		std::vector<int64_t> durations;
+		for (auto& frame : frames) {
+			durations.push_back(frame.endUsec - frame.startUsec);
+		}
+		std::nth_element(durations.begin(), durations.begin() + durations.size() / 2, durations.end());
+		slowUsec = durations[durations.size() / 2] * 2;
 	}
-	else {
-		return a->count > b->count ? -1 : 1;
+	std::unordered_map<std::string, int> folded;
+	size_t f = 0;
+	char root[64];
+	for (auto& sample : timeline) {
+		while (f < frames.size() && frames[f].endUsec < sample.usec) {
+			f++;
+		}
+		if (f == frames.size() || frames[f].startUsec > sample.usec) {
+			strcpy(root, "outside frame");
+		} else if (frames[f].endUsec - frames[f].startUsec > slowUsec) {
+			snprintf(root, sizeof(root), "slow frame %d (%.1f msec)", frames[f].index, (frames[f].endUsec - frames[f].startUsec) / 1000.0);
+		} else {
+			strcpy(root, "frame");
+		}
+		folded[std::string(root) + ";" + stacks[sample.stack].key] += sample.count;
+	}
+
+	std::vector<d_hit_s> lines;
+	for (auto& [key, count] : folded) {
+		lines.push_back({ key, count });
+	}
+	std::sort(lines.begin(), lines.end(), [](const d_hit_s& a, const d_hit_s& b) { return a.key < b.key; });
+	std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+	for (auto& line : lines) {
+		out << line.key << ' ' << line.count << '\n';
+	}
+	if ( !out ) {
+		ui->sys->con->Warning("couldn't write profile to '%s'", fileName.generic_u8string().c_str());
 	}
 }
 
-void ui_debug_c::ThreadProc()
+static void WriteJSONString(std::ostream& out, const std::string& str)
 {
-	isRunning = true;
-	while (doRun) {
-		ui->sys->Sleep(1);
-
-		if (profiling) {
-			if (!ui->inLua) {
-				continue;
-			}
-			hookHold = true;
-			lua_sethook(ui->L, &debugHook, LUA_MASKLINE, 0);
-			while (profiling && !hookHolding);
-			lua_sethook(ui->L, &debugHook, 0, 0);
-			if (!profiling) {
-				hookHold = false;
-				continue;
-			}
-			lua_Debug dbg;
-			memset(&dbg, 0, sizeof(dbg));
-			if (lua_getstack(ui->L, 0, &dbg) && lua_getinfo(ui->L, "Sln", &dbg) && dbg.source) {
-				int l;
-				for (l = 0; l < lineHitNum; l++) {
-					if (dbg.currentline == lineHits[l].line && !strcmp(dbg.source, lineHits[l].source)) {
-						if (dbg.name && !lineHits[l].name) {
-							lineHits[l].name = AllocString(dbg.name);
-						}
-						lineHits[l].count++;
-						break;
-					}
-				}
-				if (l == lineHitNum) {
-					if (lineHitNum == lineHitSz) {
-						lineHitSz <<= 1;
-						trealloc(lineHits, lineHitSz);
-					}
-					lineHits[l].source = AllocString(dbg.source);
-					lineHits[l].name = AllocString(dbg.name);
-					lineHits[l].line = dbg.currentline;
-					lineHits[l].count = 1;
-					lineHitNum++;
-				}
-				const char* funcSource = dbg.source;
-				const char* funcName = dbg.name;
-				if (funcName && lua_getstack(ui->L, 1, &dbg) && lua_getinfo(ui->L, "Sln", &dbg) && dbg.source) {
-					int c;
-					for (c = 0; c < callHitNum; c++) {
-						if (!strcmp(funcSource, callHits[c].source) && !strcmp(funcName, callHits[c].name)) {
-							callHits[c].count++;
-							break;
-						}
-					}
-					if (c == callHitNum) {
-						if (callHitNum == callHitSz) {
-							callHitSz <<= 1;
-							trealloc(callHits, callHitSz);
-						}
-						if (callHitNum == callHitInitCount) {
-							callHits[c].lineHitSz = 16;
-							callHits[c].lineHits = new d_lineHit_s[16];
-							callHitInitCount++;
-						}
-						callHits[c].source = AllocString(funcSource);
-						callHits[c].name = AllocString(funcName);
-						callHits[c].count = 1;
-						callHits[c].lineHitNum = 0;
-						callHitNum++;
-					}
-					d_callHit_s* call = callHits + c;
-					int l;
-					for (l = 0; l < call->lineHitNum; l++) {
-						if (dbg.currentline == call->lineHits[l].line && !strcmp(dbg.source, call->lineHits[l].source)) {
-							if (dbg.name && !call->lineHits[l].name) {
-								call->lineHits[l].name = AllocString(dbg.name);
-							}
-							call->lineHits[l].count++;
-							break;
-						}
-					}
-					if (l == call->lineHitNum) {
-						if (call->lineHitNum == call->lineHitSz) {
-							call->lineHitSz <<= 1;
-							trealloc(call->lineHits, call->lineHitSz);
-						}
-						call->lineHits[l].source = AllocString(dbg.source);
-						call->lineHits[l].name = AllocString(dbg.name);
-						call->lineHits[l].line = dbg.currentline;
-						call->lineHits[l].count = 1;
-						call->lineHitNum++;
-					}
-				}
-			}
-			hookHold = false;
-			while (hookHolding);
+	out << '"';
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		} else if ((unsigned char)c < 0x20) {
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			out << esc;
+		} else {
+			out << c;
 		}
-		else if (lineHitNum) {
-			ui->sys->con->Printf("Hot lines:\n");
-			qsort(lineHits, lineHitNum, sizeof(d_lineHit_s), lineComp);
-			for (int l = 0; l < lineHitNum; l++) {
-				if (l < 20) {
-					ui->sys->con->Printf("%s(%d) in '%s': %d\n", lineHits[l].source, lineHits[l].line, lineHits[l].name ? lineHits[l].name : "?", lineHits[l].count);
-				}
-				delete lineHits[l].source;
-				delete lineHits[l].name;
-			}
-			lineHitNum = 0;
-			ui->sys->con->Printf("Hot calls:\n");
-			qsort(callHits, callHitNum, sizeof(d_callHit_s), callComp);
-			for (int c = 0; c < callHitNum; c++) {
-				qsort(callHits[c].lineHits, callHits[c].lineHitNum, sizeof(d_lineHit_s), lineComp);
-				if (c < 10) {
-					ui->sys->con->Printf("%s in '%s': %d\n", callHits[c].source, callHits[c].name, callHits[c].count);
-				}
-				for (int l = 0; l < callHits[c].lineHitNum; l++) {
-					if (c < 10 && l < 5) {
-						ui->sys->con->Printf("\t%s(%d) in '%s': %d\n", callHits[c].lineHits[l].source, callHits[c].lineHits[l].line, callHits[c].lineHits[l].name ? callHits[c].lineHits[l].name : "?", callHits[c].lineHits[l].count);
-					}
-					delete callHits[c].lineHits[l].source;
-					delete callHits[c].lineHits[l].name;
-				}
-				delete callHits[c].source;
-				delete callHits[c].name;
-			}
-			callHitNum = 0;
+	}
+	out << '"';
+}
+
+void ui_debug_c::WriteTrace(const std::filesystem::path& fileName)
+{
+	// Chrome trace event format: frames on one track, and the sampled stacks turned into nested spans on another
+	// A span ends when a sample no longer has its function at that depth, or when sampling pauses
+	std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+	out << "{\"traceEvents\":[\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Frames\"}},\n";
+	out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"Lua\"}}";
+	for (auto& frame : frames) {
+		out << ",\n{\"name\":\"Frame " << frame.index << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << frame.startUsec << ",\"dur\":" << frame.endUsec - frame.startUsec << "}";
+	}
+
+	// Native zones get a track per engine thread, sharing the timebase of the Lua samples
+	std::vector<zoneEvent_s> zones;
+	Zone_Collect(zones, zoneStartNsec);
+	std::set<unsigned int> zoneThreads;
+	for (auto& zone : zones) {
+		const unsigned int tid = 10 + zone.thread;
+		if (zoneThreads.insert(tid).second) {
+			out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":";
+			WriteJSONString(out, Zone_GetThreadName(zone.thread));
+			out << "}}";
 		}
+		out << ",\n{\"name\":";
+		WriteJSONString(out, zone.name);
+		out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << (zone.startNsec - zoneStartNsec) / 1000 << ",\"dur\":" << (zone.endNsec - zone.startNsec) / 1000 << "}";
+	}
+
+	const int64_t gapUsec = 2000;
+	std::vector<std::string> open, funcs;
+	int64_t lastUsec = 0;
+	auto closeTo = [&](size_t depth, int64_t usec) {
+		while (open.size() > depth) {
+			out << ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":2,\"ts\":" << usec << "}";
+			open.pop_back();
+		}
+	};
+	for (auto& sample : timeline) {
+		if ( !open.empty() && sample.usec - lastUsec > gapUsec ) {
+			closeTo(0, lastUsec + gapUsec / 2);
+		}
+		SplitStack(stacks[sample.stack].key, funcs);
+		size_t common = 0;
+		while (common < open.size() && common < funcs.size() && open[common] == funcs[common]) {
+			common++;
+		}
+		closeTo(common, sample.usec);
+		for (size_t d = common; d < funcs.size(); d++) {
+			out << ",\n{\"name\":";
+			WriteJSONString(out, funcs[d]);
+			out << ",\"ph\":\"B\",\"pid\":1,\"tid\":2,\"ts\":" << sample.usec << "}";
+			open.push_back(funcs[d]);
+		}
+		lastUsec = sample.usec;
+	}
+	closeTo(0, lastUsec + gapUsec / 2);
+	out << "\n]}\n";
+	if ( !out ) {
+		ui->sys->con->Warning("couldn't write profile to '%s'", fileName.generic_u8string().c_str());
 	}
-	isRunning = false;
 }
 
+// ==============
+// Profiler State
+// ==============
+
 void ui_debug_c::SetProfiling(bool enable)
 {
+	if (enable == profiling) {
+		return;
+	}
 	if (enable) {
 		ui->sys->con->Printf("Profiling enabled.\n");
+		pcallCount = 0;
+		pcallOverhead = 0.0;
+		sampleCount = 0;
+		memset(vmStateSamples, 0, sizeof(vmStateSamples));
+		stackIndex.clear();
+		stacks.clear();
+		recordTimeline = outputBase.has_value();
+		startTime = std::chrono::steady_clock::now();
+		zoneStartNsec = Zone_Now();
+		if (recordTimeline) {
+			// Native zones are exported alongside the Lua samples
+			zonesWereEnabled = Zone_IsEnabled();
+			Zone_Enable(true);
+		}
+		timeline.clear();
+		frames.clear();
+		frameStart.reset();
+		frameIndex = 0;
+		allocWasSampling = ui->allocTracker->IsSampling();
+		ui->allocTracker->SetSampling(true);
+		// Line level samples every millisecond
+		luaJIT_profile_start(ui->L, "li1", ProfileCallback, this);
 		profiling = true;
 	}
 	else {
 		ui->sys->con->Printf("Profiling finished:\n");
+		luaJIT_profile_stop(ui->L);
 		profiling = false;
-		while (lineHitNum || callHitNum);
+		PrintReport();
+		ui->allocTracker->PrintReport();
+		if (recordTimeline) {
+			auto foldedName = std::filesystem::path(*outputBase).concat(".folded");
+			auto allocName = std::filesystem::path(*outputBase).concat(".alloc.folded");
+			auto traceName = std::filesystem::path(*outputBase).concat(".json");
+			WriteFolded(foldedName);
+			ui->allocTracker->WriteFolded(allocName);
+			WriteTrace(traceName);
+			Zone_Enable(zonesWereEnabled);
+			ui->sys->con->Printf("Profile written to %s, %s and %s\n", foldedName.generic_u8string().c_str(), allocName.generic_u8string().c_str(), traceName.generic_u8string().c_str());
+			timeline = { };
+			frames = { };
+		}
+		outputBase.reset();
+		ui->allocTracker->SetSampling(allocWasSampling);
+		if (pcallCount) {
+			ui->sys->con->Printf("Callback overhead: %d calls, %.3f msec total, %.2f usec per call\n", pcallCount, pcallOverhead, pcallOverhead * 1000.0 / pcallCount);
+		}
 	}
 }
 
@@ -297,3 +430,21 @@ void ui_debug_c::ToggleProfiling()
 {
 	SetProfiling(!profiling);
 }
+
+bool ui_debug_c::IsProfiling()
+{
+	return profiling;
+}
+
+void ui_debug_c::AddPCallOverhead(double msec)
+{
+	pcallCount++;
+	pcallOverhead += msec;
+}
+
+void ui_debug_c::SetProfileOutput(std::optional<std::filesystem::path> base)
+{
+	if ( !profiling ) {
+		outputBase = std::move(base);
+	}
+}
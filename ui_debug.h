@@ -16,4 +16,11 @@ public:
 
 	virtual void	SetProfiling(bool enable) = 0;
 	virtual void	ToggleProfiling() = 0;
+	virtual bool	IsProfiling() = 0;
+	virtual void	AddPCallOverhead(double msec) = 0;
+	// When set, profiling also records a timeline and writes <base>.folded, <base>.alloc.folded and <base>.json when it stops
+	// Applies to the next session only: ignored while profiling, and cleared when profiling stops
+	virtual void	SetProfileOutput(std::optional<std::filesystem::path> base) = 0;
+	virtual void	FrameBegin() = 0;
+	virtual void	FrameEnd() = 0;
 };
\ No newline at end of file
@@ -15,8 +15,13 @@
 #define SOL_USING_CXX_LUAJIT 1
 #include <sol/sol.hpp>
 
+#include "ui_alloc.h"
+#include "ui_artslice.h"
+#include "ui_asyncfile.h"
 #include "ui_console.h"
 #include "ui_debug.h"
+#include "ui_modulecache.h"
+#include "ui_snapshot.h"
 #include "ui_subscript.h"
 
 #include "ui_main.h"
\ No newline at end of file
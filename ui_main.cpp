@@ -6,6 +6,8 @@
 
 #include "ui_local.h"
 
+#include <chrono>
+
 // ======
 // Locals
 // ======
@@ -148,32 +150,77 @@ int ui_main_c::PushCallback(const char* name)
 
 void ui_main_c::PCall(int narg, int nret)
 {
-	sys->SetWorkDir(scriptWorkDir);
+	ZONE("Lua PCall");
+	using clock = std::chrono::steady_clock;
+	const bool timing = debug->IsProfiling();
+	clock::time_point start, callStart, callEnd;
+	if (timing) {
+		start = clock::now();
+	}
+
+	// Outside of Lua the working directory is the base path, so it only needs switching if the script's differs
+	if (scriptWorkDir.native() != sys->basePath.native()) {
+		sys->SetWorkDir(scriptWorkDir);
+	}
 	inLua = true;
-	hasActiveCoroutine = false;
+	if (timing) {
+		callStart = clock::now();
+	}
 	int err = lua_pcall(L, narg, nret, 1);
-	lua_getglobal(L, "coroutine");
-	lua_getfield(L, -1, "_list");
-	lua_pcall(L, 0, 1, 0);
-
-	if (lua_istable(L, -1)) {
-		lua_pushnil(L);
-		while (lua_next(L, -2)) {
-			lua_State* co = lua_tothread(L, -2);
-			if (co && lua_status(co) == LUA_YIELD) {
-				hasActiveCoroutine = true;
-			}
-			lua_pop(L, 1);
-		}
+	if (timing) {
+		callEnd = clock::now();
 	}
-	lua_pop(L, 2);
 	inLua = false;
-	sys->SetWorkDir();
+	if (scriptWorkDir.native() != sys->basePath.native()) {
+		sys->SetWorkDir();
+	}
+
+	if (timing) {
+		debug->AddPCallOverhead(std::chrono::duration<double, std::milli>((callStart - start) + (clock::now() - callEnd)).count());
+	}
 	if (err && !didExit) {
 		DoError("Runtime error in", lua_tostring(L, -1));
 	}
 }
 
+bool ui_main_c::HasActiveCoroutine()
+{
+	if (!L || suspendedCoroutines <= 0) {
+		return false;
+	}
+	// Coroutines abandoned while suspended never pass through resume again, but drop out of the weak table when collected
+	lua_getfield(L, LUA_REGISTRYINDEX, "uisuspendedcoroutines");
+	lua_pushnil(L);
+	if (!lua_next(L, -2)) {
+		lua_pop(L, 1);
+		suspendedCoroutines = 0;
+		return false;
+	}
+	lua_pop(L, 3);
+
+	// Something is suspended, but only the coroutines the script lists in coroutine._list keep frames running
+	bool active = false;
+	lua_getglobal(L, "coroutine");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, "_list");
+		if (lua_isfunction(L, -1) && lua_pcall(L, 0, 1, 0) == 0 && lua_istable(L, -1)) {
+			lua_pushnil(L);
+			while (lua_next(L, -2)) {
+				lua_State* co = lua_tothread(L, -2);
+				lua_pop(L, 1);
+				if (co && lua_status(co) == LUA_YIELD) {
+					active = true;
+					lua_pop(L, 1);
+					break;
+				}
+			}
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	return active;
+}
+
 void ui_main_c::DoError(const char* msg, const char* error)
 {
 	auto scriptStr = scriptName.generic_u8string();
@@ -246,6 +293,9 @@ void ui_main_c::Init(int argc, char** argv)
 		scriptCfg.clear();
 	}
 
+	// Create module cache, shared by every script instance until shutdown
+	moduleCache = ui_IModuleCache::GetHandle(this);
+
 	// Initialise script
 	ScriptInit();
 	while (restartFlag && !didExit) {
@@ -292,6 +342,7 @@ void ui_main_c::ScriptInit()
 	didExit = false;
 	renderEnable = false;
 	inLua = false;
+	suspendedCoroutines = 0;
 
 	// Initialise Lua
 	sys->con->Printf("Initialising Lua...\n");
@@ -299,6 +350,8 @@ void ui_main_c::ScriptInit()
 	L = solState->lua_state();
 	if ( !L ) sys->Error("Error: unable to create Lua state.");
 	lua_atpanic(L, l_panicFunc);
+	allocTracker = ui_IAllocTracker::GetHandle(this);
+	allocTracker->Attach(L, "Main");
 	lua_pushlightuserdata(L, this);
 	lua_seti(L, LUA_REGISTRYINDEX, ui_main_c::REGISTRY_KEY);
 	lua_pushcfunction(L, traceback);
@@ -310,6 +363,9 @@ void ui_main_c::ScriptInit()
 	lua_setfield(L, LUA_REGISTRYINDEX, "LUA_NOENV");
 #endif
 
+	// Setup snapshot store, before the APIs and subscripts that read it
+	snapshots = ui_ISnapshots::GetHandle(this);
+
 	// Add libraries and APIs
 	lua_gc(L, LUA_GCSTOP, 0);
 	lua_pushcfunction(L, InitAPI);
@@ -320,7 +376,11 @@ void ui_main_c::ScriptInit()
 	// Setup debug system
 	debug = ui_IDebug::GetHandle(this);
 
+	// Setup async file system
+	asyncFile = ui_IAsyncFile::GetHandle(this);
+
 	// Setup subscript system
+	subScriptPool = ui_ISubScriptPool::GetHandle(this);
 	subScriptSize = 16;
 	subScriptList = new ui_ISubScript*[subScriptSize];
 	for (dword i = 0; i < subScriptSize; i++) {
@@ -328,6 +388,8 @@ void ui_main_c::ScriptInit()
 	}
 	
 	// Load the script file
+	moduleCache->TakeStats();
+	const int startTime = sys->GetTime();
 	sys->SetWorkDir(scriptWorkDir);
  	err = luaL_loadfile(L, scriptName.filename().generic_u8string().c_str());
 	if (err) {
@@ -355,6 +417,9 @@ void ui_main_c::ScriptInit()
 		if (extraArgs >= 0) {
 			PCall(extraArgs, 0);
 		}
+		ui_moduleCacheStats_s stats = moduleCache->TakeStats();
+		sys->con->Printf("Script initialised in %d msec, %d modules loaded in %.1f msec (%d from memory cache, %d from disk cache)\n",
+			sys->GetTime() - startTime, stats.loads, stats.loadMsec, stats.memoryHits, stats.diskHits);
 	}
 	if ( !didExit && !restartFlag ) {
 		// Check for frame callback
@@ -385,12 +450,16 @@ void ui_main_c::Frame()
 	else if (framesSinceWindowHidden <= 10) {
 		framesSinceWindowHidden++;
 	}
-	// Otherwise only runs frames if the mouse is on screen, there is an active coroutine, or there is an active subscript
-	else if (!sys->video->IsActive() && !sys->video->IsCursorOverWindow() && !hasActiveCoroutine && !hasSubscript) {
+	// Otherwise only runs frames if the mouse is on screen, there is an active coroutine, subscript or async file request
+	else if (!sys->video->IsActive() && !sys->video->IsCursorOverWindow() && !HasActiveCoroutine() && !hasSubscript && !asyncFile->HasPending()) {
 		sys->Sleep(100);
 		return;
 	}	
 	
+	ZONE("UI Frame");
+	debug->FrameBegin();
+	allocTracker->AllocFrame();
+
 	if (renderer) {
 		// Prepare for rendering
 		renderer->BeginFrame();
@@ -401,21 +470,33 @@ void ui_main_c::Frame()
 	renderEnable = true;
 
 	// Run subscript system
-	for (dword i = 0; i < subScriptSize; i++) {
-		if (subScriptList[i]) {
-			subScriptList[i]->SubScriptFrame();
-			if ( !subScriptList[i]->IsRunning() ) {
-				ui_ISubScript::FreeHandle(subScriptList[i]);
-				subScriptList[i] = NULL;
+	{
+		ZONE("Sub scripts");
+		for (dword i = 0; i < subScriptSize; i++) {
+			if (subScriptList[i]) {
+				subScriptList[i]->SubScriptFrame();
+				if ( !subScriptList[i]->IsRunning() ) {
+					ui_ISubScript::FreeHandle(subScriptList[i]);
+					subScriptList[i] = NULL;
+				}
 			}
 		}
 	}
 
+	// Deliver completed async file requests
+	{
+		ZONE("Async files");
+		asyncFile->AsyncFileFrame();
+	}
+
 	// Run script
 	//sys->con->Printf("OnFrame...\n");
-	int extraArgs = PushCallback("OnFrame");
-	if (extraArgs >= 0) {
-		PCall(extraArgs, 0);
+	{
+		ZONE("OnFrame");
+		int extraArgs = PushCallback("OnFrame");
+		if (extraArgs >= 0) {
+			PCall(extraArgs, 0);
+		}
 	}
 
 	renderEnable = false;
@@ -431,8 +512,10 @@ void ui_main_c::Frame()
 		renderer->EndFrame();
 	}
 
+	debug->FrameEnd();
+
 	//sys->con->Printf("Finishing up...\n");
-	if ( !sys->video->IsActive() && !hasActiveCoroutine && !hasSubscript ) {
+	if ( !sys->video->IsActive() && !HasActiveCoroutine() && !hasSubscript && !asyncFile->HasPending() ) {
 		sys->Sleep(100);
 	}
 
@@ -453,6 +536,10 @@ void ui_main_c::ScriptShutdown()
 		PCall(extraArgs, 0);
 	}
 
+	// Shutdown async file system, finishing outstanding writes and dropping reads
+	ui_IAsyncFile::FreeHandle(asyncFile);
+	asyncFile = nullptr;
+
 	// Shutdown subscript and debug systems
 	for (dword i = 0; i < subScriptSize; i++) {
 		if (subScriptList[i]) {
@@ -460,17 +547,28 @@ void ui_main_c::ScriptShutdown()
 		}
 	}
 	delete subScriptList;
+	ui_ISubScriptPool::FreeHandle(subScriptPool);
+	subScriptPool = nullptr;
 	ui_IDebug::FreeHandle(debug);
 
 	// Shutdown Lua
+	allocTracker->Detach(L);
 	L = NULL;
 	solState.reset();
+	ui_IAllocTracker::FreeHandle(allocTracker);
+	allocTracker = nullptr;
+
+	// Views still held by either side are gone, so the snapshots can go too
+	ui_ISnapshots::FreeHandle(snapshots);
+	snapshots = nullptr;
 }
 
 void ui_main_c::Shutdown()
 {
 	// Shutdown script
 	ScriptShutdown();
+	ui_IModuleCache::FreeHandle(moduleCache);
+	moduleCache = nullptr;
 
 	if (renderer) {
 		ui_IConsole::FreeHandle(conUI);
@@ -30,7 +30,13 @@ public:
 
 	ui_IConsole* conUI = nullptr;
 	ui_IDebug* debug = nullptr;
+	ui_IAllocTracker* allocTracker = nullptr;
 
+	ui_IAsyncFile* asyncFile = nullptr;
+	ui_IModuleCache* moduleCache = nullptr;
+	ui_ISnapshots* snapshots = nullptr;
+
+	ui_ISubScriptPool* subScriptPool = nullptr;
 	dword	subScriptSize = 0;
 	ui_ISubScript** subScriptList = nullptr;
 
@@ -49,10 +55,11 @@ public:
 	int		cursorY = 0;
 	int		framesSinceWindowHidden = 0;
 	volatile bool	inLua = false;
-	bool	hasActiveCoroutine = false;
+	int		suspendedCoroutines = 0;	// Upper bound, see HasActiveCoroutine()
 	int		ioOpenf = LUA_NOREF;
 
 	float lastColor[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	std::vector<float> drawBatchBuffer;	// Reused for unpacking DrawImageBatch tables
 
 	static int InitAPI(lua_State* L);
 
@@ -65,6 +72,7 @@ public:
 	int		IsUserData(lua_State* L, int index, const char* metaName);
 	int		PushCallback(const char* name);
 	void	PCall(int narg, int nret);
+	bool	HasActiveCoroutine();
 	void	DoError(const char* msg, const char* error);
 
 	void	CallKeyHandler(const char* hname, int key, bool dblclk);
@@ -0,0 +1,221 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// Module: UI Module Cache
+//
+
+#include "ui_local.h"
+
+#include <chrono>
+#include <fstream>
+#include <unordered_map>
+
+// =======
+// Classes
+// =======
+
+// Identifies one version of a source file; any change to either field invalidates the compiled chunk
+struct ui_moduleStamp_s {
+	int64_t	mtime = 0;
+	uint64_t size = 0;
+
+	bool operator==(const ui_moduleStamp_s& other) const
+	{
+		return mtime == other.mtime && size == other.size;
+	}
+};
+
+struct ui_moduleEntry_s {
+	ui_moduleStamp_s stamp;
+	std::string bytecode;
+};
+
+// On-disk cache file header, followed by the source path and then the bytecode
+struct ui_moduleDiskHeader_s {
+	char	magic[4] = { 'S', 'G', 'M', 'C' };
+	dword	version = 1;
+	ui_moduleStamp_s stamp;
+	dword	pathLen = 0;
+};
+
+// ==========================
+// ui_IModuleCache Interface
+// ==========================
+
+class ui_moduleCache_c: public ui_IModuleCache {
+public:
+	// Interface
+	int		Load(lua_State* L, const std::filesystem::path& fileName);
+	ui_moduleCacheStats_s TakeStats();
+
+	// Encapsulated
+	ui_moduleCache_c(ui_main_c* ui);
+
+	ui_main_c* ui = nullptr;
+	conVar_c* ui_moduleCache = nullptr;
+
+	std::unordered_map<std::string, ui_moduleEntry_s> entries;
+	ui_moduleCacheStats_s stats;
+
+	int		LoadCached(lua_State* L, const std::filesystem::path& fileName);
+	std::optional<std::filesystem::path> DiskPath(const std::string& key);
+	bool	ReadDisk(const std::string& key, const ui_moduleStamp_s& stamp, std::string& bytecode);
+	void	WriteDisk(const std::string& key, const ui_moduleStamp_s& stamp, const std::string& bytecode);
+};
+
+ui_IModuleCache* ui_IModuleCache::GetHandle(ui_main_c* ui)
+{
+	return new ui_moduleCache_c(ui);
+}
+
+void ui_IModuleCache::FreeHandle(ui_IModuleCache* hnd)
+{
+	delete (ui_moduleCache_c*)hnd;
+}
+
+ui_moduleCache_c::ui_moduleCache_c(ui_main_c* ui)
+	: ui(ui)
+{
+	ui_moduleCache = ui->sys->con->Cvar_Add("ui_moduleCache", CV_ARCHIVE | CV_CLAMP, "1", 0, 1);
+}
+
+// ===============
+// Disk Cache I/O
+// ===============
+
+std::optional<std::filesystem::path> ui_moduleCache_c::DiskPath(const std::string& key)
+{
+	if (!ui_moduleCache->intVal || !ui->sys->userPath) {
+		return {};
+	}
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.ljbc", (unsigned long long)std::hash<std::string>{}(key));
+	return *ui->sys->userPath / "SimpleGraphic" / "ModuleCache" / name;
+}
+
+bool ui_moduleCache_c::ReadDisk(const std::string& key, const ui_moduleStamp_s& stamp, std::string& bytecode)
+{
+	auto path = DiskPath(key);
+	if (!path) {
+		return false;
+	}
+	std::ifstream in(*path, std::ios::binary);
+	ui_moduleDiskHeader_s header, expected;
+	if (!in.read((char*)&header, sizeof(header))
+		|| memcmp(header.magic, expected.magic, sizeof(header.magic)) || header.version != expected.version
+		|| !(header.stamp == stamp) || header.pathLen != key.size()) {
+		return false;
+	}
+	std::string path8(key.size(), '\0');
+	if (!in.read(path8.data(), path8.size()) || path8 != key) {
+		return false;
+	}
+	bytecode.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return !bytecode.empty();
+}
+
+void ui_moduleCache_c::WriteDisk(const std::string& key, const ui_moduleStamp_s& stamp, const std::string& bytecode)
+{
+	auto path = DiskPath(key);
+	if (!path) {
+		return;
+	}
+	std::error_code ec;
+	std::filesystem::create_directories(path->parent_path(), ec);
+
+	// Written aside and renamed into place, so a reader never sees a partial file
+	auto tmpPath = std::filesystem::path(*path).concat(".tmp");
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		ui_moduleDiskHeader_s header;
+		header.stamp = stamp;
+		header.pathLen = (dword)key.size();
+		out.write((const char*)&header, sizeof(header));
+		out.write(key.data(), key.size());
+		out.write(bytecode.data(), bytecode.size());
+		out.close();
+		if (!out) {
+			std::filesystem::remove(tmpPath, ec);
+			return;
+		}
+	}
+	std::filesystem::rename(tmpPath, *path, ec);
+	if (ec) {
+		std::filesystem::remove(tmpPath, ec);
+	}
+}
+
+// ===============
+// Module Loading
+// ===============
+
+static int DumpWriter(lua_State* L, const void* p, size_t sz, void* ud)
+{
+	((std::string*)ud)->append((const char*)p, sz);
+	return 0;
+}
+
+int ui_moduleCache_c::LoadCached(lua_State* L, const std::filesystem::path& fileName)
+{
+	auto fileStr = fileName.generic_u8string();
+	auto fullPath = (ui->scriptPath / fileName).lexically_normal();
+	std::error_code ec;
+	auto mtime = std::filesystem::last_write_time(fullPath, ec);
+	uint64_t size = ec ? 0 : std::filesystem::file_size(fullPath, ec);
+	if (ec) {
+		// Let luaL_loadfile() produce the usual error
+		return luaL_loadfile(L, fileStr.c_str());
+	}
+	const std::string key = fullPath.generic_u8string();
+	const ui_moduleStamp_s stamp{ (int64_t)mtime.time_since_epoch().count(), size };
+	const std::string chunkName = "@" + fileStr;
+
+	// Bytecode that fails to load (e.g. from a different LuaJIT build) is discarded and rebuilt from source
+	auto it = entries.find(key);
+	if (it != entries.end() && it->second.stamp == stamp) {
+		const std::string& bytecode = it->second.bytecode;
+		if (luaL_loadbuffer(L, bytecode.data(), bytecode.size(), chunkName.c_str()) == 0) {
+			stats.memoryHits++;
+			return 0;
+		}
+		lua_pop(L, 1);
+	}
+
+	std::string bytecode;
+	if (ReadDisk(key, stamp, bytecode)) {
+		if (luaL_loadbuffer(L, bytecode.data(), bytecode.size(), chunkName.c_str()) == 0) {
+			entries[key] = { stamp, std::move(bytecode) };
+			stats.diskHits++;
+			return 0;
+		}
+		lua_pop(L, 1);
+		bytecode.clear();
+	}
+
+	int err = luaL_loadfile(L, fileStr.c_str());
+	if (err) {
+		entries.erase(key);
+		return err;
+	}
+	if (lua_dump(L, DumpWriter, &bytecode) == 0 && !bytecode.empty()) {
+		WriteDisk(key, stamp, bytecode);
+		entries[key] = { stamp, std::move(bytecode) };
+	}
+	return 0;
+}
+
+int ui_moduleCache_c::Load(lua_State* L, const std::filesystem::path& fileName)
+{
+	auto start = std::chrono::steady_clock::now();
+	int err = LoadCached(L, fileName);
+	stats.loads++;
+	stats.loadMsec += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return err;
+}
+
+ui_moduleCacheStats_s ui_moduleCache_c::TakeStats()
+{
+	ui_moduleCacheStats_s out = stats;
+	stats = {};
+	return out;
+}
@@ -0,0 +1,32 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// UI Module Cache Header
+//
+
+// =======
+// Classes
+// =======
+
+struct ui_moduleCacheStats_s {
+	int		loads = 0;
+	int		memoryHits = 0;
+	int		diskHits = 0;
+	double	loadMsec = 0.0;		// Total time spent in Load(), including compiles and cache I/O
+};
+
+// ==========
+// Interfaces
+// ==========
+
+// UI Module Cache Handler
+// Outlives individual Lua states so that compiled modules are reused across script restarts
+class ui_IModuleCache {
+public:
+	static ui_IModuleCache* GetHandle(class ui_main_c*);
+	static void FreeHandle(ui_IModuleCache*);
+
+	// Same contract as luaL_loadfile(), relative paths are resolved against the script path
+	virtual int		Load(lua_State* L, const std::filesystem::path& fileName) = 0;
+	virtual ui_moduleCacheStats_s TakeStats() = 0;	// Returns and resets the counters
+};
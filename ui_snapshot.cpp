@@ -0,0 +1,615 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// Module: UI Snapshot
+//
+
+#include "ui_local.h"
+
+#include <cmath>
+#include <mutex>
+#include <unordered_map>
+
+// =======
+// Classes
+// =======
+
+// Snapshot layout: the root value slot at offset 0, followed by table nodes and string bytes
+// A table node is a uint32 array count and a uint32 hash capacity (zero or a power of two),
+// then the array value slots and the open-addressed hash entries; empty entries have a nil key
+enum snapType_e : byte {
+	SNAP_NIL,
+	SNAP_BOOLEAN,		// Payload is 0 or 1
+	SNAP_NUMBER,		// Payload is the bits of a double
+	SNAP_STRING,		// Payload is the offset of the bytes
+	SNAP_TABLE,			// Payload is the offset of the table node
+};
+
+struct snapValue_s {
+	byte	type = SNAP_NIL;
+	byte	pad[3] = { };
+	dword	len = 0;			// String length
+	uint64_t payload = 0;
+};
+
+struct snapEntry_s {
+	snapValue_s key;
+	snapValue_s value;
+};
+
+struct ui_snapshot_s {
+	std::string buf;
+
+	template <class T>
+	T Read(size_t offset) const
+	{
+		T val;
+		memcpy(&val, buf.data() + offset, sizeof(T));
+		return val;
+	}
+};
+
+// Read-only view of one table inside a snapshot, as seen by Lua
+struct snapView_s {
+	std::shared_ptr<const ui_snapshot_s> snap;
+	dword	node = 0;
+};
+
+// ========================
+// ui_ISnapshots Interface
+// ========================
+
+class ui_snapshots_c: public ui_ISnapshots {
+public:
+	// Interface
+	bool	Publish(lua_State* L, const char* name, int index);
+	void	OpenLibrary(lua_State* L);
+
+	// Encapsulated
+	ui_snapshots_c(ui_main_c* ui);
+
+	ui_main_c* ui = nullptr;
+
+	std::mutex mutex;
+	std::unordered_map<std::string, std::shared_ptr<const ui_snapshot_s>> snapshots;	// Guarded by mutex
+
+	std::shared_ptr<const ui_snapshot_s> Get(const char* name);
+};
+
+ui_ISnapshots* ui_ISnapshots::GetHandle(ui_main_c* ui)
+{
+	return new ui_snapshots_c(ui);
+}
+
+void ui_ISnapshots::FreeHandle(ui_ISnapshots* hnd)
+{
+	delete (ui_snapshots_c*)hnd;
+}
+
+ui_snapshots_c::ui_snapshots_c(ui_main_c* ui)
+	: ui(ui)
+{
+}
+
+// =======
+// Hashing
+// =======
+
+static uint64_t SnapHashBytes(const char* str, size_t len)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ (byte)str[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t SnapHashBits(uint64_t bits)
+{
+	// SplitMix64 finaliser
+	bits = (bits ^ (bits >> 30)) * 0xBF58476D1CE4E5B9ull;
+	bits = (bits ^ (bits >> 27)) * 0x94D049BB133111EBull;
+	return bits ^ (bits >> 31);
+}
+
+static uint64_t SnapNumberBits(double num)
+{
+	if (num == 0) {
+		num = 0;	// Fold -0 into 0
+	}
+	uint64_t bits;
+	memcpy(&bits, &num, sizeof(bits));
+	return bits;
+}
+
+// ================
+// Snapshot Builder
+// ================
+
+class snapBuilder_c {
+public:
+	snapBuilder_c(lua_State* L, std::string& buf)
+		: L(L), buf(buf) { }
+
+	bool	Build(int index);
+
+	char	error[128] = { };
+
+private:
+	lua_State* L;
+	std::string& buf;
+	std::unordered_map<const void*, dword> tables;
+	std::unordered_map<std::string, dword> strings;
+	int		depth = 0;
+
+	bool	Encode(int index, snapValue_s& out);
+	bool	WriteTable(int index, dword& node);
+	bool	Reserve(size_t size, dword& offset);
+	uint64_t HashKey(const snapValue_s& key) const;
+};
+
+bool snapBuilder_c::Reserve(size_t size, dword& offset)
+{
+	// Nodes are kept 8 byte aligned, strings are packed in between
+	size_t start = (buf.size() + 7) & ~(size_t)7;
+	if (start + size > UINT32_MAX) {
+		snprintf(error, sizeof(error), "snapshot exceeds 4GB");
+		return false;
+	}
+	buf.resize(start + size);
+	offset = (dword)start;
+	return true;
+}
+
+uint64_t snapBuilder_c::HashKey(const snapValue_s& key) const
+{
+	if (key.type == SNAP_STRING) {
+		return SnapHashBytes(buf.data() + key.payload, key.len);
+	}
+	return SnapHashBits(key.payload ^ key.type);
+}
+
+bool snapBuilder_c::Encode(int index, snapValue_s& out)
+{
+	out = { };
+	switch (lua_type(L, index)) {
+	case LUA_TNIL:
+		return true;
+	case LUA_TBOOLEAN:
+		out.type = SNAP_BOOLEAN;
+		out.payload = lua_toboolean(L, index) ? 1 : 0;
+		return true;
+	case LUA_TNUMBER:
+		out.type = SNAP_NUMBER;
+		out.payload = SnapNumberBits(lua_tonumber(L, index));
+		return true;
+	case LUA_TSTRING: {
+		// Identical strings, mostly keys, are stored once
+		size_t len;
+		const char* str = lua_tolstring(L, index, &len);
+		auto it = strings.find(std::string(str, len));
+		if (it == strings.end()) {
+			if (buf.size() + len > UINT32_MAX) {
+				snprintf(error, sizeof(error), "snapshot exceeds 4GB");
+				return false;
+			}
+			it = strings.emplace(std::string(str, len), (dword)buf.size()).first;
+			buf.append(str, len);
+		}
+		out.type = SNAP_STRING;
+		out.len = (dword)len;
+		out.payload = it->second;
+		return true;
+	}
+	case LUA_TTABLE: {
+		dword node;
+		if ( !WriteTable(index, node) ) {
+			return false;
+		}
+		out.type = SNAP_TABLE;
+		out.payload = node;
+		return true;
+	}
+	default:
+		snprintf(error, sizeof(error), "%s values can't be stored in a snapshot", luaL_typename(L, index));
+		return false;
+	}
+}
+
+bool snapBuilder_c::WriteTable(int index, dword& node)
+{
+	// Tables are written once, so shared and cyclic references point at the same node
+	const void* ptr = lua_topointer(L, index);
+	auto it = tables.find(ptr);
+	if (it != tables.end()) {
+		node = it->second;
+		return true;
+	}
+	if (depth >= 200 || !lua_checkstack(L, 4)) {
+		snprintf(error, sizeof(error), "tables nested deeper than %d levels can't be stored in a snapshot", depth);
+		return false;
+	}
+
+	const size_t arrayCount = lua_objlen(L, index);
+	auto isArrayKey = [&](int keyIndex) {
+		if (lua_type(L, keyIndex) != LUA_TNUMBER) {
+			return false;
+		}
+		double key = lua_tonumber(L, keyIndex);
+		return key >= 1 && key <= arrayCount && key == floor(key);
+	};
+	size_t hashCount = 0;
+	lua_pushnil(L);
+	while (lua_next(L, index)) {
+		lua_pop(L, 1);
+		int keyType = lua_type(L, -1);
+		if (keyType != LUA_TSTRING && keyType != LUA_TNUMBER && keyType != LUA_TBOOLEAN) {
+			snprintf(error, sizeof(error), "%s keys can't be stored in a snapshot", luaL_typename(L, -1));
+			lua_pop(L, 1);
+			return false;
+		}
+		if ( !isArrayKey(-1) ) {
+			hashCount++;
+		}
+	}
+	size_t hashCap = 0;
+	if (hashCount) {
+		// Kept at most half full
+		for (hashCap = 2; hashCap < hashCount * 2; hashCap <<= 1);
+	}
+	if ( !Reserve(sizeof(dword) * 2 + arrayCount * sizeof(snapValue_s) + hashCap * sizeof(snapEntry_s), node) ) {
+		return false;
+	}
+	tables.emplace(ptr, node);
+	depth++;
+
+	const dword header[2] = { (dword)arrayCount, (dword)hashCap };
+	memcpy(buf.data() + node, header, sizeof(header));
+	const size_t arrayStart = node + sizeof(header);
+	const size_t hashStart = arrayStart + arrayCount * sizeof(snapValue_s);
+
+	for (size_t i = 0; i < arrayCount; i++) {
+		lua_rawgeti(L, index, (int)i + 1);
+		snapValue_s val;
+		bool ok = Encode(lua_gettop(L), val);
+		lua_pop(L, 1);
+		if ( !ok ) {
+			return false;
+		}
+		memcpy(buf.data() + arrayStart + i * sizeof(snapValue_s), &val, sizeof(val));
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, index)) {
+		if (isArrayKey(-2)) {
+			lua_pop(L, 1);
+			continue;
+		}
+		snapEntry_s entry;
+		if ( !Encode(lua_gettop(L) - 1, entry.key) || !Encode(lua_gettop(L), entry.value) ) {
+			lua_pop(L, 2);
+			return false;
+		}
+		lua_pop(L, 1);
+		size_t slot = HashKey(entry.key) & (hashCap - 1);
+		while (buf[hashStart + slot * sizeof(snapEntry_s)] != SNAP_NIL) {
+			slot = (slot + 1) & (hashCap - 1);
+		}
+		memcpy(buf.data() + hashStart + slot * sizeof(snapEntry_s), &entry, sizeof(entry));
+	}
+
+	depth--;
+	return true;
+}
+
+bool snapBuilder_c::Build(int index)
+{
+	dword root;
+	Reserve(sizeof(snapValue_s), root);
+	snapValue_s val;
+	if ( !Encode(index, val) ) {
+		return false;
+	}
+	memcpy(buf.data() + root, &val, sizeof(val));
+	return true;
+}
+
+// ===============
+// Snapshot Access
+// ===============
+
+static void SnapPushValue(lua_State* L, const std::shared_ptr<const ui_snapshot_s>& snap, const snapValue_s& val)
+{
+	switch (val.type) {
+	case SNAP_BOOLEAN:
+		lua_pushboolean(L, (int)val.payload);
+		break;
+	case SNAP_NUMBER: {
+		double num;
+		memcpy(&num, &val.payload, sizeof(num));
+		lua_pushnumber(L, num);
+		break;
+	}
+	case SNAP_STRING:
+		lua_pushlstring(L, snap->buf.data() + val.payload, val.len);
+		break;
+	case SNAP_TABLE: {
+		snapView_s* view = new(lua_newuserdata(L, sizeof(snapView_s))) snapView_s();
+		view->snap = snap;
+		view->node = (dword)val.payload;
+		lua_getfield(L, LUA_REGISTRYINDEX, "uisnapshotviewmeta");
+		lua_setmetatable(L, -2);
+		break;
+	}
+	default:
+		lua_pushnil(L);
+		break;
+	}
+}
+
+// Looks up the Lua value at keyIndex in a table node, returning false if it isn't present
+static bool SnapLookup(lua_State* L, const ui_snapshot_s& snap, dword node, int keyIndex, snapValue_s& out)
+{
+	const dword arrayCount = snap.Read<dword>(node);
+	const dword hashCap = snap.Read<dword>(node + sizeof(dword));
+	const size_t arrayStart = node + sizeof(dword) * 2;
+	const size_t hashStart = arrayStart + (size_t)arrayCount * sizeof(snapValue_s);
+
+	snapValue_s key;
+	uint64_t hash;
+	size_t len = 0;
+	const char* str = nullptr;
+	switch (lua_type(L, keyIndex)) {
+	case LUA_TNUMBER: {
+		double num = lua_tonumber(L, keyIndex);
+		if (num >= 1 && num <= arrayCount && num == floor(num)) {
+			out = snap.Read<snapValue_s>(arrayStart + ((size_t)num - 1) * sizeof(snapValue_s));
+			return out.type != SNAP_NIL;
+		}
+		key.type = SNAP_NUMBER;
+		key.payload = SnapNumberBits(num);
+		hash = SnapHashBits(key.payload ^ key.type);
+		break;
+	}
+	case LUA_TBOOLEAN:
+		key.type = SNAP_BOOLEAN;
+		key.payload = lua_toboolean(L, keyIndex) ? 1 : 0;
+		hash = SnapHashBits(key.payload ^ key.type);
+		break;
+	case LUA_TSTRING:
+		str = lua_tolstring(L, keyIndex, &len);
+		key.type = SNAP_STRING;
+		hash = SnapHashBytes(str, len);
+		break;
+	default:
+		return false;
+	}
+	if ( !hashCap ) {
+		return false;
+	}
+
+	for (size_t slot = hash & (hashCap - 1); ; slot = (slot + 1) & (hashCap - 1)) {
+		const size_t entryPos = hashStart + slot * sizeof(snapEntry_s);
+		snapValue_s entryKey = snap.Read<snapValue_s>(entryPos);
+		if (entryKey.type == SNAP_NIL) {
+			return false;
+		}
+		if (entryKey.type != key.type) {
+			continue;
+		}
+		bool match = key.type == SNAP_STRING
+			? entryKey.len == len && !memcmp(snap.buf.data() + entryKey.payload, str, len)
+			: entryKey.payload == key.payload;
+		if (match) {
+			out = snap.Read<snapValue_s>(entryPos + sizeof(snapValue_s));
+			return true;
+		}
+	}
+}
+
+// ===================
+// Lua Snapshot Views
+// ===================
+
+static snapView_s* GetSnapView(lua_State* L, int index)
+{
+	return (snapView_s*)luaL_checkudata(L, index, "uisnapshotviewmeta");
+}
+
+static int l_snapViewIndex(lua_State* L)
+{
+	snapView_s* view = GetSnapView(L, 1);
+	snapValue_s val;
+	if (SnapLookup(L, *view->snap, view->node, 2, val)) {
+		SnapPushValue(L, view->snap, val);
+	} else {
+		lua_pushnil(L);
+	}
+	return 1;
+}
+
+static int l_snapViewNewIndex(lua_State* L)
+{
+	return luaL_error(L, "snapshots are read-only");
+}
+
+static int l_snapViewLen(lua_State* L)
+{
+	snapView_s* view = GetSnapView(L, 1);
+	lua_pushinteger(L, view->snap->Read<dword>(view->node));
+	return 1;
+}
+
+static int l_snapViewGC(lua_State* L)
+{
+	snapView_s* view = GetSnapView(L, 1);
+	view->~snapView_s();
+	return 0;
+}
+
+static int l_snapViewPairsNext(lua_State* L)
+{
+	// Upvalues are the view and the position of the next slot, counting array slots then hash entries
+	snapView_s* view = (snapView_s*)lua_touserdata(L, lua_upvalueindex(1));
+	const ui_snapshot_s& snap = *view->snap;
+	const dword arrayCount = snap.Read<dword>(view->node);
+	const dword hashCap = snap.Read<dword>(view->node + sizeof(dword));
+	const size_t arrayStart = view->node + sizeof(dword) * 2;
+	const size_t hashStart = arrayStart + (size_t)arrayCount * sizeof(snapValue_s);
+	size_t pos = (size_t)lua_tonumber(L, lua_upvalueindex(2));
+	for ( ; pos < arrayCount; pos++) {
+		snapValue_s val = snap.Read<snapValue_s>(arrayStart + pos * sizeof(snapValue_s));
+		if (val.type != SNAP_NIL) {
+			lua_pushnumber(L, (lua_Number)(pos + 1));
+			lua_replace(L, lua_upvalueindex(2));
+			lua_pushinteger(L, pos + 1);
+			SnapPushValue(L, view->snap, val);
+			return 2;
+		}
+	}
+	for ( ; pos < arrayCount + (size_t)hashCap; pos++) {
+		snapEntry_s entry = snap.Read<snapEntry_s>(hashStart + (pos - arrayCount) * sizeof(snapEntry_s));
+		if (entry.key.type != SNAP_NIL) {
+			lua_pushnumber(L, (lua_Number)(pos + 1));
+			lua_replace(L, lua_upvalueindex(2));
+			SnapPushValue(L, view->snap, entry.key);
+			SnapPushValue(L, view->snap, entry.value);
+			return 2;
+		}
+	}
+	lua_pushnumber(L, (lua_Number)pos);
+	lua_replace(L, lua_upvalueindex(2));
+	return 0;
+}
+
+static int l_SnapshotPairs(lua_State* L)
+{
+	GetSnapView(L, 1);
+	lua_settop(L, 1);
+	lua_pushnumber(L, 0);
+	lua_pushcclosure(L, l_snapViewPairsNext, 2);
+	return 1;
+}
+
+static void SnapPushTable(lua_State* L, const ui_snapshot_s& snap, const std::shared_ptr<const ui_snapshot_s>& snapPtr, dword node, int tables);
+
+static void SnapPushCopy(lua_State* L, const std::shared_ptr<const ui_snapshot_s>& snap, const snapValue_s& val, int tables)
+{
+	if (val.type == SNAP_TABLE) {
+		SnapPushTable(L, *snap, snap, (dword)val.payload, tables);
+	} else {
+		SnapPushValue(L, snap, val);
+	}
+}
+
+static void SnapPushTable(lua_State* L, const ui_snapshot_s& snap, const std::shared_ptr<const ui_snapshot_s>& snapPtr, dword node, int tables)
+{
+	// Tables copied so far are kept by node offset, so shared and cyclic references survive the copy
+	lua_rawgeti(L, tables, (int)node);
+	if ( !lua_isnil(L, -1) ) {
+		return;
+	}
+	lua_pop(L, 1);
+	lua_checkstack(L, 4);
+	const dword arrayCount = snap.Read<dword>(node);
+	const dword hashCap = snap.Read<dword>(node + sizeof(dword));
+	const size_t arrayStart = node + sizeof(dword) * 2;
+	const size_t hashStart = arrayStart + (size_t)arrayCount * sizeof(snapValue_s);
+	lua_createtable(L, (int)arrayCount, (int)hashCap / 2);
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, tables, (int)node);
+	for (dword i = 0; i < arrayCount; i++) {
+		SnapPushCopy(L, snapPtr, snap.Read<snapValue_s>(arrayStart + i * sizeof(snapValue_s)), tables);
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+	for (dword i = 0; i < hashCap; i++) {
+		snapEntry_s entry = snap.Read<snapEntry_s>(hashStart + i * sizeof(snapEntry_s));
+		if (entry.key.type != SNAP_NIL) {
+			SnapPushValue(L, snapPtr, entry.key);
+			SnapPushCopy(L, snapPtr, entry.value, tables);
+			lua_rawset(L, -3);
+		}
+	}
+}
+
+static int l_SnapshotToTable(lua_State* L)
+{
+	snapView_s* view = GetSnapView(L, 1);
+	lua_newtable(L);
+	int tables = lua_gettop(L);
+	SnapPushTable(L, *view->snap, view->snap, view->node, tables);
+	return 1;
+}
+
+static int l_GetSnapshot(lua_State* L)
+{
+	ui_snapshots_c* store = (ui_snapshots_c*)lua_touserdata(L, lua_upvalueindex(1));
+	if ( !lua_isstring(L, 1) ) {
+		return luaL_error(L, "GetSnapshot() argument 1: expected string, got %s", luaL_typename(L, 1));
+	}
+	auto snap = store->Get(lua_tostring(L, 1));
+	if ( !snap ) {
+		lua_pushnil(L);
+		return 1;
+	}
+	SnapPushValue(L, snap, snap->Read<snapValue_s>(0));
+	return 1;
+}
+
+// ==============
+// Snapshot Store
+// ==============
+
+bool ui_snapshots_c::Publish(lua_State* L, const char* name, int index)
+{
+	std::shared_ptr<ui_snapshot_s> snap;
+	if ( !lua_isnil(L, index) ) {
+		snap = std::make_shared<ui_snapshot_s>();
+		snapBuilder_c builder(L, snap->buf);
+		if ( !builder.Build(index) ) {
+			lua_pushstring(L, builder.error);
+			return false;
+		}
+	}
+
+	// Readers holding views of the previous version keep it alive until they let go
+	std::lock_guard lock(mutex);
+	if (snap) {
+		snapshots[name] = std::move(snap);
+	} else {
+		snapshots.erase(name);
+	}
+	return true;
+}
+
+std::shared_ptr<const ui_snapshot_s> ui_snapshots_c::Get(const char* name)
+{
+	std::lock_guard lock(mutex);
+	auto it = snapshots.find(name);
+	return it != snapshots.end() ? it->second : nullptr;
+}
+
+void ui_snapshots_c::OpenLibrary(lua_State* L)
+{
+	luaL_newmetatable(L, "uisnapshotviewmeta");
+	lua_pushcfunction(L, l_snapViewIndex);
+	lua_setfield(L, -2, "__index");
+	lua_pushcfunction(L, l_snapViewNewIndex);
+	lua_setfield(L, -2, "__newindex");
+	lua_pushcfunction(L, l_snapViewLen);
+	lua_setfield(L, -2, "__len");
+	lua_pushcfunction(L, l_snapViewGC);
+	lua_setfield(L, -2, "__gc");
+	lua_pushboolean(L, 0);
+	lua_setfield(L, -2, "__metatable");
+	lua_pop(L, 1);
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, l_GetSnapshot, 1);
+	lua_setglobal(L, "GetSnapshot");
+	lua_pushcfunction(L, l_SnapshotPairs);
+	lua_setglobal(L, "SnapshotPairs");
+	lua_pushcfunction(L, l_SnapshotToTable);
+	lua_setglobal(L, "SnapshotToTable");
+}
@@ -0,0 +1,23 @@
+// DyLua: SimpleGraphic
+// (c) David Gowor, 2014
+//
+// UI Snapshot Header
+//
+
+// ==========
+// Interfaces
+// ==========
+
+// UI Snapshot Store
+// Named, immutable copies of Lua data that any Lua state can read in place; thread safe
+class ui_ISnapshots {
+public:
+	static ui_ISnapshots* GetHandle(class ui_main_c*);
+	static void FreeHandle(ui_ISnapshots*);
+
+	// Replaces the named snapshot with the value at the given index, nil removes it
+	// Returns false with the reason on the Lua stack if the value can't be stored
+	virtual bool	Publish(lua_State* L, const char* name, int index) = 0;
+	// Adds GetSnapshot(), SnapshotPairs() and SnapshotToTable() to the given state
+	virtual void	OpenLibrary(lua_State* L) = 0;
+};
@@ -6,108 +6,297 @@
 
 #include "ui_local.h"
 
+#include "luajit.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
 // =======
 // Classes
 // =======
 
-struct ssTweenData_s {
-	ssTweenData_s* next;
-	enum {
-		NIL,
-		BOOLEAN,
-		NUM,
-		STRING
-	} type;
-	union {
-		bool boolean;
-		double num;
-		char* string;
-	};
+// Values passed between Lua states, packed into one contiguous buffer
+// Tables keep their shared and cyclic references
+struct ssPacket_s {
+	int		count = 0;			// Number of top level values
+	bool	hasTables = false;
+	std::string buf;
 };
 
 struct ssCall_s {
 	ssCall_s* next = nullptr;
 	const char* name = nullptr;
-	ssTweenData_s* data = nullptr;
+	ssPacket_s data;
+	bool	isFunc = false;		// Caller is blocked until replied is set, and owns the call
+	bool	replied = false;	// Guarded by the sub script mutex
+};
+
+// Lock-free multiple producer, single consumer queue of calls
+// Producers push onto an intrusive stack; the consumer takes the whole stack at once and restores call order
+class ssCallQueue_c {
+public:
+	void	Push(ssCall_s* call)
+	{
+		call->next = head.load(std::memory_order_relaxed);
+		while ( !head.compare_exchange_weak(call->next, call, std::memory_order_release, std::memory_order_relaxed) );
+	}
+	ssCall_s* TakeAll()
+	{
+		ssCall_s* list = head.exchange(nullptr, std::memory_order_acquire);
+		ssCall_s* ordered = nullptr;
+		while (list) {
+			ssCall_s* next = list->next;
+			list->next = ordered;
+			ordered = list;
+			list = next;
+		}
+		return ordered;
+	}
+	bool	HasPending() const
+	{
+		return head.load(std::memory_order_acquire) != nullptr;
+	}
+
+private:
+	std::atomic<ssCall_s*> head = nullptr;
+};
+
+// Script compiled once on the main thread, loaded from bytecode by each worker
+struct ssChunk_s {
+	dword	serial = 0;
+	std::string bytecode;
+};
+
+class ui_subscript_c;
+
+struct ssWorker_s {
+	std::thread thread;
+	std::condition_variable wake;
+	lua_State* L = nullptr;
+	ui_subscript_c* job = nullptr;				// Guarded by pool mutex
+	bool	stopping = false;					// Guarded by pool mutex
+	std::unordered_map<dword, int> chunkRefs;	// Worker thread only, chunk serial to registry reference
+	int		gcPause = 0;						// Collector tuning restored after each job
+	int		gcStepMul = 0;
 };
 
 // =======================
 // ui_ISubScript Interface
 // =======================
 
-class ui_subscript_c: public ui_ISubScript, public thread_c {
+class ui_subscript_c: public ui_ISubScript {
 public:
 	// Interface
 	bool	Start();
 	void	SubScriptFrame();
 	bool	IsRunning();
 	size_t	GetScriptMemory();
+	void	Cancel(int graceMsec);
+	void	SetTimeout(int msec);
+	void	Abort();
 
 	// Encapsulated
-	ui_subscript_c(ui_main_c* ui, dword id);
+	ui_subscript_c(ui_main_c* ui, dword id, std::shared_ptr<ui_subScriptJob_s> job);
 	~ui_subscript_c();
 
 	ui_main_c* ui = nullptr;
+	class ui_subScriptPool_c* pool = nullptr;
 	dword	id = 0;
+	std::shared_ptr<ui_subScriptJob_s> job;		// Outcome goes here instead of to OnSubFinished/OnSubError
 
-	lua_State* L = nullptr;
+	std::shared_ptr<const ssChunk_s> chunk;
+	std::string funcList;
+	std::string subList;
+	ssPacket_s args;
+
+	ssWorker_s* worker = nullptr;				// Guarded by pool mutex
 	bool	running = false;
-	bool	finished = false;
-	bool	subWriting = false;
-	ssCall_s* subCalls = nullptr;
-	bool	funcWaiting = false;
-	ssCall_s funcCall;
+	std::atomic<bool> finished = false;		// Set under mutex
+	ssCallQueue_c calls;						// Sub and function calls to the main script, in call order
+	std::mutex mutex;
+	std::condition_variable wake;				// Signals function call replies, new function calls and finishing
 	char*	errorStr = nullptr;
+	char*	resultError = nullptr;
+	ssPacket_s results;
+
+	std::atomic<bool> cancelRequested = false;	// Polled by the script through IsCancelRequested()
+	std::atomic<bool> interruptRequested = false;	// Set under pool mutex
+	bool	aborted = false;
+	bool	timedOut = false;
+	std::optional<int> interruptAt;				// GetTime() at which a requested cancel becomes an interrupt
+	std::optional<int> timeoutAt;
+
+	bool	isMapShard = false;					// Runs the function returned by the chunk over each of the args
+	int		mapFirst = 0;						// Index of the shard's first item in the whole list
+	int		mapCount = 0;
+	int		mapErrorIndex = 0;					// Index of the item that failed
 
+	bool	PrepareShard(std::shared_ptr<const ssChunk_s> shardChunk, int first, int count, char* error, size_t errorSize);
+	void	Launch();
 	void	Stop();
+	void	Reply(ssCall_s* call);
+	void	DiscardCalls();
+	void	CheckDeadlines();
+	void	FinishJob();
+
+	void	LAssert(lua_State* L, int cond, const char* fmt, ...);
+};
+
+// ============================
+// ui_ISubScript Map Interface
+// ============================
+
+// Runs one shard per sub script and gathers their results; owns the shards rather than taking subscript slots
+class ui_parallelMap_c: public ui_ISubScript {
+public:
+	// Interface
+	bool	Start();
+	void	SubScriptFrame();
+	bool	IsRunning();
+	size_t	GetScriptMemory();
+	void	Cancel(int graceMsec);
+	void	SetTimeout(int msec);
+	void	Abort();
+
+	// Encapsulated
+	ui_parallelMap_c(ui_main_c* ui, dword id, std::shared_ptr<ui_subScriptJob_s> job, int maxShards);
+	~ui_parallelMap_c();
 
-	void	ThreadProc();
+	ui_main_c* ui = nullptr;
+	dword	id = 0;
+	std::shared_ptr<ui_subScriptJob_s> job;
+	int		maxShards = 1;
+	int		itemCount = 0;
+	std::vector<ui_subscript_c*> shards;	// In item order
+	std::vector<std::shared_ptr<ui_subScriptJob_s>> shardJobs;
 
-	void	LAssert(int cond, const char* fmt, ...);
+	bool	running = false;
+	bool	aborted = false;
+	bool	cancelled = false;
+	bool	timedOut = false;
+	std::optional<int> timeoutAt;
+
+	void	CancelShards(int graceMsec, int afterIndex);
+	void	Finish();
 };
 
-ui_ISubScript* ui_ISubScript::GetHandle(ui_main_c* ui, dword id)
+// ===========================
+// ui_ISubScriptPool Interface
+// ===========================
+
+class ui_subScriptPool_c: public ui_ISubScriptPool {
+public:
+	// Interface
+	dword	GetWorkerCount();
+
+	// Encapsulated
+	ui_subScriptPool_c(ui_main_c* ui);
+	~ui_subScriptPool_c();
+
+	ui_main_c* ui = nullptr;
+
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ssWorker_s>> workers;	// Guarded by mutex
+	std::vector<ssWorker_s*> idle;						// Guarded by mutex
+
+	dword	nextSerial = 0;
+	std::unordered_map<std::string, std::shared_ptr<const ssChunk_s>> chunks;	// Main thread only, keyed by source text
+
+	std::shared_ptr<const ssChunk_s> GetChunk(lua_State* L, int index);
+	void	Launch(ui_subscript_c* ss);
+	void	Interrupt(ui_subscript_c* ss);
+	size_t	GetMemory(ui_subscript_c* ss);
+
+	void	WorkerProc(ssWorker_s* w);
+	void	InitWorkerState(ssWorker_s* w);
+	void	RunJob(ssWorker_s* w, ui_subscript_c* ss);
+	void	RunMapShard(lua_State* L, ui_subscript_c* ss);
+	void	ResetWorkerState(ssWorker_s* w);
+};
+
+ui_ISubScript* ui_ISubScript::GetHandle(ui_main_c* ui, dword id, std::shared_ptr<ui_subScriptJob_s> job)
+{
+	return new ui_subscript_c(ui, id, std::move(job));
+}
+
+ui_ISubScript* ui_ISubScript::GetMapHandle(ui_main_c* ui, dword id, std::shared_ptr<ui_subScriptJob_s> job, int maxShards)
 {
-	return new ui_subscript_c(ui, id);
+	return new ui_parallelMap_c(ui, id, std::move(job), maxShards);
 }
 
 void ui_ISubScript::FreeHandle(ui_ISubScript* hnd)
 {
-	delete (ui_subscript_c*)hnd;
+	delete hnd;
+}
+
+ui_ISubScriptPool* ui_ISubScriptPool::GetHandle(ui_main_c* ui)
+{
+	return new ui_subScriptPool_c(ui);
+}
+
+void ui_ISubScriptPool::FreeHandle(ui_ISubScriptPool* hnd)
+{
+	delete (ui_subScriptPool_c*)hnd;
 }
 
-ui_subscript_c::ui_subscript_c(ui_main_c* ui, dword id)
-	: thread_c(ui->sys), ui(ui), id(id)
+ui_subscript_c::ui_subscript_c(ui_main_c* ui, dword id, std::shared_ptr<ui_subScriptJob_s> job)
+	: ui(ui), pool((ui_subScriptPool_c*)ui->subScriptPool), id(id), job(std::move(job))
 {
-	L = NULL;
-	errorStr = NULL;
-	running = false;
-	finished = false;
+	if (this->job) {
+		this->job->subScript = this;
+	}
 }
 
 ui_subscript_c::~ui_subscript_c()
 {
 	Stop();
 
-	FreeString(errorStr);
-	if (L) {
-		lua_close(L);
+	// finished is read without the lock, so wait for the worker to leave its final notify before the mutex goes away
+	{
+		std::lock_guard lock(mutex);
+	}
+
+	if (job && job->subScript == this) {
+		// Freed before finishing, e.g. by a restart
+		job->subScript = nullptr;
+		job->error = "Sub script was stopped";
+		job->state = SS_JOB_CANCELLED;
 	}
+
+	FreeString(errorStr);
+	FreeString(resultError);
 }
 
 // =======================
 // Lua Interface Utilities
 // =======================
 
+// Named fields, as luaL_ref() keeps its free list in integer slot 0
 static ui_subscript_c* GetSSPtr(lua_State* L)
 {
-	lua_rawgeti(L, LUA_REGISTRYINDEX, 0);
+	lua_getfield(L, LUA_REGISTRYINDEX, "sssubscript");
 	ui_subscript_c* ss = (ui_subscript_c*)lua_touserdata(L, -1);
 	lua_pop(L, 1);
 	return ss;
 }
 
-void ui_subscript_c::LAssert(int cond, const char* fmt, ...)
+static void SetSSPtr(lua_State* L, ui_subscript_c* ss)
+{
+	if (ss) {
+		lua_pushlightuserdata(L, ss);
+	} else {
+		lua_pushnil(L);
+	}
+	lua_setfield(L, LUA_REGISTRYINDEX, "sssubscript");
+}
+
+void ui_subscript_c::LAssert(lua_State* L, int cond, const char* fmt, ...)
 {
 	if ( !cond ) {
 		va_list va;
@@ -140,88 +329,260 @@ static int traceback (lua_State *L) {
 
 static int l_panicFunc(lua_State* L)
 {
-	ui_subscript_c* ss = GetSSPtr(L);
-	ss->ui->sys->Error("Unprotected Lua error:\n%s", lua_tostring(L, -1));
+	// May happen between jobs, so the pool is what's relied on here
+	lua_getfield(L, LUA_REGISTRYINDEX, "sspool");
+	ui_subScriptPool_c* pool = (ui_subScriptPool_c*)lua_touserdata(L, -1);
+	lua_pop(L, 1);
+	pool->ui->sys->Error("Unprotected Lua error:\n%s", lua_tostring(L, -2));
 	return 0;
 }
 
-// ==================
-// Tween Data Helpers
-// ==================
+// =====================
+// Value Packing Helpers
+// =====================
+
+enum ssPackTag_e : byte {
+	SS_TAG_NIL,
+	SS_TAG_FALSE,
+	SS_TAG_TRUE,
+	SS_TAG_NUMBER,		// Followed by a native double
+	SS_TAG_STRING,		// Followed by a varint length and the bytes
+	SS_TAG_TABLE,		// Followed by a varint array count, a dword hash count, the array values and the key/value pairs
+	SS_TAG_TABLEREF,	// Followed by a varint index into the tables seen so far
+};
+
+class ssPacker_c {
+public:
+	ssPacker_c(lua_State* L, ssPacket_s& packet, char* error, size_t errorSize)
+		: L(L), packet(packet), error(error), errorSize(errorSize) { }
+
+	bool	Pack(int index);
+
+private:
+	lua_State* L;
+	ssPacket_s& packet;
+	char*	error;
+	size_t	errorSize;
+	std::unordered_map<const void*, dword> tables;
+	int		depth = 0;
+
+	bool	PackTable(int index);
+	void	PutByte(byte b) { packet.buf.push_back((char)b); }
+	void	PutRaw(const void* data, size_t size) { packet.buf.append((const char*)data, size); }
+	void	PutVarint(size_t val)
+	{
+		while (val >= 0x80) {
+			PutByte((byte)(val | 0x80));
+			val >>= 7;
+		}
+		PutByte((byte)val);
+	}
+};
 
-static ssTweenData_s* ssBuildData(lua_State* L, int start)
+bool ssPacker_c::Pack(int index)
 {
-	ssTweenData_s* ret = NULL;
-	ssTweenData_s* last = NULL;
-	int n = lua_gettop(L);
-	for (int a = start; a <= n; a++) {
-		ssTweenData_s* d = new ssTweenData_s;
-		d->next = NULL;
-		if (last) {
-			last->next = d;
-			last = d;
-		} else {
-			ret = last = d;
+	switch (lua_type(L, index)) {
+	case LUA_TNIL:
+		PutByte(SS_TAG_NIL);
+		return true;
+	case LUA_TBOOLEAN:
+		PutByte(lua_toboolean(L, index) ? SS_TAG_TRUE : SS_TAG_FALSE);
+		return true;
+	case LUA_TNUMBER: {
+		double num = lua_tonumber(L, index);
+		PutByte(SS_TAG_NUMBER);
+		PutRaw(&num, sizeof(num));
+		return true;
+	}
+	case LUA_TSTRING: {
+		size_t len;
+		const char* str = lua_tolstring(L, index, &len);
+		PutByte(SS_TAG_STRING);
+		PutVarint(len);
+		PutRaw(str, len);
+		return true;
+	}
+	case LUA_TTABLE:
+		return PackTable(index);
+	default:
+		snprintf(error, errorSize, "%s values", luaL_typename(L, index));
+		return false;
+	}
+}
+
+bool ssPacker_c::PackTable(int index)
+{
+	// Tables seen before are written as references, which keeps shared and cyclic structure intact
+	const void* ptr = lua_topointer(L, index);
+	auto it = tables.find(ptr);
+	if (it != tables.end()) {
+		PutByte(SS_TAG_TABLEREF);
+		PutVarint(it->second);
+		return true;
+	}
+	if (depth >= 200 || !lua_checkstack(L, 4)) {
+		snprintf(error, errorSize, "tables nested deeper than %d levels", depth);
+		return false;
+	}
+	tables.emplace(ptr, (dword)tables.size());
+	packet.hasTables = true;
+	depth++;
+
+	const size_t arrayCount = lua_objlen(L, index);
+	PutByte(SS_TAG_TABLE);
+	PutVarint(arrayCount);
+	const size_t hashCountPos = packet.buf.size();
+	dword hashCount = 0;
+	PutRaw(&hashCount, sizeof(hashCount));
+	for (size_t i = 1; i <= arrayCount; i++) {
+		lua_rawgeti(L, index, (int)i);
+		bool ok = Pack(lua_gettop(L));
+		lua_pop(L, 1);
+		if ( !ok ) {
+			return false;
 		}
-		switch (lua_type(L, a)) {
-		case LUA_TNIL:
-			d->type = ssTweenData_s::NIL;
-			break;
-		case LUA_TBOOLEAN:
-			d->type = ssTweenData_s::BOOLEAN;
-			d->boolean = (lua_toboolean(L, a) != 0);
-			break;
-		case LUA_TNUMBER:
-			d->type = ssTweenData_s::NUM;
-			d->num = lua_tonumber(L, a);
-			break;
-		case LUA_TSTRING:
-			d->type = ssTweenData_s::STRING;
-			d->string = AllocString(lua_tostring(L, a));
-			break;
+	}
+	lua_pushnil(L);
+	while (lua_next(L, index)) {
+		if (lua_type(L, -2) == LUA_TNUMBER) {
+			double key = lua_tonumber(L, -2);
+			if (key >= 1 && key <= arrayCount && key == floor(key)) {
+				// Already written as part of the array
+				lua_pop(L, 1);
+				continue;
+			}
 		}
+		if ( !Pack(lua_gettop(L) - 1) || !Pack(lua_gettop(L)) ) {
+			lua_pop(L, 2);
+			return false;
+		}
+		lua_pop(L, 1);
+		hashCount++;
 	}
-	lua_settop(L, start - 1);
-	return ret;
+	memcpy(packet.buf.data() + hashCountPos, &hashCount, sizeof(hashCount));
+
+	depth--;
+	return true;
 }
 
-static void ssWipeData(ssTweenData_s* list)
+class ssUnpacker_c {
+public:
+	ssUnpacker_c(lua_State* L, const ssPacket_s& packet, int refs)
+		: L(L), packet(packet), refs(refs) { }
+
+	void	Unpack();
+
+private:
+	lua_State* L;
+	const ssPacket_s& packet;
+	int		refs;				// Stack index of the table of tables created so far
+	int		tableCount = 0;
+	size_t	pos = 0;
+
+	byte	GetByte() { return (byte)packet.buf[pos++]; }
+	size_t	GetVarint()
+	{
+		size_t val = 0;
+		for (int shift = 0; ; shift += 7) {
+			byte b = GetByte();
+			val |= (size_t)(b & 0x7F) << shift;
+			if ( !(b & 0x80) ) {
+				return val;
+			}
+		}
+	}
+};
+
+void ssUnpacker_c::Unpack()
 {
-	while (list) {
-		ssTweenData_s* data = list;
-		if (data->type == ssTweenData_s::STRING) {
-			delete data->string;
+	switch (GetByte()) {
+	case SS_TAG_NIL:
+		lua_pushnil(L);
+		break;
+	case SS_TAG_FALSE:
+		lua_pushboolean(L, 0);
+		break;
+	case SS_TAG_TRUE:
+		lua_pushboolean(L, 1);
+		break;
+	case SS_TAG_NUMBER: {
+		double num;
+		memcpy(&num, packet.buf.data() + pos, sizeof(num));
+		pos += sizeof(num);
+		lua_pushnumber(L, num);
+		break;
+	}
+	case SS_TAG_STRING: {
+		size_t len = GetVarint();
+		lua_pushlstring(L, packet.buf.data() + pos, len);
+		pos += len;
+		break;
+	}
+	case SS_TAG_TABLE: {
+		const size_t arrayCount = GetVarint();
+		dword hashCount;
+		memcpy(&hashCount, packet.buf.data() + pos, sizeof(hashCount));
+		pos += sizeof(hashCount);
+		lua_checkstack(L, 4);
+		lua_createtable(L, (int)arrayCount, (int)hashCount);
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, refs, ++tableCount);
+		for (size_t i = 1; i <= arrayCount; i++) {
+			Unpack();
+			lua_rawseti(L, -2, (int)i);
+		}
+		for (dword i = 0; i < hashCount; i++) {
+			Unpack();
+			Unpack();
+			lua_rawset(L, -3);
 		}
-		list = data->next;
-		delete data;
+		break;
+	}
+	case SS_TAG_TABLEREF:
+		lua_rawgeti(L, refs, (int)GetVarint() + 1);
+		break;
 	}
 }
 
-static int ssPushData(lua_State* L, ssTweenData_s* list)
+// Packs the values from start to the top of the stack into one buffer, shared by the whole list, and pops them
+// Returns 0 on success, or the list position of the first value that couldn't be packed with the reason in error
+static int ssPackValues(lua_State* L, int start, ssPacket_s& packet, char* error, size_t errorSize)
 {
-	int numdat = 0;
-	for ( ; list; numdat++) {
-		ssTweenData_s* data = list;
-		lua_checkstack(L, 1);
-		switch (data->type) {
-		case ssTweenData_s::NIL:
-			lua_pushnil(L);
-			break;
-		case ssTweenData_s::BOOLEAN:
-			lua_pushboolean(L, data->boolean);
-			break;
-		case ssTweenData_s::NUM:
-			lua_pushnumber(L, data->num);
-			break;
-		case ssTweenData_s::STRING:
-			lua_pushstring(L, data->string);
-			delete data->string;
-			break;
+	packet = {};
+	ssPacker_c packer(L, packet, error, errorSize);
+	int n = lua_gettop(L);
+	for (int a = start; a <= n; a++) {
+		if ( !packer.Pack(a) ) {
+			packet = {};
+			lua_settop(L, start - 1);
+			return a - start + 1;
 		}
-		list = data->next;
-		delete data;
+		packet.count++;
+	}
+	lua_settop(L, start - 1);
+	return 0;
+}
+
+// Pushes the values of a packet, returning the number pushed
+static int ssUnpackValues(lua_State* L, const ssPacket_s& packet)
+{
+	if ( !packet.count ) {
+		return 0;
+	}
+	lua_checkstack(L, packet.count + 1);
+	int refs = 0;
+	if (packet.hasTables) {
+		lua_newtable(L);
+		refs = lua_gettop(L);
+	}
+	ssUnpacker_c unpacker(L, packet, refs);
+	for (int i = 0; i < packet.count; i++) {
+		unpacker.Unpack();
 	}
-	return numdat;
+	if (refs) {
+		lua_remove(L, refs);
+	}
+	return packet.count;
 }
 
 // ============================
@@ -231,43 +592,51 @@ static int ssPushData(lua_State* L, ssTweenData_s* list)
 static int l_SubScriptFunc(lua_State* L)
 {
 	ui_subscript_c* ss = GetSSPtr(L);
-	int n = lua_gettop(L);
-	const char* funcName = lua_tostring(L, lua_upvalueindex(1)); 
-	for (int i = 1; i <= n; i++) {
-		ss->LAssert(lua_isnil(L, i) || lua_isboolean(L, i) || lua_isnumber(L, i) || lua_isstring(L, i),
-			"%s() argument %d: only nil, boolean, number and string can be passed to the main script", funcName, i);
+	ssCall_s call;
+	call.name = lua_tostring(L, lua_upvalueindex(1));
+	call.isFunc = true;
+	char error[128];
+	int bad = ssPackValues(L, 1, call.data, error, sizeof(error));
+	ss->LAssert(L, bad == 0, "%s() argument %d: %s can't be passed to the main script", call.name, bad, error);
+	{
+		// Block until the main thread has run the call and replied
+		std::unique_lock lock(ss->mutex);
+		ss->calls.Push(&call);
+		ss->wake.notify_all();
+		ss->wake.wait(lock, [&call] { return call.replied; });
 	}
-	ss->funcCall.name = funcName;
-	ss->funcCall.data = ssBuildData(L, 1);
-	ss->funcWaiting = true;
-	while (ss->funcWaiting) ss->ui->sys->Sleep(1);
-	return ssPushData(L, ss->funcCall.data);
+	return ssUnpackValues(L, call.data);
 }
 
 static int l_SubScriptSub(lua_State* L)
 {
 	ui_subscript_c* ss = GetSSPtr(L);
-	int n = lua_gettop(L);
 	const char* subName = lua_tostring(L, lua_upvalueindex(1));
-	for (int i = 1; i <= n; i++) {
-		ss->LAssert(lua_isnil(L, i) || lua_isboolean(L, i) || lua_isnumber(L, i) || lua_isstring(L, i),
-			"%s() argument %d: only nil, boolean, number and string can be passed to the main script", subName, i);
-	}
-	ss->subWriting = true;
-	ssCall_s* calls = ss->subCalls;
+	ssPacket_s data;
+	char error[128];
+	int bad = ssPackValues(L, 1, data, error, sizeof(error));
+	ss->LAssert(L, bad == 0, "%s() argument %d: %s can't be passed to the main script", subName, bad, error);
 	ssCall_s* call = new ssCall_s;
 	call->name = subName;
-	call->data = ssBuildData(L, 1);
-	call->next = NULL;
-	if (calls) {
-		while (calls->next) {
-			calls = calls->next;
-		}
-		calls->next = call;
-	} else {
-		ss->subCalls = call;
+	call->data = std::move(data);
+	ss->calls.Push(call);
+	return 0;
+}
+
+static int l_IsCancelRequested(lua_State* L)
+{
+	ui_subscript_c* ss = GetSSPtr(L);
+	lua_pushboolean(L, ss->cancelRequested);
+	return 1;
+}
+
+static int l_ReportProgress(lua_State* L)
+{
+	ui_subscript_c* ss = GetSSPtr(L);
+	ss->LAssert(L, lua_isnumber(L, 1), "ReportProgress() argument 1: expected number, got %s", luaL_typename(L, 1));
+	if (ss->job) {
+		ss->job->progress = lua_tonumber(L, 1);
 	}
-	ss->subWriting = false;
 	return 0;
 }
 
@@ -295,152 +664,669 @@ static void l_hookStop(lua_State* L, lua_Debug* dbg)
 	lua_error(L);
 }
 
-// ===================
-// UI Sub Script Class
-// ===================
+// The allocation sampler clears its own hook, which can race with Interrupt() setting the stop hook
+static void l_hookRestoreStop(lua_State* L, lua_Debug* dbg)
+{
+	ui_subscript_c* ss = GetSSPtr(L);
+	if (ss && ss->interruptRequested) {
+		lua_sethook(L, l_hookStop, LUA_MASKLINE, 0);
+	}
+}
 
-bool ui_subscript_c::Start()
+static int DumpWriter(lua_State* L, const void* p, size_t sz, void* ud)
 {
-	subWriting = false;
-	subCalls = NULL;
-	funcWaiting = false;
-	errorStr = NULL;
+	((std::string*)ud)->append((const char*)p, sz);
+	return 0;
+}
 
-	// Initialise Lua
-	L = luaL_newstate();
-	if ( !L ) return false;
+// Stores a copy of the fields of the table at lib in the table at the top of the stack, keyed by the table itself
+static void ssSnapshotLib(lua_State* L, int lib)
+{
+	if (lib < 0) {
+		lib = lua_gettop(L) + lib + 1;
+	}
+	lua_pushvalue(L, lib);
+	lua_newtable(L);
+	lua_pushnil(L);
+	while (lua_next(L, lib)) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_rawset(L, -3);
+}
+
+// Puts every table recorded in ssbaselibs back the way it was snapshotted
+static void ssRestoreLibs(lua_State* L)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, "ssbaselibs");
+	lua_pushnil(L);
+	while (lua_next(L, -2)) {
+		// Drop fields the job added; clearing an existing field during traversal is allowed
+		lua_pushnil(L);
+		while (lua_next(L, -3)) {
+			lua_pop(L, 1);
+			lua_pushvalue(L, -1);
+			lua_rawget(L, -3);
+			bool isBase = !lua_isnil(L, -1);
+			lua_pop(L, 1);
+			if ( !isBase ) {
+				lua_pushvalue(L, -1);
+				lua_pushnil(L);
+				lua_rawset(L, -5);
+			}
+		}
+		lua_pushnil(L);
+		while (lua_next(L, -2)) {
+			lua_pushvalue(L, -2);
+			lua_insert(L, -2);
+			lua_rawset(L, -5);
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+}
+
+// ========================
+// UI Sub Script Pool Class
+// ========================
+
+ui_subScriptPool_c::ui_subScriptPool_c(ui_main_c* ui)
+	: ui(ui)
+{
+}
+
+ui_subScriptPool_c::~ui_subScriptPool_c()
+{
+	// Every sub script has been freed by now, so the workers are all idle
+	{
+		std::lock_guard lock(mutex);
+		for (auto& w : workers) {
+			w->stopping = true;
+			w->wake.notify_one();
+		}
+	}
+	for (auto& w : workers) {
+		w->thread.join();
+		if (w->L) {
+			ui->allocTracker->Detach(w->L);
+			lua_close(w->L);
+		}
+	}
+}
+
+dword ui_subScriptPool_c::GetWorkerCount()
+{
+	std::lock_guard lock(mutex);
+	return (dword)workers.size();
+}
+
+std::shared_ptr<const ssChunk_s> ui_subScriptPool_c::GetChunk(lua_State* L, int index)
+{
+	size_t len;
+	const char* src = lua_tolstring(L, index, &len);
+	std::string key(src, len);
+	auto it = chunks.find(key);
+	if (it != chunks.end()) {
+		return it->second;
+	}
+
+	// Compiled in the calling state so that syntax errors are reported to the launching script straight away
+	if (luaL_loadbuffer(L, src, len, src)) {
+		return nullptr;
+	}
+	auto chunk = std::make_shared<ssChunk_s>();
+	chunk->serial = ++nextSerial;
+	lua_dump(L, DumpWriter, &chunk->bytecode);
+	lua_pop(L, 1);
+
+	// Scripts that build their source on the fly would otherwise grow this forever
+	if (chunks.size() >= 64) {
+		chunks.clear();
+	}
+	chunks.emplace(std::move(key), chunk);
+	return chunk;
+}
+
+void ui_subScriptPool_c::Launch(ui_subscript_c* ss)
+{
+	std::lock_guard lock(mutex);
+	ssWorker_s* w;
+	if (idle.empty()) {
+		workers.push_back(std::make_unique<ssWorker_s>());
+		w = workers.back().get();
+		w->thread = std::thread(&ui_subScriptPool_c::WorkerProc, this, w);
+	} else {
+		w = idle.back();
+		idle.pop_back();
+	}
+	w->job = ss;
+	ss->worker = w;
+	w->wake.notify_one();
+}
+
+void ui_subScriptPool_c::Interrupt(ui_subscript_c* ss)
+{
+	// The worker unbinds itself under the lock before moving on, so this can't hit a later job
+	// A job that hasn't reached its script yet sets the hook itself
+	std::lock_guard lock(mutex);
+	ss->interruptRequested = true;
+	if (ss->worker && ss->worker->job == ss && ss->worker->L) {
+		// Set hook to stop script on the next line
+		lua_sethook(ss->worker->L, l_hookStop, LUA_MASKLINE, 0);
+	}
+}
+
+size_t ui_subScriptPool_c::GetMemory(ui_subscript_c* ss)
+{
+	std::lock_guard lock(mutex);
+	if (ss->worker && ss->worker->job == ss && ss->worker->L) {
+		return lua_gc(ss->worker->L, LUA_GCCOUNT, 0);
+	}
+	return 0;
+}
+
+void ui_subScriptPool_c::InitWorkerState(ssWorker_s* w)
+{
+	lua_State* L = luaL_newstate();
+	if ( !L ) {
+		return;
+	}
 	lua_atpanic(L, l_panicFunc);
 	lua_pushlightuserdata(L, this);
-	lua_rawseti(L, LUA_REGISTRYINDEX, 0);
-	lua_pushcfunction(L, traceback);
+	lua_setfield(L, LUA_REGISTRYINDEX, "sspool");
+	ui->allocTracker->Attach(L, "Sub script", l_hookRestoreStop);
 
 #ifdef _WIN32
 	lua_pushboolean(L, 1);
 	lua_setfield(L, LUA_REGISTRYINDEX, "LUA_NOENV");
 #endif
 
-	// Add libraries and APIs
+	// Add libraries
 	lua_gc(L, LUA_GCSTOP, 0);
 	luaL_openlibs(L);
 	lua_getglobal(L, "os");
 	lua_pushcfunction(L, l_os_exit);
 	lua_setfield(L, -2, "exit");
 	lua_pop(L, 1);
-	parseSubScriptList(L, lua_tostring(ui->L, 2), l_SubScriptFunc);
-	parseSubScriptList(L, lua_tostring(ui->L, 3), l_SubScriptSub);
+	lua_pushcfunction(L, l_IsCancelRequested);
+	lua_setglobal(L, "IsCancelRequested");
+	lua_pushcfunction(L, l_ReportProgress);
+	lua_setglobal(L, "ReportProgress");
+	ui->snapshots->OpenLibrary(L);
 	lua_gc(L, LUA_GCRESTART, -1);
+	w->gcPause = lua_gc(L, LUA_GCSETPAUSE, 0);
+	lua_gc(L, LUA_GCSETPAUSE, w->gcPause);
+	w->gcStepMul = lua_gc(L, LUA_GCSETSTEPMUL, 0);
+	lua_gc(L, LUA_GCSETSTEPMUL, w->gcStepMul);
 
-	// Load the script
-	int err = luaL_loadstring(L, lua_tostring(ui->L, 1));
-	if (err) {
-		lua_pushstring(ui->L, lua_tostring(L, -1));
-		lua_error(ui->L);
+	// Snapshot the pristine globals and loaded modules, each job starts from a copy of these
+	lua_newtable(L);
+	lua_pushnil(L);
+	while (lua_next(L, LUA_GLOBALSINDEX)) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
 	}
+	lua_setfield(L, LUA_REGISTRYINDEX, "ssbaseglobals");
+	lua_newtable(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+	lua_pushnil(L);
+	while (lua_next(L, -2)) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -5);
+	}
+	lua_pop(L, 1);
+	lua_setfield(L, LUA_REGISTRYINDEX, "ssbaseloaded");
 
-	// Copy arguments and launch script thread
-	lua_pushinteger(L, ssPushData(L, ssBuildData(ui->L, 4)));
-	ThreadStart();
-	running = true;
+	// Library tables are shared by every job's globals, so their fields are snapshotted too
+	// That covers package.path and cpath; the string metatable and the loader tables are added explicitly
+	lua_newtable(L);
+	lua_pushnil(L);
+	while (lua_next(L, LUA_GLOBALSINDEX)) {
+		if (lua_istable(L, -1) && !lua_rawequal(L, -1, LUA_GLOBALSINDEX)) {
+			ssSnapshotLib(L, -1);
+		}
+		lua_pop(L, 1);
+	}
+	lua_pushliteral(L, "");
+	if (lua_getmetatable(L, -1)) {
+		ssSnapshotLib(L, -1);
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	lua_getglobal(L, "package");
+	for (const char* field : { "loaders", "preload" }) {
+		lua_getfield(L, -1, field);
+		if (lua_istable(L, -1)) {
+			ssSnapshotLib(L, -1);
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	lua_setfield(L, LUA_REGISTRYINDEX, "ssbaselibs");
+
+	std::lock_guard lock(mutex);
+	w->L = L;
+}
+
+void ui_subScriptPool_c::RunJob(ssWorker_s* w, ui_subscript_c* ss)
+{
+	ZONE("Sub script job");
+	lua_State* L = w->L;
+	if ( !L ) {
+		ss->errorStr = AllocString("Unable to create Lua state for sub script");
+		return;
+	}
+	SetSSPtr(L, ss);
+
+	// Fresh globals table so nothing leaks in from the previous job
+	lua_newtable(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, "ssbaseglobals");
+	lua_pushnil(L);
+	while (lua_next(L, -2)) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -5);
+	}
+	lua_pop(L, 1);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "_G");
+	lua_replace(L, LUA_GLOBALSINDEX);
+	parseSubScriptList(L, ss->funcList.c_str(), l_SubScriptFunc);
+	parseSubScriptList(L, ss->subList.c_str(), l_SubScriptSub);
+
+	lua_pushcfunction(L, traceback);
+
+	// Fetch the compiled script, loading it into this state on first use
+	auto ref = w->chunkRefs.find(ss->chunk->serial);
+	if (ref != w->chunkRefs.end()) {
+		lua_rawgeti(L, LUA_REGISTRYINDEX, ref->second);
+	} else {
+		if (w->chunkRefs.size() >= 64) {
+			for (auto& [serial, chunkRef] : w->chunkRefs) {
+				luaL_unref(L, LUA_REGISTRYINDEX, chunkRef);
+			}
+			w->chunkRefs.clear();
+		}
+		if (luaL_loadbuffer(L, ss->chunk->bytecode.data(), ss->chunk->bytecode.size(), "=subscript")) {
+			ss->errorStr = AllocString(lua_tostring(L, -1));
+			return;
+		}
+		lua_pushvalue(L, -1);
+		w->chunkRefs.emplace(ss->chunk->serial, luaL_ref(L, LUA_REGISTRYINDEX));
+	}
+	lua_pushvalue(L, LUA_GLOBALSINDEX);
+	lua_setfenv(L, -2);
+
+	if (ss->interruptRequested) {
+		lua_sethook(L, l_hookStop, LUA_MASKLINE, 0);
+	}
+	if (ss->isMapShard) {
+		RunMapShard(L, ss);
+		return;
+	}
+
+	// Copy arguments and run the script
+	int numarg = ssUnpackValues(L, ss->args);
+	ss->args = {};
+	if (lua_pcall(L, numarg, LUA_MULTRET, 1)) {
+		ss->errorStr = AllocString(lua_tostring(L, -1));
+		return;
+	}
+
+	// Pack the return values for the main thread
+	char error[128];
+	int bad = ssPackValues(L, 2, ss->results, error, sizeof(error));
+	if (bad) {
+		ss->resultError = AllocStringLen(256);
+		snprintf(ss->resultError, 256, "Subscript return %d: %s can't be returned from sub script", bad, error);
+	}
+}
+
+void ui_subScriptPool_c::RunMapShard(lua_State* L, ui_subscript_c* ss)
+{
+	// Stack holds the traceback and the chunk, which must return the function to map with
+	ss->mapErrorIndex = ss->mapFirst;
+	if (lua_pcall(L, 0, 1, 1)) {
+		ss->errorStr = AllocString(lua_tostring(L, -1));
+		return;
+	}
+	if ( !lua_isfunction(L, -1) ) {
+		ss->errorStr = AllocString("ParallelMap() script must return a function");
+		return;
+	}
+	int func = lua_gettop(L);
+	ssUnpackValues(L, ss->args);
+	ss->args = {};
+	int items = lua_gettop(L);
+	lua_createtable(L, ss->mapCount, 0);
+	int out = lua_gettop(L);
+
+	// Items are mapped in order and the first failure ends the shard, so the lowest failing index is always the one reported
+	for (int i = 1; i <= ss->mapCount; i++) {
+		lua_pushvalue(L, func);
+		lua_rawgeti(L, items, i);
+		lua_pushinteger(L, ss->mapFirst + i - 1);
+		if (lua_pcall(L, 2, 1, 1)) {
+			ss->mapErrorIndex = ss->mapFirst + i - 1;
+			const char* msg = lua_isstring(L, -1) ? lua_tostring(L, -1) : "(non-string error)";
+			ss->errorStr = AllocStringLen(strlen(msg) + 64);
+			sprintf(ss->errorStr, "ParallelMap() item %d: %s", ss->mapErrorIndex, msg);
+			return;
+		}
+		lua_rawseti(L, out, i);
+		ss->job->progress = (double)i / ss->mapCount;
+	}
+
+	char error[128];
+	if (ssPackValues(L, out, ss->results, error, sizeof(error))) {
+		ss->resultError = AllocStringLen(256);
+		snprintf(ss->resultError, 256, "ParallelMap() items %d to %d: %s can't be returned from sub script", ss->mapFirst, ss->mapFirst + ss->mapCount - 1, error);
+	}
+}
+
+void ui_subScriptPool_c::ResetWorkerState(ssWorker_s* w)
+{
+	lua_State* L = w->L;
+	if ( !L ) {
+		return;
+	}
+	lua_settop(L, 0);
+	lua_sethook(L, NULL, 0, 0);
+	SetSSPtr(L, nullptr);
+
+	// Undo changes the job made to the shared library tables, and turn the JIT back on if it was switched off
+	ssRestoreLibs(L);
+	luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_ON);
+
+	// Forget modules required by the job, so they're reloaded against the next job's globals
+	lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+	lua_getfield(L, LUA_REGISTRYINDEX, "ssbaseloaded");
+	lua_pushnil(L);
+	while (lua_next(L, -3)) {
+		lua_pop(L, 1);
+		lua_pushvalue(L, -1);
+		lua_rawget(L, -3);
+		bool isBase = !lua_isnil(L, -1);
+		lua_pop(L, 1);
+		if ( !isBase ) {
+			// Clearing an existing field during traversal is allowed
+			lua_pushvalue(L, -1);
+			lua_pushnil(L);
+			lua_rawset(L, -5);
+		}
+	}
+	lua_pop(L, 2);
+
+	// Detach the job's globals from the thread and the cached chunks so they can be collected
+	lua_getfield(L, LUA_REGISTRYINDEX, "ssbaseglobals");
+	for (auto& [serial, chunkRef] : w->chunkRefs) {
+		lua_rawgeti(L, LUA_REGISTRYINDEX, chunkRef);
+		lua_pushvalue(L, -2);
+		lua_setfenv(L, -2);
+		lua_pop(L, 1);
+	}
+	lua_replace(L, LUA_GLOBALSINDEX);
+
+	// Undo collectgarbage("stop"/"setpause"/"setstepmul") from the job; a single step leaves the rest of its garbage to the
+	// incremental collector, as a full collection after every short job costs about as much as the job
+	lua_gc(L, LUA_GCRESTART, 0);
+	lua_gc(L, LUA_GCSETPAUSE, w->gcPause);
+	lua_gc(L, LUA_GCSETSTEPMUL, w->gcStepMul);
+	lua_gc(L, LUA_GCSTEP, 0);
+}
+
+void ui_subScriptPool_c::WorkerProc(ssWorker_s* w)
+{
+	Zone_SetThreadName("Sub script worker");
+	InitWorkerState(w);
+
+	std::unique_lock lock(mutex);
+	while (true) {
+		w->wake.wait(lock, [w] { return w->stopping || w->job; });
+		if (w->stopping) {
+			break;
+		}
+		ui_subscript_c* ss = w->job;
+		lock.unlock();
+
+		RunJob(w, ss);
+
+		lock.lock();
+		w->job = nullptr;
+		ss->worker = nullptr;
+		{
+			// The sub script may be freed as soon as this is seen; its destructor takes the lock to wait for this block to end
+			std::lock_guard ssLock(ss->mutex);
+			ss->finished = true;
+			ss->wake.notify_all();
+		}
+		lock.unlock();
+
+		ResetWorkerState(w);
+
+		lock.lock();
+		idle.push_back(w);
+	}
+}
+
+// ===================
+// UI Sub Script Class
+// ===================
+
+bool ui_subscript_c::Start()
+{
+	lua_State* mainL = ui->L;
+	chunk = pool->GetChunk(mainL, 1);
+	if ( !chunk ) {
+		lua_error(mainL);
+	}
+	funcList = lua_tostring(mainL, 2);
+	subList = lua_tostring(mainL, 3);
+	char error[128];
+	int bad = ssPackValues(mainL, 4, args, error, sizeof(error));
+	if (bad) {
+		luaL_error(mainL, "LaunchSubScript() argument %d: %s can't be passed to sub script", bad + 3, error);
+	}
+
+	Launch();
 
 	return true;
 }
 
+bool ui_subscript_c::PrepareShard(std::shared_ptr<const ssChunk_s> shardChunk, int first, int count, char* error, size_t errorSize)
+{
+	// Items are taken from a table on top of the main stack
+	chunk = std::move(shardChunk);
+	isMapShard = true;
+	mapFirst = first;
+	mapCount = count;
+	lua_State* mainL = ui->L;
+	return ssPackValues(mainL, lua_gettop(mainL), args, error, errorSize) == 0;
+}
+
+void ui_subscript_c::Launch()
+{
+	running = true;
+	pool->Launch(this);
+}
+
+void ui_subscript_c::Reply(ssCall_s* call)
+{
+	std::lock_guard lock(mutex);
+	call->replied = true;
+	wake.notify_all();
+}
+
+void ui_subscript_c::DiscardCalls()
+{
+	ssCall_s* call = calls.TakeAll();
+	while (call) {
+		ssCall_s* next = call->next;
+		if (call->isFunc) {
+			// Script is waiting on function call; answer with no values so it can reach the stop hook
+			call->data = {};
+			Reply(call);
+		} else {
+			delete call;
+		}
+		call = next;
+	}
+}
+
 void ui_subscript_c::Stop()
 {
 	if (running) {
-		// Set hook to stop script on the next line
-		lua_sethook(L, l_hookStop, LUA_MASKLINE, 0);
-		while ( !finished && !funcWaiting ) ui->sys->Sleep(0);
+		pool->Interrupt(this);
+
+		// Wait for the script to stop, answering any function calls it makes on the way
+		std::unique_lock lock(mutex);
+		while ( !finished ) {
+			lock.unlock();
+			DiscardCalls();
+			lock.lock();
+			wake.wait(lock, [this] { return finished || calls.HasPending(); });
+		}
 	}
 
-	if (funcWaiting) {
-		// Script is waiting on function call; discard and wait for script to stop
-		ssWipeData(funcCall.data);
-		funcCall.data = NULL;
-		funcWaiting = false;
-		while ( !finished ) ui->sys->Sleep(0);
+	DiscardCalls();
+}
+
+void ui_subscript_c::Cancel(int graceMsec)
+{
+	if ( !running ) {
+		return;
+	}
+	cancelRequested = true;
+	int at = ui->sys->GetTime() + std::max(graceMsec, 0);
+	if ( !interruptAt || at - *interruptAt < 0 ) {
+		interruptAt = at;
 	}
+	CheckDeadlines();
+}
 
-	// Discard data for any pending sub calls
-	while (subCalls) {
-		ssCall_s* call = subCalls;
-		subCalls = call->next;
-		ssWipeData(call->data);
-		delete call;
+void ui_subscript_c::SetTimeout(int msec)
+{
+	if (running) {
+		timeoutAt = ui->sys->GetTime() + std::max(msec, 0);
+		CheckDeadlines();
 	}
 }
 
-void ui_subscript_c::ThreadProc()
+void ui_subscript_c::Abort()
 {
-	int numarg = (int)lua_tointeger(L, -1);
-	lua_pop(L, 1);
-	if (lua_pcall(L, numarg, LUA_MULTRET, 1)) {
-		errorStr = AllocString(lua_tostring(L, -1));
+	aborted = true;
+	Cancel(0);
+}
+
+void ui_subscript_c::CheckDeadlines()
+{
+	// Only ever flags the worker, waiting for it to stop is left to SubScriptFrame()
+	if (finished) {
+		return;
+	}
+	int now = ui->sys->GetTime();
+	if (timeoutAt && now - *timeoutAt >= 0) {
+		timeoutAt.reset();
+		timedOut = true;
+		cancelRequested = true;
+		interruptAt = now;
+	}
+	if (interruptAt && now - *interruptAt >= 0) {
+		interruptAt.reset();
+		pool->Interrupt(this);
 	}
-	finished = true;
+}
+
+void ui_subscript_c::FinishJob()
+{
+	lua_State* L = ui->L;
+	int state = SS_JOB_DONE;
+	if (timedOut) {
+		state = SS_JOB_TIMEDOUT;
+		job->error = "Sub script timed out";
+	} else if (cancelRequested) {
+		state = SS_JOB_CANCELLED;
+		job->error = "Sub script was cancelled";
+	} else if (errorStr || resultError) {
+		state = SS_JOB_FAILED;
+		job->error = errorStr ? errorStr : resultError;
+	} else {
+		lua_newtable(L);
+		int table = lua_gettop(L);
+		int n = ssUnpackValues(L, results);
+		for (int i = n; i >= 1; i--) {
+			lua_rawseti(L, table, i);
+		}
+		lua_pushinteger(L, n);
+		lua_setfield(L, table, "n");
+		job->resultsRef = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+	results = {};
+	FreeString(errorStr);
+	errorStr = nullptr;
+	FreeString(resultError);
+	resultError = nullptr;
+
+	job->subScript = nullptr;
+	job->state = state;
 }
 
 void ui_subscript_c::SubScriptFrame()
 {
 	bool didFinish = finished;
-	if (running) {
-		// Check for sub calls
-		ssCall_s* itterSubCalls = subCalls;
-		subCalls = NULL;
-		while (subWriting) ui->sys->Sleep(0);
-		while (itterSubCalls) {
-			ssCall_s* call = itterSubCalls;
+	if (running && !didFinish) {
+		CheckDeadlines();
+	}
+	if (running && aborted) {
+		// Nobody is listening any more, function calls are only answered so the script can reach the interrupt
+		DiscardCalls();
+	} else if (running) {
+		// Run sub and function calls in the order they were made
+		ssCall_s* call = calls.TakeAll();
+		while (call) {
+			ssCall_s* next = call->next;
+			int retStart = lua_gettop(ui->L) + 1;
 			int extraArgs = ui->PushCallback("OnSubCall");
 			if (extraArgs >= 0) {
 				// Run the main script
 				lua_pushstring(ui->L, call->name);
-				int numdat = ssPushData(ui->L, call->data);
-				ui->PCall(extraArgs + numdat + 1, 0);
-			} else {
-				ssWipeData(call->data);
+				int numdat = ssUnpackValues(ui->L, call->data);
+				ui->PCall(extraArgs + numdat + 1, call->isFunc ? LUA_MULTRET : 0);
 			}
-			itterSubCalls = call->next;
-			delete call;
-		}
-		
-		if (funcWaiting) {
-			// Process function call
-			int retStart = lua_gettop(ui->L) + 1;
-			bool doRet = false;
-			int extraArgs = ui->PushCallback("OnSubCall");
-			if (extraArgs >= 0) {
-				// Run the main script
-				lua_pushstring(ui->L, funcCall.name);
-				int numdat = ssPushData(ui->L, funcCall.data);
-				ui->PCall(extraArgs + numdat + 1, LUA_MULTRET);
-				doRet = true;
-
-				// Validate return value types
-				int n = lua_gettop(ui->L);
-				for (int i = retStart; i <= n; i++) {
-					if ( !(lua_isnil(ui->L, i) || lua_isboolean(ui->L, i) || lua_isnumber(ui->L, i) || lua_isstring(ui->L, i)) ) {
-						char* msg = AllocStringLen(128);
-						sprintf(msg, "OnSubCall() return %d: only nil, boolean, number and string can be returned to sub script", i - retStart + 1);
+			if (call->isFunc) {
+				// Grab return values from main script
+				call->data = {};
+				if (extraArgs >= 0) {
+					char error[128];
+					int bad = ssPackValues(ui->L, retStart, call->data, error, sizeof(error));
+					if (bad) {
+						char msg[256];
+						snprintf(msg, sizeof(msg), "OnSubCall() return %d: %s can't be returned to sub script", bad, error);
 						ui->DoError("Runtime error in", msg);
-						FreeString(msg);
-						doRet = false;
 					}
 				}
-			}
-			if (doRet) {
-				// Grab return values from main script
-				funcCall.data = ssBuildData(ui->L, retStart);
+				Reply(call);
 			} else {
-				ssWipeData(funcCall.data);
-				funcCall.data = NULL;
+				delete call;
 			}
-			funcWaiting = false;
+			call = next;
 		}
 	}
 	if (didFinish) {
 		running = false;
 		finished = false;
-		if (errorStr) {
+		if (aborted) {
+			results = {};
+			FreeString(errorStr);
+			errorStr = nullptr;
+			FreeString(resultError);
+			resultError = nullptr;
+		} else if (job) {
+			FinishJob();
+		} else if (errorStr) {
 			int extraArgs = ui->PushCallback("OnSubError");
 			if (extraArgs >= 0) {
 				lua_pushlightuserdata(ui->L, (void*)(uintptr_t)id);
@@ -452,20 +1338,14 @@ void ui_subscript_c::SubScriptFrame()
 		} else {
 			int extraArgs = ui->PushCallback("OnSubFinished");
 			if (extraArgs >= 0) {
-				// Validate return value types
-				int n = lua_gettop(L);
-				for (int i = 2; i <= n; i++) {
-					if ( !(lua_isnil(L, i) || lua_isboolean(L, i) || lua_isnumber(L, i) || lua_isstring(L, i)) ) {
-						char* msg = AllocStringLen(128);
-						sprintf(msg, "Subscript return %d: only nil, boolean, number and string can be returned from sub script", i - 1);
-						ui->DoError("Runtime error in", msg);
-						FreeString(msg);
-						lua_settop(L, 1);
-						break;
-					}
+				if (resultError) {
+					ui->DoError("Runtime error in", resultError);
+					FreeString(resultError);
+					resultError = nullptr;
 				}
 				lua_pushlightuserdata(ui->L, (void*)(uintptr_t)id);
-				ui->PCall(extraArgs + 1 + ssPushData(ui->L, ssBuildData(L, 2)), 0);
+				ui->PCall(extraArgs + 1 + ssUnpackValues(ui->L, results), 0);
+				results = {};
 			}
 		}
 	}
@@ -478,5 +1358,198 @@ bool ui_subscript_c::IsRunning()
 
 size_t ui_subscript_c::GetScriptMemory()
 {
-	return running? lua_gc(L, LUA_GCCOUNT, 0) : 0;
+	return running? pool->GetMemory(this) : 0;
+}
+
+// =====================
+// UI Parallel Map Class
+// =====================
+
+ui_parallelMap_c::ui_parallelMap_c(ui_main_c* ui, dword id, std::shared_ptr<ui_subScriptJob_s> job, int maxShards)
+	: ui(ui), id(id), job(std::move(job)), maxShards(std::max(maxShards, 1))
+{
+	this->job->subScript = this;
+}
+
+ui_parallelMap_c::~ui_parallelMap_c()
+{
+	for (ui_subscript_c* shard : shards) {
+		delete shard;
+	}
+
+	if (job->subScript == this) {
+		job->subScript = nullptr;
+		job->error = "Sub script was stopped";
+		job->state = SS_JOB_CANCELLED;
+	}
+}
+
+bool ui_parallelMap_c::Start()
+{
+	lua_State* mainL = ui->L;
+	ui_subScriptPool_c* pool = (ui_subScriptPool_c*)ui->subScriptPool;
+	auto chunk = pool->GetChunk(mainL, 1);
+	if ( !chunk ) {
+		lua_error(mainL);
+	}
+
+	// Contiguous shards of near equal size, so each worker gets one run of the list
+	itemCount = (int)lua_objlen(mainL, 2);
+	int shardCount = std::min(maxShards, itemCount);
+	char error[128];
+	for (int s = 0, first = 1; s < shardCount; s++) {
+		int count = itemCount / shardCount + (s < itemCount % shardCount ? 1 : 0);
+		auto shardJob = std::make_shared<ui_subScriptJob_s>();
+		ui_subscript_c* shard = new ui_subscript_c(ui, id, shardJob);
+		shards.push_back(shard);
+		shardJobs.push_back(std::move(shardJob));
+		lua_createtable(mainL, count, 0);
+		for (int i = 0; i < count; i++) {
+			lua_rawgeti(mainL, 2, first + i);
+			lua_rawseti(mainL, -2, i + 1);
+		}
+		if ( !shard->PrepareShard(chunk, first, count, error, sizeof(error)) ) {
+			luaL_error(mainL, "ParallelMap() argument 2: %s can't be passed to sub script", error);
+		}
+		first += count;
+	}
+
+	running = true;
+	for (ui_subscript_c* shard : shards) {
+		shard->Launch();
+	}
+	return true;
+}
+
+void ui_parallelMap_c::CancelShards(int graceMsec, int afterIndex)
+{
+	for (ui_subscript_c* shard : shards) {
+		if (shard->mapFirst > afterIndex) {
+			shard->Cancel(graceMsec);
+		}
+	}
+}
+
+void ui_parallelMap_c::Cancel(int graceMsec)
+{
+	if (running) {
+		cancelled = true;
+		CancelShards(graceMsec, 0);
+	}
+}
+
+void ui_parallelMap_c::SetTimeout(int msec)
+{
+	if (running) {
+		timeoutAt = ui->sys->GetTime() + std::max(msec, 0);
+	}
+}
+
+void ui_parallelMap_c::Abort()
+{
+	if (running) {
+		aborted = true;
+		cancelled = true;
+		CancelShards(0, 0);
+	}
+}
+
+void ui_parallelMap_c::SubScriptFrame()
+{
+	if ( !running ) {
+		return;
+	}
+	if (timeoutAt && ui->sys->GetTime() - *timeoutAt >= 0) {
+		timeoutAt.reset();
+		timedOut = true;
+		CancelShards(0, 0);
+	}
+
+	bool busy = false;
+	double done = 0.0;
+	for (size_t s = 0; s < shards.size(); s++) {
+		ui_subscript_c* shard = shards[s];
+		if (shard->IsRunning()) {
+			shard->SubScriptFrame();
+			if (shardJobs[s]->state == SS_JOB_FAILED) {
+				// Later shards can't produce an earlier failure, so their work is wasted
+				CancelShards(0, shard->mapErrorIndex);
+			}
+		}
+		busy |= shard->IsRunning();
+		done += shardJobs[s]->progress * shard->mapCount;
+	}
+	if (itemCount) {
+		job->progress = done / itemCount;
+	}
+	if ( !busy ) {
+		running = false;
+		if ( !aborted ) {
+			Finish();
+		}
+		for (auto& shardJob : shardJobs) {
+			if (shardJob->resultsRef != LUA_NOREF) {
+				luaL_unref(ui->L, LUA_REGISTRYINDEX, shardJob->resultsRef);
+				shardJob->resultsRef = LUA_NOREF;
+			}
+		}
+	}
+}
+
+void ui_parallelMap_c::Finish()
+{
+	lua_State* L = ui->L;
+	int state = SS_JOB_DONE;
+	const ui_subscript_c* failed = nullptr;
+	for (size_t s = 0; s < shards.size(); s++) {
+		if (shardJobs[s]->state == SS_JOB_FAILED && (!failed || shards[s]->mapErrorIndex < failed->mapErrorIndex)) {
+			failed = shards[s];
+			job->error = shardJobs[s]->error;
+		}
+	}
+	if (timedOut) {
+		state = SS_JOB_TIMEDOUT;
+		job->error = "Sub script timed out";
+	} else if (cancelled) {
+		state = SS_JOB_CANCELLED;
+		job->error = "Sub script was cancelled";
+	} else if (failed) {
+		state = SS_JOB_FAILED;
+	} else {
+		// Each shard returned one array of its results, copied back in item order
+		lua_newtable(L);
+		lua_createtable(L, itemCount, 0);
+		int out = lua_gettop(L);
+		for (size_t s = 0; s < shards.size(); s++) {
+			lua_rawgeti(L, LUA_REGISTRYINDEX, shardJobs[s]->resultsRef);
+			lua_rawgeti(L, -1, 1);
+			for (int i = 1; i <= shards[s]->mapCount; i++) {
+				lua_rawgeti(L, -1, i);
+				lua_rawseti(L, out, shards[s]->mapFirst + i - 1);
+			}
+			lua_pop(L, 2);
+		}
+		lua_rawseti(L, out - 1, 1);
+		lua_pushinteger(L, 1);
+		lua_setfield(L, -2, "n");
+		job->resultsRef = luaL_ref(L, LUA_REGISTRYINDEX);
+		job->progress = 1.0;
+	}
+
+	job->subScript = nullptr;
+	job->state = state;
+}
+
+bool ui_parallelMap_c::IsRunning()
+{
+	return running;
+}
+
+size_t ui_parallelMap_c::GetScriptMemory()
+{
+	size_t total = 0;
+	for (ui_subscript_c* shard : shards) {
+		total += shard->GetScriptMemory();
+	}
+	return total;
 }
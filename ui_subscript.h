@@ -4,6 +4,29 @@
 // UI Sub Script Header
 //
 
+#include <atomic>
+
+// =======
+// Classes
+// =======
+
+enum ui_subScriptJobState_e {
+	SS_JOB_RUNNING,
+	SS_JOB_DONE,
+	SS_JOB_FAILED,
+	SS_JOB_CANCELLED,
+	SS_JOB_TIMEDOUT,
+};
+
+// Outcome of a sub script launched as a job, shared by the sub script and the Lua job handle
+struct ui_subScriptJob_s {
+	std::atomic<int> state = SS_JOB_RUNNING;	// Set once the outcome below is complete, so it can be polled without locking
+	std::atomic<double> progress = 0.0;			// Last value reported by the sub script
+	class ui_ISubScript* subScript = nullptr;	// Main thread only, cleared when the state is set
+	int		resultsRef = LUA_NOREF;				// Main thread only, table of return values in the main state registry
+	std::string error;							// Main thread only
+};
+
 // ==========
 // Interfaces
 // ==========
@@ -11,11 +34,28 @@
 // UI Sub Script Handler
 class ui_ISubScript {
 public:
-	static ui_ISubScript* GetHandle(class ui_main_c*, dword id);
+	static ui_ISubScript* GetHandle(class ui_main_c*, dword id, std::shared_ptr<ui_subScriptJob_s> job = nullptr);
+	// Shards an input list over up to maxShards workers; Start() takes the function source and the list from the Lua stack
+	static ui_ISubScript* GetMapHandle(class ui_main_c*, dword id, std::shared_ptr<ui_subScriptJob_s> job, int maxShards);
 	static void FreeHandle(ui_ISubScript*);
+	virtual ~ui_ISubScript() = default;		// Freed through the interface, as there is more than one implementation
 
 	virtual bool	Start() = 0;
 	virtual	void	SubScriptFrame() = 0;
-	virtual bool	IsRunning() = 0;
+	virtual bool	IsRunning() = 0;	// Stays true after a cancel until the script has actually stopped
 	virtual size_t	GetScriptMemory() = 0;
+	// None of these wait for the script; it sees IsCancelRequested() straight away and is interrupted after graceMsec
+	virtual void	Cancel(int graceMsec) = 0;
+	virtual void	SetTimeout(int msec) = 0;	// Cancels without grace if still running msec from now
+	virtual void	Abort() = 0;				// Cancels without grace and drops all further calls and callbacks
+};
+
+// UI Sub Script Worker Pool
+// Long-lived threads that each own a Lua state, reused by every sub script launched from one script instance
+class ui_ISubScriptPool {
+public:
+	static ui_ISubScriptPool* GetHandle(class ui_main_c*);
+	static void FreeHandle(ui_ISubScriptPool*);
+
+	virtual dword	GetWorkerCount() = 0;
 };
\ No newline at end of file